@@ -0,0 +1,105 @@
+#include "Bench.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+BenchState::BenchState(const BenchOptions& options)
+    : options_(options)
+{
+    samples_ns_.reserve(options.iterations);
+}
+
+void BenchState::PauseTiming(void)
+{
+    pause_start_ns_ = MonotonicNs();
+}
+
+void BenchState::ResumeTiming(void)
+{
+    paused_ns_ += MonotonicNs() - pause_start_ns_;
+}
+
+BenchRunner::BenchRunner(const BenchOptions& options)
+    : options_(options)
+{
+}
+
+void BenchRunner::Add(const std::string& name, const std::function<void(BenchState&)>& bench)
+{
+    cases_.push_back({ name, bench });
+}
+
+static inline uint64_t Percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+bool BenchRunner::Run(void)
+{
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "{{\n  \"width\": {},\n  \"height\": {},\n  \"iterations\": {},\n  \"results\": [",
+        options_.width, options_.height, options_.iterations);
+
+    bool first = true;
+    bool ok = true;
+    for (auto& item : cases_) {
+        if (!options_.filter.empty() && item.name.find(options_.filter) == std::string::npos) {
+            continue;
+        }
+
+        spdlog::info("Bench {}", item.name);
+        BenchState state(options_);
+        auto start_ns = MonotonicNs();
+        item.bench(state);
+        auto wall_ns = MonotonicNs() - start_ns - state.paused_ns_;
+
+        auto& samples = state.samples_ns_;
+        std::sort(samples.begin(), samples.end());
+        uint64_t total_ns = 0;
+        for (auto sample : samples) {
+            total_ns += sample;
+        }
+        auto calls = samples.size();
+        double seconds = wall_ns / 1e9;
+
+        fmt::format_to(it, "{}\n    {{\n      \"name\": \"{}\",\n      \"calls\": {},\n      \"seconds\": {:.6f},\n"
+                           "      \"calls_per_sec\": {:.1f},\n      \"ns_per_call\": {{ \"mean\": {:.1f}, \"min\": {}, "
+                           "\"p50\": {}, \"p90\": {}, \"p99\": {}, \"max\": {} }}",
+            first ? "" : ",", item.name, calls, seconds, seconds > 0 ? calls / seconds : 0.0,
+            calls > 0 ? (double)total_ns / calls : 0.0, calls > 0 ? samples.front() : 0,
+            Percentile(samples, 0.5), Percentile(samples, 0.9), Percentile(samples, 0.99),
+            calls > 0 ? samples.back() : 0);
+        for (auto& counter : state.counters_) {
+            fmt::format_to(it, ",\n      \"{}\": {:.3f}", counter.first, counter.second);
+        }
+        if (!state.error_.empty()) {
+            spdlog::error("Bench {} failed: {}", item.name, state.error_);
+            fmt::format_to(it, ",\n      \"error\": \"{}\"", state.error_);
+            ok = false;
+        }
+        fmt::format_to(it, "\n    }}");
+        first = false;
+    }
+    fmt::format_to(it, "\n  ]\n}}\n");
+
+    if (options_.out.empty()) {
+        fwrite(out.data(), 1, out.size(), stdout);
+        return ok;
+    }
+    auto file = fopen(options_.out.c_str(), "w");
+    if (file == nullptr) {
+        spdlog::error("Can not open {}", options_.out);
+        return false;
+    }
+    auto ret = fwrite(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return ret && ok;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "VideoFrame.h"
+
+struct BenchOptions {
+    uint64_t iterations = 10000;
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    // only cases whose name contains filter
+    std::string filter;
+    // JSON goes to stdout if empty
+    std::string out;
+};
+
+/*
+ * Handed to a case. The case runs Iterations() calls and reports the duration
+ * of each one with AddSample (or times a callable with Measure).
+ */
+class BenchState {
+public:
+    BenchState(const BenchOptions& options);
+
+    uint64_t Iterations(void) const { return options_.iterations; }
+    const BenchOptions& Options(void) const { return options_; }
+
+    void AddSample(uint64_t ns) { samples_ns_.push_back(ns); }
+
+    template <typename F>
+    void Measure(F&& call)
+    {
+        auto start_ns = MonotonicNs();
+        call();
+        AddSample(MonotonicNs() - start_ns);
+    }
+
+    // extra figures in the result, e.g. bytes per second
+    void SetCounter(const std::string& name, double value) { counters_[name] = value; }
+
+    // marks the case failed, e.g. a kernel that does not match its reference
+    void SetError(const std::string& error) { error_ = error; }
+
+    // excluded from the case wall time, e.g. setup
+    void PauseTiming(void);
+    void ResumeTiming(void);
+
+private:
+    friend class BenchRunner;
+
+    BenchOptions options_;
+    std::vector<uint64_t> samples_ns_;
+    std::map<std::string, double> counters_;
+    std::string error_;
+    uint64_t paused_ns_ = 0;
+    uint64_t pause_start_ns_ = 0;
+};
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const BenchOptions& options);
+
+    void Add(const std::string& name, const std::function<void(BenchState&)>& bench);
+
+    // false if a case failed or the result could not be written
+    bool Run(void);
+
+private:
+    struct Case {
+        std::string name;
+        std::function<void(BenchState&)> bench;
+    };
+
+    BenchOptions options_;
+    std::vector<Case> cases_;
+};
+
+void RegisterCaptureBench(BenchRunner& runner);
+void RegisterChainBench(BenchRunner& runner);
+void RegisterConvertBench(BenchRunner& runner);
+void RegisterEncoderBench(BenchRunner& runner);
+void RegisterNalBench(BenchRunner& runner);
+void RegisterScaleBench(BenchRunner& runner);
+void RegisterSinkBench(BenchRunner& runner);
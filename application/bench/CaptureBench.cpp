@@ -0,0 +1,95 @@
+#include <atomic>
+#include <thread>
+
+#include "Bench.h"
+#include "FrameQueue.h"
+#include "PatternCapture.h"
+
+namespace {
+
+CaptureSourceInfo PatternInfo(const BenchState& state)
+{
+    CaptureSourceInfo info;
+    info.type = CaptureSourceType::Pattern;
+    info.width = state.Options().width;
+    info.height = state.Options().height;
+    info.pixelformat = "NV12";
+    // as fast as the loop goes
+    info.fps = 0;
+    info.buf_count = 5;
+    return info;
+}
+
+// source loop + callback dispatch, the sample is the time between two callbacks
+void BenchDispatch(BenchState& state)
+{
+    state.PauseTiming();
+    PatternCapture capture(PatternInfo(state));
+    if (!capture.Init()) {
+        return;
+    }
+    state.ResumeTiming();
+
+    uint64_t count = 0;
+    uint64_t last_ns = 0;
+    capture.Setup([&](PlaneData& plane, int dma_fd) {
+        auto now_ns = MonotonicNs();
+        if (last_ns != 0) {
+            state.AddSample(now_ns - last_ns);
+        }
+        last_ns = now_ns;
+        if (++count > state.Iterations()) {
+            capture.Stop();
+        }
+    });
+    state.SetCounter("bytes_per_frame", CaptureFrameSize("NV12", state.Options().width, state.Options().height));
+}
+
+// FrameRef through FrameQueue to a consumer thread, the sample is Push
+void BenchQueueHandoff(BenchState& state, DropPolicy policy)
+{
+    state.PauseTiming();
+    PatternCapture capture(PatternInfo(state));
+    if (!capture.Init()) {
+        return;
+    }
+    state.ResumeTiming();
+
+    FrameQueue queue(FrameQueueInfo { policy, 3, 0 });
+    std::atomic<bool> running { true };
+    uint64_t handoff_us = 0;
+    uint64_t popped = 0;
+    std::thread consumer([&]() {
+        while (running) {
+            FrameRef frame;
+            if (!queue.Pop(frame, 10000)) {
+                continue;
+            }
+            handoff_us += MonotonicUs() - frame->meta.timestamp_us;
+            popped++;
+        }
+    });
+
+    uint64_t count = 0;
+    capture.Setup([&](FrameRef frame) {
+        state.Measure([&]() { queue.Push(std::move(frame), capture.InFlight()); });
+        if (++count >= state.Iterations()) {
+            capture.Stop();
+        }
+    });
+    running = false;
+    consumer.join();
+
+    state.SetCounter("dropped", queue.Dropped());
+    state.SetCounter("handoff_us_mean", popped > 0 ? (double)handoff_us / popped : 0.0);
+}
+
+} // namespace
+
+void RegisterCaptureBench(BenchRunner& runner)
+{
+    runner.Add("capture/dispatch", BenchDispatch);
+    runner.Add("capture/queue_handoff", [](BenchState& state) { BenchQueueHandoff(state, DropPolicy::DropNewest); });
+    runner.Add("capture/queue_handoff_oldest", [](BenchState& state) { BenchQueueHandoff(state, DropPolicy::DropOldest); });
+    runner.Add("capture/queue_handoff_latest", [](BenchState& state) { BenchQueueHandoff(state, DropPolicy::KeepLatest); });
+}
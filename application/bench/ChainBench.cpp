@@ -0,0 +1,140 @@
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "FrameChain.h"
+
+namespace {
+
+// frames per sample, one call is too short for the clock
+constexpr uint64_t kBatch = 100;
+
+// the source frame lives on the stack of the bench
+struct StaticOwner : FrameOwner {
+    void ReleaseFrame(VideoFrame& frame) override { }
+};
+
+// "encodes" every frame into the same small packet, right away
+template <typename Packets>
+class NullEncoder final : public VideoEncoder {
+public:
+    explicit NullEncoder(Packets packets)
+        : packets_(std::move(packets))
+    {
+    }
+
+    bool Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback) override
+    {
+        return true;
+    }
+    bool PutFrame(uint8_t* data, uint32_t size, int dma_fd) override { return false; }
+    bool PutFrame(FrameRef frame) override
+    {
+        packets_(packet_, sizeof(packet_), frame->meta);
+        return true;
+    }
+    void Stop(void) override { }
+
+private:
+    Packets packets_;
+    uint8_t packet_[64] = { 0, 0, 0, 1 };
+};
+
+// what every variant does per frame: a transform and two sinks
+struct Work {
+    uint64_t stamped = 0;
+    uint64_t sink_bytes[2] = { 0, 0 };
+};
+
+// the frame path as it is wired today: a std::function per stage, a virtual PutFrame
+void BenchFunctions(BenchState& state)
+{
+    Work work;
+    NalParser parser(NalCodec::H264);
+    std::vector<std::function<void(uint8_t*, uint32_t, const FrameMeta&, const AccessUnit&)>> sinks;
+    for (auto& bytes : work.sink_bytes) {
+        sinks.push_back(
+            [&bytes](uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit) { bytes += size; });
+    }
+    std::function<void(uint8_t*, uint32_t, const FrameMeta&)> package_callback =
+        [&sinks, &parser](uint8_t* data, uint32_t size, const FrameMeta& meta) {
+            auto& unit = parser.Parse(data, size);
+            for (auto& sink : sinks) {
+                sink(data, size, meta, unit);
+            }
+        };
+    NullEncoder<std::function<void(uint8_t*, uint32_t, const FrameMeta&)>> null_encoder(package_callback);
+    VideoEncoder* encoder = &null_encoder;
+    std::function<bool(FrameRef&)> transform = [&work](FrameRef& frame) {
+        frame->meta.sequence = ++work.stamped;
+        return true;
+    };
+    std::function<void(FrameRef)> callback = [&](FrameRef frame) {
+        if (transform(frame)) {
+            encoder->PutFrame(std::move(frame));
+        }
+    };
+
+    StaticOwner owner;
+    VideoFrame source;
+    source.owner = &owner;
+    auto frame = FrameRef::Adopt(&source);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() {
+            for (uint64_t k = 0; k < kBatch; k++) {
+                callback(frame);
+            }
+        });
+    }
+    frame.Reset();
+    state.SetCounter("frames_per_sample", kBatch);
+    state.SetCounter("sink_bytes", work.sink_bytes[0] + work.sink_bytes[1]);
+}
+
+// the same stages composed with FrameChain and PacketFanout, through the
+// runtime adapter (one std::function at the capture boundary) or called directly
+void BenchChain(BenchState& state, bool adapter)
+{
+    Work work;
+    NalParser parser(NalCodec::H264);
+    auto sink = [](uint64_t& bytes) {
+        return [&bytes](uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit) { bytes += size; };
+    };
+    NullEncoder encoder(PacketFanout(parser, sink(work.sink_bytes[0]), sink(work.sink_bytes[1])));
+    FrameChain chain(
+        [&work](FrameRef& frame) {
+            frame->meta.sequence = ++work.stamped;
+            return true;
+        },
+        EncodeStage<decltype(encoder)> { encoder });
+    auto callback = chain.Callback();
+
+    StaticOwner owner;
+    VideoFrame source;
+    source.owner = &owner;
+    auto frame = FrameRef::Adopt(&source);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() {
+            for (uint64_t k = 0; k < kBatch; k++) {
+                if (adapter) {
+                    callback(frame);
+                } else {
+                    chain(frame);
+                }
+            }
+        });
+    }
+    frame.Reset();
+    state.SetCounter("frames_per_sample", kBatch);
+    state.SetCounter("sink_bytes", work.sink_bytes[0] + work.sink_bytes[1]);
+}
+
+} // namespace
+
+void RegisterChainBench(BenchRunner& runner)
+{
+    runner.Add("chain/std_function", BenchFunctions);
+    runner.Add("chain/frame_chain", [](BenchState& state) { BenchChain(state, false); });
+    runner.Add("chain/frame_chain_callback", [](BenchState& state) { BenchChain(state, true); });
+}
@@ -0,0 +1,125 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "ColorConverter.h"
+
+namespace {
+
+// every byte value shows up, unlike the flat color bars
+std::vector<uint8_t> NoiseImage(size_t size)
+{
+    std::vector<uint8_t> image(size);
+    uint32_t state = 0x12345678;
+    for (auto& byte : image) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = state >> 24;
+    }
+    return image;
+}
+
+struct Nv12Image {
+    uint32_t stride;
+    uint32_t height;
+    std::vector<uint8_t> data;
+
+    Nv12Image(uint32_t width, uint32_t height)
+        : stride((width + 63) / 64 * 64)
+        , height(height)
+        , data(stride * height * 3 / 2, 0)
+    {
+    }
+
+    BgrToNv12Job Job(const uint8_t* bgr, uint32_t bgr_stride, uint32_t width)
+    {
+        return { bgr, bgr_stride, data.data(), data.data() + stride * height, stride, width };
+    }
+};
+
+// the source frame lives on the stack of the bench
+struct StaticOwner : FrameOwner {
+    void ReleaseFrame(VideoFrame& frame) override { }
+};
+
+// bytes of kernel output that differ from the scalar reference, width may leave a SIMD tail
+size_t Mismatch(ConvertKernel kernel, uint32_t width, uint32_t height)
+{
+    auto bgr_stride = width * 3;
+    auto bgr = NoiseImage(bgr_stride * height);
+    Nv12Image reference(width, height);
+    Nv12Image result(width, height);
+    BgrToNv12Scalar(reference.Job(bgr.data(), bgr_stride, width), 0, height);
+    BgrToNv12(kernel, result.Job(bgr.data(), bgr_stride, width), 0, height);
+
+    size_t mismatch = 0;
+    for (size_t i = 0; i < reference.data.size(); i++) {
+        mismatch += reference.data[i] != result.data[i];
+    }
+    return mismatch;
+}
+
+// one kernel on one thread over a whole frame, checked against scalar first
+void BenchKernel(BenchState& state, ConvertKernel kernel)
+{
+    const auto width = state.Options().width;
+    const auto height = state.Options().height;
+    if (kernel != ConvertKernel::Scalar) {
+        state.PauseTiming();
+        auto mismatch = Mismatch(kernel, width, height) + Mismatch(kernel, width - 2, height);
+        state.ResumeTiming();
+        state.SetCounter("mismatch_bytes", mismatch);
+        if (mismatch != 0) {
+            state.SetError(std::string(ConvertKernelName(kernel)) + " differs from scalar");
+            return;
+        }
+    }
+
+    auto bgr = NoiseImage(width * height * 3);
+    Nv12Image nv12(width, height);
+    auto job = nv12.Job(bgr.data(), width * 3, width);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() { BgrToNv12(kernel, job, 0, height); });
+    }
+    state.SetCounter("bytes_per_frame", bgr.size());
+}
+
+// ColorConverter with the fastest kernel and its worker threads
+void BenchConverter(BenchState& state)
+{
+    const auto width = state.Options().width;
+    const auto height = state.Options().height;
+    ColorConverter converter(width, height);
+    if (!converter.Init()) {
+        state.SetError("converter init failed");
+        return;
+    }
+
+    auto bgr = NoiseImage(width * height * 3);
+    StaticOwner owner;
+    VideoFrame source;
+    source.owner = &owner;
+    source.planes = { PlaneData { bgr.data(), (uint32_t)bgr.size() } };
+    auto frame = FrameRef::Adopt(&source);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() { converter.Convert(frame); });
+    }
+    frame.Reset();
+    state.SetCounter("bytes_per_frame", bgr.size());
+}
+
+} // namespace
+
+void RegisterConvertBench(BenchRunner& runner)
+{
+    for (auto kernel : { ConvertKernel::Scalar, ConvertKernel::Avx2, ConvertKernel::Neon }) {
+        if (!ConvertKernelSupported(kernel)) {
+            continue;
+        }
+        runner.Add(std::string("convert/bgr_to_nv12_") + std::string(ConvertKernelName(kernel)),
+            [kernel](BenchState& state) { BenchKernel(state, kernel); });
+    }
+    runner.Add("convert/converter", BenchConverter);
+}
@@ -0,0 +1,204 @@
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "Bench.h"
+#include "AvEncoder.h"
+#include "CaptureSource.h"
+#include "MppEncoder.h"
+#include "PatternCapture.h"
+
+/*
+ * The encoder paths around encode_put_frame / encode_get_packet, run without
+ * an mpp context. Buffers come from a NORMAL (malloc) group so no VPU or dma
+ * heap is needed.
+ */
+struct MppEncoderBench {
+    static uint32_t Align16(uint32_t x) { return (x + 15) & ~15u; }
+
+    static FrameInfo Frame(const BenchState& state)
+    {
+        return { state.Options().height, state.Options().width, "NV12", 60 };
+    }
+
+    // what Init would set up for NV12
+    static void Prepare(MppEncoder& encoder)
+    {
+        encoder.prep_cfg_.width = encoder.frame_info_.width;
+        encoder.prep_cfg_.height = encoder.frame_info_.height;
+        encoder.prep_cfg_.format = MPP_FMT_YUV420SP;
+        encoder.prep_cfg_.hor_stride = Align16(encoder.frame_info_.width);
+        encoder.prep_cfg_.ver_stride = Align16(encoder.frame_info_.height);
+        encoder.frame_buf_size_ = encoder.prep_cfg_.hor_stride * encoder.prep_cfg_.ver_stride * 3 / 2;
+    }
+
+    static MppBuffer NormalBuffer(MppBufferGroup group, size_t size)
+    {
+        MppBuffer buffer = nullptr;
+        if (mpp_buffer_get(group, &buffer, size) != MPP_SUCCESS) {
+            spdlog::error("Get normal buffer error");
+            return nullptr;
+        }
+        return buffer;
+    }
+
+    // MppFrame built for every frame, what the uncached dma path did
+    static void FrameSetupPerFrame(BenchState& state)
+    {
+        MppEncoder encoder(Frame(state), { "H265", 120 });
+        Prepare(encoder);
+        MppBufferGroup group = nullptr;
+        mpp_buffer_group_get_internal(&group, MPP_BUFFER_TYPE_NORMAL);
+        auto buffer = NormalBuffer(group, encoder.frame_buf_size_);
+        if (buffer == nullptr) {
+            mpp_buffer_group_put(group);
+            return;
+        }
+
+        for (uint64_t i = 0; i < state.Iterations(); i++) {
+            state.Measure([&]() {
+                mpp_buffer_inc_ref(buffer);
+                auto frame = encoder.NewFrame(buffer);
+                mpp_buffer_put(buffer);
+                mpp_frame_set_pts(frame, i);
+                mpp_frame_deinit(&frame);
+            });
+        }
+        mpp_buffer_put(buffer);
+        mpp_buffer_group_put(group);
+    }
+
+    // ImportFrame hitting the per index cache, the steady state of the dma path
+    static void FrameSetupCached(BenchState& state)
+    {
+        MppEncoder encoder(Frame(state), { "H265", 120 });
+        Prepare(encoder);
+        MppBufferGroup group = nullptr;
+        mpp_buffer_group_get_internal(&group, MPP_BUFFER_TYPE_NORMAL);
+
+        const int buf_count = 5;
+        std::vector<VideoFrame> frames(buf_count);
+        encoder.import_slots_.resize(buf_count);
+        for (int i = 0; i < buf_count; i++) {
+            // never dereferenced, only compared by the cache
+            frames[i].index = i;
+            frames[i].dma_fd = 100 + i;
+            auto& slot = encoder.import_slots_[i];
+            slot.buffer = NormalBuffer(group, encoder.frame_buf_size_);
+            slot.frame = encoder.NewFrame(slot.buffer);
+            slot.dma_fd = frames[i].dma_fd;
+        }
+
+        for (uint64_t i = 0; i < state.Iterations(); i++) {
+            auto& frame = frames[i % buf_count];
+            state.Measure([&]() {
+                auto mpp_frame = encoder.ImportFrame(frame);
+                mpp_frame_set_pts(mpp_frame, i);
+            });
+        }
+        encoder.ClearImportCache();
+        mpp_buffer_group_put(group);
+    }
+
+    // memory sources, copy into a stride aligned encoder buffer
+    static void CopyFrame(BenchState& state)
+    {
+        MppEncoder encoder(Frame(state), { "H265", 120 });
+        Prepare(encoder);
+        mpp_buffer_group_get_internal(&encoder.frame_group_, MPP_BUFFER_TYPE_NORMAL);
+        auto size = CaptureFrameSize("NV12", encoder.frame_info_.width, encoder.frame_info_.height);
+        std::vector<uint8_t> data(size, 0x80);
+
+        for (uint64_t i = 0; i < state.Iterations(); i++) {
+            state.Measure([&]() {
+                MppBuffer buffer = nullptr;
+                if (encoder.CopyFrame(data.data(), size, buffer)) {
+                    mpp_buffer_put(buffer);
+                }
+            });
+        }
+        state.SetCounter("bytes_per_frame", size);
+    }
+
+    // packet out of the encoder -> in flight frame released -> callback
+    static void Packet(BenchState& state)
+    {
+        MppEncoder encoder(Frame(state), { "H265", 120 });
+        PipelineMetrics metrics;
+        encoder.SetMetrics(&metrics);
+        uint64_t bytes = 0;
+        encoder.package_callback_ = [&bytes](uint8_t* data, uint32_t size, const FrameMeta& meta) {
+            bytes += size;
+        };
+        std::vector<uint8_t> payload(64 * 1024, 0);
+
+        for (uint64_t i = 0; i < state.Iterations(); i++) {
+            FrameMeta meta;
+            meta.sequence = i;
+            meta.timestamp_us = i + 1;
+            encoder.in_flight_.enqueue(MppEncoder::InFlightFrame { meta, FrameRef(), MonotonicUs() });
+
+            MppPacket packet = nullptr;
+            mpp_packet_init(&packet, payload.data(), payload.size());
+            mpp_packet_set_pts(packet, meta.timestamp_us);
+            state.Measure([&]() { encoder.OnPacket(packet); });
+            mpp_packet_deinit(&packet);
+        }
+        state.SetCounter("packet_bytes", payload.size());
+    }
+};
+
+namespace {
+
+// a software encode costs milliseconds, keep the run short
+constexpr uint64_t kAvFrames = 600;
+
+// whole libavcodec encode of pattern frames, send_frame + receive_packet
+void BenchAvEncode(BenchState& state)
+{
+    state.PauseTiming();
+    CaptureSourceInfo info;
+    info.type = CaptureSourceType::Pattern;
+    info.width = state.Options().width;
+    info.height = state.Options().height;
+    info.pixelformat = "NV12";
+    PatternCapture capture(info);
+    if (!capture.Init()) {
+        return;
+    }
+
+    AvEncoder encoder({ info.height, info.width, "NV12", 60 }, { "H265", 120 });
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    if (!encoder.Init([&](uint8_t* data, uint32_t size, const FrameMeta& meta) {
+            bytes += size;
+            packets++;
+        })) {
+        return;
+    }
+    state.ResumeTiming();
+
+    auto frames = std::min(state.Iterations(), kAvFrames);
+    uint64_t count = 0;
+    capture.Setup([&](FrameRef frame) {
+        state.Measure([&]() { encoder.PutFrame(std::move(frame)); });
+        if (++count >= frames) {
+            capture.Stop();
+        }
+    });
+    state.SetCounter("packets", packets);
+    state.SetCounter("bytes_per_packet", packets > 0 ? (double)bytes / packets : 0.0);
+}
+
+} // namespace
+
+void RegisterEncoderBench(BenchRunner& runner)
+{
+    runner.Add("encoder/frame_setup_per_frame", MppEncoderBench::FrameSetupPerFrame);
+    runner.Add("encoder/frame_setup_cached", MppEncoderBench::FrameSetupCached);
+    runner.Add("encoder/copy_frame", MppEncoderBench::CopyFrame);
+    runner.Add("encoder/packet", MppEncoderBench::Packet);
+    runner.Add("encoder/av_encode", BenchAvEncode);
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "NalParser.h"
+
+namespace {
+
+// a GOP of H265 packets with random slice payloads, emulation prevented like encoder output
+std::vector<uint8_t> SyntheticBitstream(uint32_t width, uint32_t height, uint32_t gop)
+{
+    std::vector<uint8_t> stream;
+    uint32_t state = 0x9e3779b9;
+    auto append = [&](uint8_t nal_type, size_t payload) {
+        static const uint8_t kStartCode[] = { 0, 0, 0, 1 };
+        stream.insert(stream.end(), kStartCode, kStartCode + sizeof(kStartCode));
+        stream.push_back(nal_type << 1);
+        stream.push_back(1);
+        int zeros = 0;
+        for (size_t i = 0; i < payload; i++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            // plenty of zero bytes, the scan can not skip them
+            uint8_t byte = (state >> 24) < 32 ? 0 : state >> 24;
+            if (zeros == 2 && byte <= 3) {
+                stream.push_back(3);
+                zeros = 0;
+            }
+            stream.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        // rbsp trailing bits, a slice never ends on a zero byte
+        stream.push_back(0x80);
+    };
+
+    auto frame_size = width * height;
+    append(32, 24);
+    append(33, 40);
+    append(34, 8);
+    append(19, frame_size / 20);
+    for (uint32_t i = 1; i < gop; i++) {
+        // a few slices per frame
+        for (int slice = 0; slice < 4; slice++) {
+            append(1, frame_size / 400);
+        }
+    }
+    return stream;
+}
+
+bool SameUnits(const AccessUnit& a, const AccessUnit& b)
+{
+    if (a.nals.size() != b.nals.size() || a.key != b.key || a.parameter_set_bytes != b.parameter_set_bytes
+        || a.slice_bytes != b.slice_bytes) {
+        return false;
+    }
+    for (size_t i = 0; i < a.nals.size(); i++) {
+        if (a.nals[i].data != b.nals[i].data || a.nals[i].size != b.nals[i].size
+            || a.nals[i].header != b.nals[i].header || a.nals[i].type != b.nals[i].type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one parse of a whole gop, i.e. throughput on a large bitstream
+void BenchParse(BenchState& state, StartCodeKernel kernel)
+{
+    auto stream = SyntheticBitstream(state.Options().width, state.Options().height, 120);
+    NalParser parser(NalCodec::H265, kernel);
+    if (kernel != StartCodeKernel::Scalar) {
+        state.PauseTiming();
+        NalParser reference(NalCodec::H265, StartCodeKernel::Scalar);
+        auto& expected = reference.Parse(stream.data(), stream.size());
+        auto same = SameUnits(expected, parser.Parse(stream.data(), stream.size()));
+        // shifted by one, the vector loads are no longer aligned to the start codes
+        auto& expected_odd = reference.Parse(stream.data() + 1, stream.size() - 1);
+        same = same && SameUnits(expected_odd, parser.Parse(stream.data() + 1, stream.size() - 1));
+        state.ResumeTiming();
+        if (!same) {
+            state.SetError(std::string(StartCodeKernelName(kernel)) + " differs from scalar");
+            return;
+        }
+    }
+
+    const auto iterations = std::min<uint64_t>(state.Iterations(), 200);
+    size_t nals = 0;
+    uint64_t total_ns = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        auto start_ns = MonotonicNs();
+        nals = parser.Parse(stream.data(), stream.size()).nals.size();
+        auto ns = MonotonicNs() - start_ns;
+        state.AddSample(ns);
+        total_ns += ns;
+    }
+    state.SetCounter("bytes_per_call", stream.size());
+    state.SetCounter("nals_per_call", nals);
+    if (total_ns != 0) {
+        state.SetCounter("mb_per_sec", (double)stream.size() * iterations * 1000 / total_ns);
+    }
+}
+
+} // namespace
+
+void RegisterNalBench(BenchRunner& runner)
+{
+    for (auto kernel : { StartCodeKernel::Scalar, StartCodeKernel::Sse2, StartCodeKernel::Avx2, StartCodeKernel::Neon }) {
+        if (!StartCodeKernelSupported(kernel)) {
+            continue;
+        }
+        runner.Add(std::string("nal/parse_") + std::string(StartCodeKernelName(kernel)),
+            [kernel](BenchState& state) { BenchParse(state, kernel); });
+    }
+}
@@ -0,0 +1,192 @@
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "FrameScaler.h"
+
+namespace {
+
+// every byte value shows up, unlike the flat color bars
+std::vector<uint8_t> NoiseImage(size_t size)
+{
+    std::vector<uint8_t> image(size);
+    uint32_t state = 0x9E3779B9;
+    for (auto& byte : image) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = state >> 24;
+    }
+    return image;
+}
+
+struct Nv12Image {
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    std::vector<uint8_t> data;
+
+    Nv12Image(uint32_t width, uint32_t height)
+        : width(width)
+        , height(height)
+        , stride((width + 63) / 64 * 64)
+        , data(stride * height * 3 / 2, 0)
+    {
+    }
+
+    uint8_t* Y(void) { return data.data(); }
+    uint8_t* UV(void) { return data.data() + stride * height; }
+};
+
+// the source frame lives on the stack of the bench
+struct StaticOwner : FrameOwner {
+    void ReleaseFrame(VideoFrame& frame) override { }
+};
+
+// one case: the destination size and filter for a source size
+struct ScaleCase {
+    const char* name;
+    ScaleFilter filter;
+    // Box, 2 or 4. Bilinear scales to a third, a size no box fits
+    uint32_t factor;
+};
+
+constexpr ScaleCase kCases[] = {
+    { "box_half", ScaleFilter::Box, 2 },
+    { "box_quarter", ScaleFilter::Box, 4 },
+    { "bilinear_third", ScaleFilter::Bilinear, 3 },
+};
+
+uint32_t Scaled(uint32_t size, const ScaleCase& scale)
+{
+    return size / scale.factor & ~1U;
+}
+
+Nv12ScaleJob MakeJob(Nv12Image& src, Nv12Image& dst, const ScaleCase& scale, const BilinearTaps* taps)
+{
+    return { src.Y(), src.UV(), src.stride, src.width, src.height, dst.Y(), dst.UV(), dst.stride, dst.width,
+        dst.height, scale.filter, scale.factor, taps };
+}
+
+// bytes of kernel output that differ from the scalar reference, width may leave a SIMD tail
+size_t Mismatch(ConvertKernel kernel, const ScaleCase& scale, uint32_t width, uint32_t height)
+{
+    Nv12Image src(width, height);
+    src.data = NoiseImage(src.data.size());
+    Nv12Image reference(Scaled(width, scale), Scaled(height, scale));
+    Nv12Image result(reference.width, reference.height);
+    auto taps = MakeBilinearTaps(width, height, reference.width, reference.height);
+    ScaleNv12Scalar(MakeJob(src, reference, scale, &taps), 0, reference.height);
+    ScaleNv12(kernel, MakeJob(src, result, scale, &taps), 0, result.height);
+
+    size_t mismatch = 0;
+    for (size_t i = 0; i < reference.data.size(); i++) {
+        mismatch += reference.data[i] != result.data[i];
+    }
+    return mismatch;
+}
+
+// one kernel on one thread over a whole frame, checked against scalar first
+void BenchKernel(BenchState& state, ConvertKernel kernel, const ScaleCase& scale)
+{
+    const auto width = state.Options().width;
+    const auto height = state.Options().height;
+    if (kernel != ConvertKernel::Scalar) {
+        state.PauseTiming();
+        auto mismatch = Mismatch(kernel, scale, width, height) + Mismatch(kernel, scale, width - 4, height);
+        state.ResumeTiming();
+        state.SetCounter("mismatch_bytes", mismatch);
+        if (mismatch != 0) {
+            state.SetError(std::string(ConvertKernelName(kernel)) + " differs from scalar");
+            return;
+        }
+    }
+
+    Nv12Image src(width, height);
+    src.data = NoiseImage(src.data.size());
+    Nv12Image dst(Scaled(width, scale), Scaled(height, scale));
+    auto taps = MakeBilinearTaps(width, height, dst.width, dst.height);
+    auto job = MakeJob(src, dst, scale, &taps);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() { ScaleNv12(kernel, job, 0, dst.height); });
+    }
+    state.SetCounter("bytes_per_frame", src.data.size());
+    state.SetCounter("scaled_bytes_per_frame", dst.data.size());
+}
+
+// FrameScaler with the fastest kernel and its worker threads
+void BenchScaler(BenchState& state, const ScaleCase& scale)
+{
+    const auto width = state.Options().width;
+    const auto height = state.Options().height;
+    Nv12Image src(width, height);
+    src.data = NoiseImage(src.data.size());
+    FrameScaler scaler(width, height, src.stride, height, Scaled(width, scale), Scaled(height, scale), scale.filter);
+    if (!scaler.Init()) {
+        state.SetError("scaler init failed");
+        return;
+    }
+
+    StaticOwner owner;
+    VideoFrame source;
+    source.owner = &owner;
+    source.planes = { PlaneData { src.data.data(), (uint32_t)src.data.size() } };
+    auto frame = FrameRef::Adopt(&source);
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() { scaler.Scale(frame); });
+    }
+    frame.Reset();
+    state.SetCounter("bytes_per_frame", src.data.size());
+}
+
+// libswscale on the same NV12 frames, the baseline the kernels replace
+void BenchSwscale(BenchState& state, const ScaleCase& scale, int flags)
+{
+    const auto width = state.Options().width;
+    const auto height = state.Options().height;
+    Nv12Image src(width, height);
+    src.data = NoiseImage(src.data.size());
+    Nv12Image dst(Scaled(width, scale), Scaled(height, scale));
+    auto sws = sws_getContext(width, height, AV_PIX_FMT_NV12, dst.width, dst.height, AV_PIX_FMT_NV12, flags,
+        nullptr, nullptr, nullptr);
+    if (sws == nullptr) {
+        state.SetError("sws_getContext failed");
+        return;
+    }
+
+    const uint8_t* src_planes[] = { src.Y(), src.UV() };
+    const int src_strides[] = { (int)src.stride, (int)src.stride };
+    uint8_t* dst_planes[] = { dst.Y(), dst.UV() };
+    const int dst_strides[] = { (int)dst.stride, (int)dst.stride };
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        state.Measure([&]() { sws_scale(sws, src_planes, src_strides, 0, height, dst_planes, dst_strides); });
+    }
+    sws_freeContext(sws);
+    state.SetCounter("bytes_per_frame", src.data.size());
+}
+
+} // namespace
+
+void RegisterScaleBench(BenchRunner& runner)
+{
+    for (auto& scale : kCases) {
+        for (auto kernel : { ConvertKernel::Scalar, ConvertKernel::Avx2, ConvertKernel::Neon }) {
+            if (!ConvertKernelSupported(kernel)) {
+                continue;
+            }
+            runner.Add(std::string("scale/") + scale.name + "_" + std::string(ConvertKernelName(kernel)),
+                [kernel, &scale](BenchState& state) { BenchKernel(state, kernel, scale); });
+        }
+        runner.Add(std::string("scale/") + scale.name + "_scaler",
+            [&scale](BenchState& state) { BenchScaler(state, scale); });
+        // area is what swscale offers closest to a box
+        int flags = scale.filter == ScaleFilter::Box ? SWS_AREA : SWS_BILINEAR;
+        runner.Add(std::string("scale/") + scale.name + "_swscale",
+            [&scale, flags](BenchState& state) { BenchSwscale(state, scale, flags); });
+    }
+}
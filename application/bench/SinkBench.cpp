@@ -0,0 +1,75 @@
+#include <cstring>
+#include <vector>
+
+#include "Bench.h"
+#include "StreamServer.h"
+
+namespace {
+
+// Annex-B H265 access unit, nal_type goes into the two byte nal header
+void AppendNal(std::vector<uint8_t>& au, uint8_t nal_type, size_t payload)
+{
+    static const uint8_t kStartCode[] = { 0, 0, 0, 1 };
+    au.insert(au.end(), kStartCode, kStartCode + sizeof(kStartCode));
+    au.push_back(nal_type << 1);
+    au.push_back(1);
+    // no emulation prevention needed, the payload never holds two zero bytes
+    for (size_t i = 0; i < payload; i++) {
+        au.push_back(0x80 | (i & 0x7f));
+    }
+}
+
+// one gop of packets like the encoder puts out: VPS SPS PPS IDR, then TRAIL_R
+std::vector<std::vector<uint8_t>> SyntheticGop(const BenchState& state, uint32_t gop)
+{
+    auto frame_size = state.Options().width * state.Options().height;
+    std::vector<std::vector<uint8_t>> packets(gop);
+    AppendNal(packets[0], 32, 24);
+    AppendNal(packets[0], 33, 40);
+    AppendNal(packets[0], 34, 8);
+    AppendNal(packets[0], 19, frame_size / 20);
+    for (uint32_t i = 1; i < gop; i++) {
+        AppendNal(packets[i], 1, frame_size / 100);
+    }
+    return packets;
+}
+
+// StreamSink::SendPackage into ZLMediaKit without any player attached
+void BenchSendPackage(BenchState& state)
+{
+    StreamServer server({ 0, 0, 0 });
+    if (!server.Init()) {
+        return;
+    }
+
+    const uint8_t fps = 60;
+    auto sink = server.CreateSink({ "bench", "1", "H265", fps, state.Options().width, state.Options().height });
+    if (!sink->Init()) {
+        return;
+    }
+    PipelineMetrics metrics;
+    sink->SetMetrics(&metrics);
+
+    auto packets = SyntheticGop(state, 120);
+    uint64_t bytes = 0;
+    FrameMeta meta;
+    meta.timestamp_us = MonotonicUs();
+    for (uint64_t i = 0; i < state.Iterations(); i++) {
+        auto& packet = packets[i % packets.size()];
+        meta.sequence = i;
+        meta.timestamp_us += 1000000 / fps;
+        state.Measure([&]() { sink->SendPackage(packet.data(), packet.size(), meta); });
+        bytes += packet.size();
+    }
+    sink->Stop();
+
+    state.SetCounter("bytes_per_packet", (double)bytes / state.Iterations());
+    state.SetCounter("send_errors", metrics.send_errors.Get());
+}
+
+} // namespace
+
+void RegisterSinkBench(BenchRunner& runner)
+{
+    runner.Add("sink/send_package", BenchSendPackage);
+}
@@ -0,0 +1,59 @@
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Bench.h"
+
+static void Usage(const char* name)
+{
+  spdlog::info("Usage: {} [--iterations N] [--size WxH] [--filter NAME] [--out FILE]", name);
+}
+
+int main(int argc, char** argv)
+{
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      Usage(argv[0]);
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--iterations") {
+      options.iterations = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (arg == "--size") {
+      if (sscanf(value.c_str(), "%ux%u", &options.width, &options.height) != 2) {
+        Usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--filter") {
+      options.filter = value;
+    } else if (arg == "--out") {
+      options.out = value;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.iterations == 0 || options.width == 0 || options.height == 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  // keep stdout for the JSON
+  spdlog::set_default_logger(spdlog::stderr_color_mt("bench"));
+  spdlog::set_level(spdlog::level::warn);
+
+  BenchRunner runner(options);
+  RegisterCaptureBench(runner);
+  RegisterChainBench(runner);
+  RegisterConvertBench(runner);
+  RegisterEncoderBench(runner);
+  RegisterNalBench(runner);
+  RegisterScaleBench(runner);
+  RegisterSinkBench(runner);
+  return runner.Run() ? 0 : 1;
+}
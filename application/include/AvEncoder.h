@@ -0,0 +1,72 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "VideoEncoder.h"
+
+/*
+ * Software encoder on libavcodec (libx264 / libx265 when available), tuned
+ * for low delay: no B frames, zerolatency, slice threads. Frames are encoded
+ * and packets delivered on the thread calling PutFrame.
+ */
+class AvEncoder : public VideoEncoder {
+public:
+    AvEncoder(const FrameInfo& frame_info, const StreamInfo& stream_info);
+    ~AvEncoder(void);
+
+    using VideoEncoder::Init;
+    bool Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback) override;
+
+    // data is copied, dma_fd is ignored
+    bool PutFrame(uint8_t* data, uint32_t size, int dma_fd = -1) override;
+    // encoded in place when the encoder takes the source format, the frame is
+    // referenced until libavcodec drops it
+    bool PutFrame(FrameRef frame) override;
+
+    void Stop(void) override;
+
+private:
+    bool FillPlanes(AVFrame* frame, const std::vector<PlaneData>& planes);
+    // src_frame_ -> dst_frame_
+    bool Convert(void);
+    bool Encode(AVFrame* frame, const FrameMeta& meta);
+    bool ReceivePackets(void);
+    static void ReleaseFrameRef(void* opaque, uint8_t* data);
+
+private:
+    FrameInfo frame_info_;
+    StreamInfo stream_info_;
+
+    AVCodecContext* ctx_ = nullptr;
+    AVPixelFormat src_format_ = AV_PIX_FMT_NONE;
+    // wraps the source planes
+    AVFrame* src_frame_ = nullptr;
+    // encoder owned picture when the source format has to be converted
+    AVFrame* dst_frame_ = nullptr;
+    SwsContext* sws_ = nullptr;
+    AVPacket* packet_ = nullptr;
+
+    std::atomic<bool> is_running_ { false };
+    std::function<void(uint8_t*, uint32_t, const FrameMeta&)> package_callback_;
+
+    // frames inside the encoder, in pts order
+    struct InFlightFrame {
+        FrameMeta meta;
+        int64_t pts;
+        uint64_t submit_us;
+    };
+    std::deque<InFlightFrame> in_flight_;
+    // libx264 wants strictly increasing pts, capture stamps may repeat at fps 0
+    int64_t last_pts_ = -1;
+    // for PutFrame without FrameRef
+    uint64_t sequence_ = 0;
+};
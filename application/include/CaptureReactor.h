@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * A few epoll threads driving many capture fds. Every fd is one shot: after
+ * an event it stays quiet until its handler returns, so handler calls for
+ * one fd never overlap and need no locking against each other. A handler
+ * runs on the reactor thread and must not block, V4L2 fds are non blocking.
+ */
+class CaptureReactor {
+public:
+    // events is 0 on timeout. Returns when to wait for the fd again: < 0
+    // never (the fd is dropped), 0 at once, > 0 after that many milliseconds
+    using Handler = std::function<int(uint32_t events)>;
+
+    explicit CaptureReactor(int threads = 1);
+    ~CaptureReactor(void);
+
+    bool Start(void);
+    void Stop(void);
+
+    // on the thread with the fewest fds, timeout_ms 0 waits forever
+    bool Add(int fd, uint32_t events, uint32_t timeout_ms, const Handler& handler);
+    // no handler call for fd once it returns, waits for a running one
+    // unless called from that handler
+    void Remove(int fd);
+
+    size_t Threads(void) const { return loops_.size(); }
+
+private:
+    struct Entry {
+        int fd;
+        uint32_t events;
+        uint32_t timeout_ms;
+        Handler handler;
+        // armed in epoll, else waiting until rearm_us
+        bool armed = true;
+        uint64_t deadline_us = 0;
+        uint64_t rearm_us = 0;
+    };
+
+    struct Loop {
+        int epoll_fd = -1;
+        // eventfd, new deadlines and Stop
+        int wake_fd = -1;
+        std::thread thread;
+        std::thread::id thread_id;
+        std::mutex mutex;
+        std::condition_variable idle_cv;
+        std::map<int, std::shared_ptr<Entry>> entries;
+        // fd whose handler runs right now
+        int running_fd = -1;
+    };
+
+    void Run(Loop& loop, int index);
+    // loop.mutex held
+    bool Arm(Loop& loop, Entry& entry, uint64_t now_us);
+    void Dispatch(Loop& loop, int fd, uint32_t events);
+    void WakeLoop(Loop& loop);
+    Loop* Owner(int fd);
+
+private:
+    int thread_count_;
+    std::atomic<bool> running_ { false };
+    std::vector<std::unique_ptr<Loop>> loops_;
+
+    std::mutex owners_mutex_;
+    std::map<int, Loop*> owners_;
+};
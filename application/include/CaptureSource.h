@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Metrics.h"
+#include "VideoFrame.h"
+
+class CaptureReactor;
+
+struct BufferData {
+    int dma_fd;
+    std::vector<PlaneData> data;
+};
+
+struct CaptureVideoInfo {
+    uint32_t height;
+    uint32_t width;
+    std::string pixelformat;
+    uint8_t num_planes;
+    std::vector<uint32_t> sizeimage;
+    // per plane, bytes from one line to the next
+    std::vector<uint32_t> bytesperline;
+    std::string colorspace;
+};
+
+enum class CaptureSourceType {
+    V4l2,
+    File,
+    Pattern,
+};
+
+struct CaptureSourceInfo {
+    CaptureSourceType type = CaptureSourceType::V4l2;
+    // device node for V4l2, file path for File
+    std::string path;
+    // File and Pattern: frame layout, File with a YUV4MPEG header takes them from the header
+    // V4l2: forced size and format, 0 / empty keeps the current size and negotiates the format
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::string pixelformat;
+    // V4l2 only, formats the consumer accepts, the cheapest one the device has wins, empty is any
+    std::vector<std::string> formats;
+    // 0 is as fast as possible
+    uint32_t fps = 0;
+    // File only, restart from the first frame at the end of file
+    bool loop = true;
+    int buf_count = 5;
+    // seconds, 0 is wait forever
+    uint32_t timeout = 10;
+};
+
+/*
+ * Producer of raw video frames. Every backend delivers frames through the
+ * same callbacks as the V4L2 capture, dma_fd is -1 if the frame is not backed
+ * by a dma buffer.
+ */
+class CaptureSource : public FrameOwner {
+public:
+    virtual ~CaptureSource(void) = default;
+
+    virtual bool Init(void) = 0;
+    virtual bool GetVideoInfo(CaptureVideoInfo& info) = 0;
+
+    // blocking until Stop or error
+    virtual bool Setup(const std::function<void(PlaneData&, int dma_fd)>& callback) = 0;
+    virtual bool Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback) = 0;
+    // the callback may keep the frame, the buffer is reused once every FrameRef is dropped
+    virtual bool Setup(const std::function<void(FrameRef)>& callback) = 0;
+
+    virtual void Stop(void) = 0;
+    // keeps the buffers while frames are still held
+    virtual void Deinit(void) = 0;
+    // false, and nothing freed, while frames are still held, the caller retries
+    virtual bool Reset(void) = 0;
+
+    // frames handed out and not released yet
+    virtual uint32_t InFlight(void) const = 0;
+
+    // optional, must outlive the source
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+    // optional, must outlive the source. V4L2 devices are driven by its
+    // threads instead of a select on the Setup thread, other sources ignore it
+    void SetReactor(CaptureReactor* reactor) { reactor_ = reactor; }
+
+    // no frames are delivered while paused (V4L2: STREAMOFF), any thread
+    void SetPaused(bool paused);
+    bool Paused(void) const { return paused_.load(std::memory_order_acquire); }
+
+    // capture thread, the source changed size or format (e.g. a new HDMI
+    // resolution) and every frame handed out has come back. Frames after it
+    // have the new layout, false ends the capture loop with an error
+    void SetFormatCallback(const std::function<bool(const CaptureVideoInfo&)>& callback) { format_callback_ = callback; }
+
+protected:
+    // capture loop, blocks until unpaused or is_running is cleared
+    void WaitWhilePaused(const std::atomic<bool>& is_running);
+
+protected:
+    PipelineMetrics* metrics_ = nullptr;
+    CaptureReactor* reactor_ = nullptr;
+    std::function<bool(const CaptureVideoInfo&)> format_callback_;
+
+private:
+    std::atomic<bool> paused_ { false };
+    std::mutex pause_mutex_;
+    std::condition_variable pause_cv_;
+};
+
+// bytes of one tightly packed frame, 0 if the format is unknown
+uint32_t CaptureFrameSize(std::string_view pixelformat, uint32_t width, uint32_t height);
+// bytes of one tightly packed line of the first plane, 0 if the format is unknown
+uint32_t CaptureLineSize(std::string_view pixelformat, uint32_t width);
+// every format the pipeline handles, cheapest (bytes per pixel) first
+const std::vector<std::string>& CaptureFormats(void);
+
+std::shared_ptr<CaptureSource> CreateCaptureSource(const CaptureSourceInfo& info);
+
+// "/dev/video0", "file:path?w=1920&h=1080&fmt=NV12&fps=60&loop=1", "pattern:1920x1080?fmt=BGR24&fps=0"
+bool ParseCaptureSource(std::string_view uri, CaptureSourceInfo& info);
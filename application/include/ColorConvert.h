@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/*
+ * BGR24 -> NV12, BT.601 limited range like PatternCapture. Chroma is taken
+ * from the rounded mean of each 2x2 block. Every kernel gives the same bytes
+ * as the scalar one.
+ */
+struct BgrToNv12Job {
+    const uint8_t* bgr;
+    uint32_t bgr_stride;
+    // uv follows y in one buffer or not, both use stride
+    uint8_t* y;
+    uint8_t* uv;
+    uint32_t stride;
+    // even
+    uint32_t width;
+};
+
+enum class ConvertKernel {
+    Scalar,
+    Avx2,
+    Neon,
+};
+
+// rows [row_begin, row_end), both even
+void BgrToNv12Scalar(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end);
+#if defined(__x86_64__)
+void BgrToNv12Avx2(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end);
+#endif
+#if defined(__aarch64__)
+void BgrToNv12Neon(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end);
+#endif
+
+// false if the kernel is not built in or the cpu lacks it
+bool ConvertKernelSupported(ConvertKernel kernel);
+// fastest supported kernel
+ConvertKernel BestConvertKernel(void);
+std::string_view ConvertKernelName(ConvertKernel kernel);
+
+void BgrToNv12(ConvertKernel kernel, const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end);
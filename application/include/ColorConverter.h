@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ColorConvert.h"
+#include "FramePool.h"
+#include "VideoFrame.h"
+
+/*
+ * Optional stage between capture and encoder for sources that only deliver
+ * BGR24. Frames are converted into a FramePool of NV12 buffers, the rows
+ * are split in bands across BandWorkers.
+ */
+class ColorConverter {
+public:
+    // src_stride 0 is tightly packed, threads 0 picks one per core up to 4
+    ColorConverter(uint32_t width, uint32_t height, uint32_t src_stride = 0,
+        int buf_count = 4, int threads = 0, ConvertKernel kernel = BestConvertKernel());
+    ~ColorConverter(void);
+
+    bool Init(void);
+
+    // NV12 copy of frame with its meta, empty if every pool buffer is still referenced
+    FrameRef Convert(const FrameRef& frame);
+
+    // layout of the converted frames
+    uint32_t Stride(void) const { return stride_; }
+    uint32_t FrameSize(void) const { return stride_ * height_ * 3 / 2; }
+    ConvertKernel Kernel(void) const { return kernel_; }
+
+private:
+    void RunBand(int band);
+
+private:
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t src_stride_;
+    uint32_t stride_;
+    int buf_count_;
+    ConvertKernel kernel_;
+
+    FramePool pool_;
+    // the job of the frame Convert runs, set before the bands
+    BgrToNv12Job job_;
+    // last, the workers stop before the job and the pool go
+    BandWorkers workers_;
+};
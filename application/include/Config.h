@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "DemandGate.h"
+#include "FrameQueue.h"
+#include "FrameScaler.h"
+#include "FrameTracer.h"
+#include "Recorder.h"
+#include "Snapshot.h"
+#include "StreamServer.h"
+#include "ThreadPlacement.h"
+#include "VideoEncoder.h"
+
+// another encoding of a pipeline's frames, published as app/stream_id
+struct OutputConfig {
+    std::string stream_id;
+    VideoEncoderType encoder = VideoEncoderType::Mpp;
+    StreamInfo stream { "H265", 120, 0 };
+    RecordInfo record;
+    TimeshiftInfo timeshift;
+    // a smaller copy of the frames, e.g. a low bitrate sub-stream, NV12 captures only
+    ScaleInfo scale;
+};
+
+// one capture -> encode -> sink chain, defaults are the single pipeline server
+struct PipelineConfig {
+    std::string name = "default";
+    CaptureSourceInfo source;
+    VideoEncoderType encoder = VideoEncoderType::Mpp;
+    StreamInfo stream { "H265", 120, 0 };
+    uint8_t fps = 60;
+    std::string app = "live";
+    std::string stream_id = "1";
+    // capacity and max_in_flight 0 are sized from source.buf_count
+    FrameQueueInfo queue;
+    DemandInfo demand;
+    // record_path empty records nothing
+    RecordInfo record;
+    // timeshift_bytes 0 leaves seek and speed unanswered
+    TimeshiftInfo timeshift;
+    // jpeg of the latest frame on the http port, /snapshot/<app>/<stream_id>.jpg
+    SnapshotInfo snapshot;
+    uint32_t idr_interval_ms = 1000;
+    // wait before opening the input again after it failed
+    uint32_t retry_ms = 2000;
+    // encoded next to the stream above from the same capture buffers, queue and demand settings are shared
+    std::vector<OutputConfig> outputs;
+
+    PipelineConfig(void);
+
+    // the pipeline's own stream first, then outputs
+    std::vector<OutputConfig> Outputs(void) const;
+};
+
+struct ServerConfig {
+    StreamServerInfo server { 10002, 10001, 10000 };
+    // epoll threads for every V4L2 input, 0 keeps a select on each pipeline thread
+    uint16_t capture_threads = 1;
+    // empty leaves every thread to the scheduler
+    PlacementInfo threads;
+    // per-frame spans, /trace on the http port and SIGUSR1
+    TraceInfo trace;
+    std::vector<PipelineConfig> pipelines;
+};
+
+/*
+ * INI file, one [server] section, an optional [threads] section, a
+ * [pipeline <name>] section per input and [output <stream_id>] sections for
+ * more encodings of the pipeline above them:
+ *
+ *   [server]
+ *   http_port = 10000
+ *   trace = false
+ *
+ *   [threads]
+ *   capture_cpus = big
+ *   capture_priority = 50
+ *
+ *   [pipeline cam0]
+ *   source = /dev/video0
+ *   codec = H265
+ *   fps = 60
+ *   stream_id = cam0
+ *
+ *   [output cam0_h264]
+ *   codec = H264
+ *
+ * Pipeline keys are the fields of PipelineConfig, outputs start with the
+ * encoder and codec settings of their pipeline and take encoder, codec, gop,
+ * bitrate, record_*, timeshift_* and their own scale (1/2, 1/4 or <w>x<h>)
+ * and scale_filter. Thread keys are <role>_cpus,
+ * <role>_priority and <role>_nice, see config.ini. Unknown keys are an error.
+ */
+bool LoadConfig(const std::string& path, ServerConfig& config);
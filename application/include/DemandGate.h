@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include "Metrics.h"
+#include "VideoFrame.h"
+
+struct DemandInfo {
+    // readers gone for this long before the pipeline idles, covers reconnects and page reloads
+    uint32_t idle_linger_ms = 10000;
+    // frames per second encoded while idle, 0 pauses the capture as well
+    uint32_t keepalive_fps = 0;
+    // false encodes at full rate until the first reader came and went
+    bool start_idle = true;
+};
+
+/*
+ * Decides which captured frames are encoded, depending on whether anybody
+ * watches. Reader events come from ZLMediaKit poller threads, Admit from the
+ * encode thread. ZLMediaKit reports players joining and the last one
+ * leaving, not every reader leaving: the count is the players that joined
+ * since the stream last had none, an upper bound that drops to 0 on the no
+ * reader event. Only 0 against not 0 is exact.
+ */
+class DemandGate {
+public:
+    explicit DemandGate(const DemandInfo& info);
+
+    // a player started, wakes the pipeline at once
+    void ReaderJoined(void);
+    // ZLMediaKit has no reader left on the stream
+    void ReadersGone(void);
+    // joins since the last no reader event, see the class comment
+    int Readers(void);
+    bool Active(void);
+
+    // encode thread, false drops the frame, idr is set for the first frame after idling
+    bool Admit(uint64_t now_us, bool& idr);
+
+    // called outside the lock on every idle <-> active change, e.g. to pause the capture
+    void SetStateCallback(const std::function<void(bool active)>& callback);
+
+    // optional, must outlive the gate
+    void SetMetrics(PipelineMetrics* metrics);
+
+private:
+    // with mutex_ held, returns true if the state changed
+    bool SetActive(bool active);
+    void Notify(void);
+
+private:
+    DemandInfo info_;
+    std::mutex mutex_;
+    int readers_ = 0;
+    bool active_;
+    // the next admitted frame has to be an IDR
+    bool need_idr_ = false;
+    // when the last reader left, 0 while somebody watches
+    uint64_t idle_since_us_ = 0;
+    uint64_t last_keepalive_us_ = 0;
+
+    std::mutex notify_mutex_;
+    std::function<void(bool active)> state_callback_;
+    PipelineMetrics* metrics_ = nullptr;
+};
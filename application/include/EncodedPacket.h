@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Metrics.h"
+#include "NalParser.h"
+#include "VideoFrame.h"
+
+class PacketPool;
+
+/*
+ * One encoded packet in a pool buffer. The producer fills it once, then it
+ * is only read: any number of consumers on their own threads hold it through
+ * PacketRef, nobody copies it, the buffer goes back to the pool with the last
+ * reference.
+ */
+struct EncodedPacket {
+    uint8_t* data = nullptr;
+    uint32_t size = 0;
+    uint32_t capacity = 0;
+    // of the frame it was encoded from
+    FrameMeta meta;
+    // CLOCK_MONOTONIC, out of the encoder
+    uint64_t encoded_us = 0;
+    // IDR (H.264) or IRAP (H.265) slices, VPS/SPS/PPS in the packet
+    bool key = false;
+    bool has_parameter_sets = false;
+
+    PacketPool* pool = nullptr;
+    // index of the size class, -1 for a packet larger than every class
+    int size_class = -1;
+    std::atomic<uint32_t> refcount { 0 };
+};
+
+/*
+ * Intrusive reference to an EncodedPacket, like FrameRef for frames.
+ */
+class PacketRef {
+public:
+    PacketRef(void) = default;
+
+    // take the first reference of a free packet
+    static PacketRef Adopt(EncodedPacket* packet)
+    {
+        packet->refcount.store(1, std::memory_order_relaxed);
+        return PacketRef(packet);
+    }
+
+    PacketRef(const PacketRef& other)
+        : packet_(other.packet_)
+    {
+        if (packet_ != nullptr) {
+            packet_->refcount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    PacketRef(PacketRef&& other) noexcept
+        : packet_(std::exchange(other.packet_, nullptr))
+    {
+    }
+
+    PacketRef& operator=(const PacketRef& other)
+    {
+        PacketRef(other).Swap(*this);
+        return *this;
+    }
+
+    PacketRef& operator=(PacketRef&& other) noexcept
+    {
+        PacketRef(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~PacketRef(void)
+    {
+        Reset();
+    }
+
+    void Reset(void);
+
+    void Swap(PacketRef& other) noexcept
+    {
+        std::swap(packet_, other.packet_);
+    }
+
+    EncodedPacket* Get(void) const { return packet_; }
+    EncodedPacket* operator->(void) const { return packet_; }
+    EncodedPacket& operator*(void) const { return *packet_; }
+    explicit operator bool(void) const { return packet_ != nullptr; }
+
+private:
+    explicit PacketRef(EncodedPacket* packet)
+        : packet_(packet)
+    {
+    }
+
+private:
+    EncodedPacket* packet_ = nullptr;
+};
+
+struct PacketPoolInfo {
+    // smallest and largest size class, powers of two in between
+    uint32_t min_bytes = 4 << 10;
+    uint32_t max_bytes = 4 << 20;
+    // free packets kept per class, more are freed when they come back
+    uint32_t max_free = 32;
+};
+
+/*
+ * Packet buffers by size class. A packet is allocated the first time its
+ * class runs dry and reused from then on: once the pool has seen a gop the
+ * encoder output costs no malloc. Larger packets than the biggest class get
+ * a buffer of their own, freed on release. Any thread, the pool must outlive
+ * its packets.
+ */
+class PacketPool {
+public:
+    explicit PacketPool(const PacketPoolInfo& info = PacketPoolInfo());
+    ~PacketPool(void);
+
+    // room for size bytes, size and metadata left for the caller to fill
+    PacketRef Acquire(uint32_t size);
+    // copy of an encoder packet, the one copy it gets
+    PacketRef Copy(const uint8_t* data, uint32_t size, const FrameMeta& meta);
+    // the same, key and parameter set flags taken from the producer's parse of it
+    PacketRef Copy(const uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit);
+
+    // optional, must outlive the pool
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+
+    // buffers allocated so far, flat once the pool is warm
+    uint64_t Allocations(void) const { return allocations_.load(std::memory_order_relaxed); }
+
+private:
+    friend class PacketRef;
+
+    void Release(EncodedPacket* packet);
+    EncodedPacket* Allocate(uint32_t capacity, int size_class);
+    static void Free(EncodedPacket* packet);
+
+private:
+    PacketPoolInfo info_;
+    PipelineMetrics* metrics_ = nullptr;
+    // capacity of each class
+    std::vector<uint32_t> classes_;
+
+    std::mutex mutex_;
+    std::vector<std::vector<EncodedPacket*>> free_;
+    // buffers allocated and not freed, in and out of the pool
+    uint64_t bytes_ = 0;
+    uint32_t outstanding_ = 0;
+    std::atomic<uint64_t> allocations_ { 0 };
+};
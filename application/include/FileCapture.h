@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ReplayCapture.h"
+
+/*
+ * Replay raw frames (BGR24, NV12, I420) or a YUV4MPEG2 stream from a mmap'ed
+ * file, frames are handed out in place without copies.
+ */
+class FileCapture : public ReplayCapture {
+public:
+    explicit FileCapture(const CaptureSourceInfo& info);
+    ~FileCapture(void);
+
+    bool Init(void) override;
+    void Deinit(void) override;
+
+protected:
+    bool NextFrame(PlaneData& frame) override;
+
+private:
+    bool ParseY4mHeader(size_t& data_offset);
+    bool IndexY4mFrames(size_t data_offset);
+
+private:
+    CaptureSourceInfo info_;
+    int fd_ = -1;
+    uint8_t* map_ = nullptr;
+    size_t map_size_ = 0;
+
+    uint32_t frame_size_ = 0;
+    // offset of each frame in the file
+    std::vector<size_t> frames_;
+    size_t frame_index_ = 0;
+};
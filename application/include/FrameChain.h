@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "ColorConverter.h"
+#include "EncodedPacket.h"
+#include "FrameScaler.h"
+#include "NalParser.h"
+#include "Recorder.h"
+#include "StreamSink.h"
+#include "VideoEncoder.h"
+#include "VideoFrame.h"
+
+/*
+ * Frame path composed at compile time: transforms -> encoder and encoder ->
+ * sinks are template arguments called directly, the compiler can inline them
+ * instead of going through a std::function or a virtual call per stage.
+ *
+ *   FrameChain chain(ConvertStage { converter }, EncodeStage<AvEncoder> { encoder });
+ *   PacketFanout packets(parser, SinkStage { sink }, RecordStage { recorder, pool });
+ *   encoder.Init(packets.Callback());
+ *   capture->Setup(chain.Callback());
+ *
+ * The capture backend and the encoder's package callback are picked at
+ * runtime, Callback() is the one type erased call at each of those
+ * boundaries, the std::function they always took. Stages hold references,
+ * the objects behind them must outlive the chain and its callbacks.
+ */
+
+// a frame stage is callable as bool(FrameRef&), false drops the frame
+template <typename... Stages>
+class FrameChain {
+public:
+    explicit FrameChain(Stages... stages)
+        : stages_(std::move(stages)...)
+    {
+    }
+
+    // true if the frame went through every stage
+    bool operator()(FrameRef frame) { return Run<0>(frame); }
+
+    // for CaptureSource::Setup, holds a copy of the chain
+    std::function<void(FrameRef)> Callback(void) const
+    {
+        return [chain = *this](FrameRef frame) mutable { chain(std::move(frame)); };
+    }
+
+private:
+    template <size_t I>
+    bool Run(FrameRef& frame)
+    {
+        if constexpr (I == sizeof...(Stages)) {
+            return true;
+        } else {
+            return std::get<I>(stages_)(frame) && Run<I + 1>(frame);
+        }
+    }
+
+private:
+    std::tuple<Stages...> stages_;
+};
+
+// a packet stage is callable as
+// void(uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit),
+// the fanout parses each packet once and every stage gets the same unit
+template <typename... Sinks>
+class PacketFanout {
+public:
+    // parser of the encoder's codec, must outlive the fanout and its callbacks
+    explicit PacketFanout(NalParser& parser, Sinks... sinks)
+        : parser_(parser)
+        , sinks_(std::move(sinks)...)
+    {
+    }
+
+    void operator()(uint8_t* data, uint32_t size, const FrameMeta& meta)
+    {
+        auto& unit = parser_.Parse(data, size);
+        std::apply([&](auto&... sink) { (sink(data, size, meta, unit), ...); }, sinks_);
+    }
+
+    // for VideoEncoder::Init, holds a copy of the fanout
+    std::function<void(uint8_t*, uint32_t, const FrameMeta&)> Callback(void) const
+    {
+        return [fanout = *this](uint8_t* data, uint32_t size, const FrameMeta& meta) mutable {
+            fanout(data, size, meta);
+        };
+    }
+
+private:
+    NalParser& parser_;
+    std::tuple<Sinks...> sinks_;
+};
+
+// BGR24 -> NV12, dropped if the pool is exhausted
+struct ConvertStage {
+    ColorConverter& converter;
+
+    bool operator()(FrameRef& frame) const
+    {
+        frame = converter.Convert(frame);
+        return (bool)frame;
+    }
+};
+
+// sub-stream size, dropped if the pool is exhausted
+struct ScaleStage {
+    FrameScaler& scaler;
+
+    bool operator()(FrameRef& frame) const
+    {
+        frame = scaler.Scale(frame);
+        return (bool)frame;
+    }
+};
+
+// the last frame stage. With the backend class (MppEncoder, AvEncoder)
+// PutFrame is called without the virtual dispatch, VideoEncoder keeps it
+template <typename Encoder>
+struct EncodeStage {
+    Encoder& encoder;
+
+    bool operator()(FrameRef& frame) const
+    {
+        if constexpr (std::is_abstract_v<Encoder>) {
+            return encoder.PutFrame(std::move(frame));
+        } else {
+            return encoder.Encoder::PutFrame(std::move(frame));
+        }
+    }
+};
+
+struct SinkStage {
+    StreamSink& sink;
+
+    void operator()(uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit) const
+    {
+        sink.SendPackage(data, size, meta, unit);
+    }
+};
+
+// nullptr records nothing. The packet is copied into the pool once, tagged
+// from the fanout's parse, the writer thread shares it
+struct RecordStage {
+    Recorder* recorder;
+    PacketPool& packets;
+
+    void operator()(uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit) const
+    {
+        if (recorder == nullptr) {
+            return;
+        }
+        auto packet = packets.Copy(data, size, meta, unit);
+        if (packet) {
+            recorder->Push(std::move(packet));
+        }
+    }
+};
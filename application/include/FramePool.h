@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VideoFrame.h"
+
+/*
+ * Fixed set of 64 byte aligned single plane frames, the output of the
+ * convert and scale stages. A frame is free again once its refcount drops
+ * to 0, nothing is allocated after Init.
+ */
+class FramePool : public FrameOwner {
+public:
+    static constexpr uint32_t kAlign = 64;
+
+    // name is for the logs
+    explicit FramePool(const std::string& name);
+    ~FramePool(void);
+
+    bool Init(int buf_count, uint32_t frame_size);
+
+    // the next free frame round robin, nullptr if every one is still
+    // referenced: like a driver running out of buffers, the caller drops its frame
+    VideoFrame* Acquire(void);
+
+    // pool buffers are reused once their refcount drops to 0
+    void ReleaseFrame(VideoFrame& frame) override { }
+
+private:
+    std::string name_;
+    std::vector<uint8_t*> buffers_;
+    std::vector<VideoFrame> frames_;
+    size_t index_ = 0;
+};
+
+/*
+ * Rows of a frame split in bands across worker threads and the calling
+ * thread. One job at a time: Run hands it out and waits for every band.
+ */
+class BandWorkers {
+public:
+    // band is 0 .. Bands() - 1, the job itself is state of the caller set before Run
+    using Work = std::function<void(int band)>;
+
+    // threads 0 picks one per core up to 4
+    explicit BandWorkers(int threads);
+    ~BandWorkers(void);
+
+    // no more bands than max_bands, threads are named "<name> <band>"
+    void Start(int max_bands, const std::string& name, const Work& work);
+    int Bands(void) const { return bands_; }
+
+    // band 0 runs on the calling thread
+    void Run(void);
+
+    // first row of band, whole row pairs of rows rows
+    uint32_t BandBegin(int band, uint32_t rows) const { return rows / 2 * band / bands_ * 2; }
+
+private:
+    void Worker(int band, const std::string& name);
+
+private:
+    int bands_;
+    Work work_;
+
+    std::mutex mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+    uint64_t job_id_ = 0;
+    int pending_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
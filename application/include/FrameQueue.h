@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string_view>
+
+#include <readerwriterqueue/readerwriterqueue.h>
+
+#include "Metrics.h"
+#include "VideoFrame.h"
+
+enum class DropPolicy {
+    // a frame that does not fit is dropped, the queue keeps its order
+    DropNewest,
+    // the oldest queued frame makes room for the new one
+    DropOldest,
+    // low latency, only the freshest frame waits, the encoder never works on a stale one
+    KeepLatest,
+};
+
+struct FrameQueueInfo {
+    DropPolicy policy = DropPolicy::DropNewest;
+    // ignored by KeepLatest
+    size_t capacity = 3;
+    // source frames held between capture and encoder, queued or in the encoder, 0 is no limit
+    uint32_t max_in_flight = 0;
+};
+
+/*
+ * Single producer single consumer handoff of captured frames. The producer
+ * never blocks, a dropped frame goes straight back to the source. DropNewest
+ * is lock free, the other policies take frames back out of the queue on the
+ * producer side and use a short lock.
+ */
+class FrameQueue {
+public:
+    // DropNewest
+    explicit FrameQueue(size_t capacity);
+    explicit FrameQueue(const FrameQueueInfo& info);
+
+    // in_flight is what the source has handed out, this frame included, see CaptureSource::InFlight
+    bool Push(FrameRef frame, uint32_t in_flight = 0);
+    // false on timeout
+    bool Pop(FrameRef& frame, int64_t timeout_us);
+
+    size_t Size(void) const;
+    // every drop, whatever the reason
+    uint64_t Dropped(void) const;
+
+    // optional, queue_depth and the queue_dropped counters
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+
+private:
+    enum class DropReason {
+        Newest,
+        Oldest,
+        InFlight,
+    };
+    void CountDrop(DropReason reason);
+
+private:
+    DropPolicy policy_;
+    size_t capacity_;
+    uint32_t max_in_flight_;
+    PipelineMetrics* metrics_ = nullptr;
+    std::atomic<uint64_t> dropped_ { 0 };
+
+    // DropNewest
+    moodycamel::BlockingReaderWriterQueue<FrameRef> queue_;
+
+    // DropOldest and KeepLatest
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<FrameRef> frames_;
+};
+
+// "newest", "oldest" or "latest"
+bool ParseDropPolicy(std::string_view name, DropPolicy& policy);
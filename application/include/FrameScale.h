@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "ColorConvert.h"
+
+/*
+ * NV12 -> smaller NV12. Box takes the rounded mean of 2x2 or 4x4 blocks,
+ * bilinear scales to any size with 8 bit weights from pixel centers, rows
+ * first into an 8 bit line, then columns. Every kernel gives the same bytes
+ * as the scalar one.
+ */
+enum class ScaleFilter {
+    Box,
+    Bilinear,
+};
+
+// per destination column or row, the first source sample and the weight (0-255) of the next one
+struct ScaleTaps {
+    std::vector<uint32_t> index;
+    std::vector<uint16_t> weight;
+};
+
+struct BilinearTaps {
+    ScaleTaps luma_x;
+    ScaleTaps luma_y;
+    // in uv pairs and chroma rows
+    ScaleTaps chroma_x;
+    ScaleTaps chroma_y;
+};
+
+// src and dst sizes even
+BilinearTaps MakeBilinearTaps(uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height);
+
+struct Nv12ScaleJob {
+    const uint8_t* src_y;
+    const uint8_t* src_uv;
+    uint32_t src_stride;
+    uint32_t src_width;
+    uint32_t src_height;
+    uint8_t* dst_y;
+    uint8_t* dst_uv;
+    uint32_t dst_stride;
+    // even, Box: src / factor
+    uint32_t dst_width;
+    uint32_t dst_height;
+    ScaleFilter filter;
+    // Box, 2 or 4
+    uint32_t factor;
+    // Bilinear
+    const BilinearTaps* taps;
+};
+
+// destination rows [row_begin, row_end), both even
+void ScaleNv12Scalar(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end);
+#if defined(__x86_64__)
+void ScaleNv12Avx2(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end);
+#endif
+#if defined(__aarch64__)
+void ScaleNv12Neon(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end);
+#endif
+
+// same kernels as the color conversion, see ConvertKernelSupported
+void ScaleNv12(ConvertKernel kernel, const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end);
+
+// "box" or "bilinear"
+bool ParseScaleFilter(std::string_view name, ScaleFilter& filter);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "FramePool.h"
+#include "FrameScale.h"
+#include "VideoFrame.h"
+
+// sub-stream size of an output, nothing set keeps the capture size
+struct ScaleInfo {
+    // 2 or 4 divides the capture size, 0 takes width and height
+    uint32_t divisor = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // box where the size is a half or a quarter of the capture, bilinear otherwise
+    ScaleFilter filter = ScaleFilter::Box;
+
+    bool Enabled(void) const { return divisor != 0 || width != 0; }
+};
+
+/*
+ * NV12 downscaler feeding a sub-stream encoder. Frames are scaled into a
+ * FramePool of NV12 buffers, the rows are split in bands across BandWorkers,
+ * like the ColorConverter.
+ */
+class FrameScaler {
+public:
+    // src_ver_stride is the rows between the y and uv planes of single plane
+    // frames. Box needs dst = src / 2 or src / 4, threads 0 picks one per core up to 4
+    FrameScaler(uint32_t src_width, uint32_t src_height, uint32_t src_stride, uint32_t src_ver_stride,
+        uint32_t dst_width, uint32_t dst_height, ScaleFilter filter, int buf_count = 4, int threads = 0,
+        ConvertKernel kernel = BestConvertKernel());
+    ~FrameScaler(void);
+
+    bool Init(void);
+
+    // scaled copy of frame with its meta, empty if every pool buffer is still referenced
+    FrameRef Scale(const FrameRef& frame);
+
+    // layout of the scaled frames
+    uint32_t Width(void) const { return dst_width_; }
+    uint32_t Height(void) const { return dst_height_; }
+    uint32_t Stride(void) const { return stride_; }
+    uint32_t FrameSize(void) const { return stride_ * dst_height_ * 3 / 2; }
+    ConvertKernel Kernel(void) const { return kernel_; }
+
+private:
+    void RunBand(int band);
+
+private:
+    uint32_t src_width_;
+    uint32_t src_height_;
+    uint32_t src_stride_;
+    uint32_t src_ver_stride_;
+    uint32_t dst_width_;
+    uint32_t dst_height_;
+    uint32_t stride_;
+    ScaleFilter filter_;
+    uint32_t factor_ = 0;
+    int buf_count_;
+    ConvertKernel kernel_;
+    BilinearTaps taps_;
+
+    FramePool pool_;
+    // the job of the frame Scale runs, set before the bands
+    Nv12ScaleJob job_ {};
+    // last, the workers stop before the job and the pool go
+    BandWorkers workers_;
+};
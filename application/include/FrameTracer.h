@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceInfo {
+    // recording from the start, otherwise only between /trace?start and /trace?stop
+    bool enabled = false;
+    // spans kept per thread, the oldest are overwritten, rounded up to a power of two
+    uint32_t events = 16384;
+    // directory of the SIGUSR1 dumps, streamserver-<pid>-<unix time>.json
+    std::string path = "/tmp";
+};
+
+// the stages of a frame, each span is one of them for one frame
+enum class TraceSpan : uint8_t {
+    // select + VIDIOC_DQBUF
+    Dequeue,
+    // capture callback, the handoff to the encode thread
+    Callback,
+    // encoder PutFrame, import and encode_put_frame
+    PutFrame,
+    // frame in the encoder, put -> packet out (EncRecvThread for mpp)
+    Encode,
+    // StreamSink::SendPackage
+    Send,
+};
+
+/*
+ * Per-frame spans in Chrome trace format (chrome://tracing, ui.perfetto.dev).
+ * Every thread that records gets a ring of its own, written without a lock
+ * or a shared cache line: a span is four relaxed stores and a fence. Off,
+ * Record is one relaxed load. Render reads the rings while they are written
+ * and skips what was overwritten under it, so a recording can run in
+ * production and be fetched at any time.
+ */
+class FrameTracer {
+public:
+    // process wide like the thread placement, the spans come from every pipeline
+    static FrameTracer& Instance(void);
+
+    // before the threads start
+    void Configure(const TraceInfo& info);
+    const TraceInfo& Info(void) const { return info_; }
+
+    // drops what was recorded so far, 0 seconds records until Stop
+    void Start(uint32_t seconds = 0);
+    void Stop(void);
+    // main loop, ends a timed recording
+    void Poll(uint64_t now_us);
+
+    // stream name -> id for PipelineMetrics::trace_stream, ids are never reused
+    uint16_t Stream(const std::string& name);
+
+    static bool Enabled(void) { return enabled_.load(std::memory_order_relaxed); }
+
+    // one span of the calling thread, CLOCK_MONOTONIC microseconds
+    static void Record(TraceSpan span, uint16_t stream, uint64_t sequence, uint64_t start_us, uint64_t end_us)
+    {
+        if (Enabled()) {
+            Append(span, stream, sequence, start_us, end_us);
+        }
+    }
+
+    // Chrome trace JSON of the spans recorded since Start
+    std::string Render(void);
+    // Render into a file under TraceInfo::path, for SIGUSR1
+    bool Dump(void);
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> start_us { 0 };
+        std::atomic<uint64_t> end_us { 0 };
+        std::atomic<uint64_t> sequence { 0 };
+        // span | stream << 8
+        std::atomic<uint64_t> tag { 0 };
+    };
+
+    // written by one thread at a time, handed to the next one when it exits
+    struct Ring {
+        std::string thread;
+        uint32_t tid = 0;
+        std::unique_ptr<Slot[]> slots;
+        uint64_t mask = 0;
+        // spans published, the slot of head is free to write
+        std::atomic<uint64_t> head { 0 };
+        // head + 1 while that slot is written, the reader drops what it may have torn
+        std::atomic<uint64_t> claimed { 0 };
+        std::atomic<bool> in_use { false };
+    };
+
+    struct Span {
+        TraceSpan span;
+        uint16_t stream;
+        uint64_t sequence;
+        uint64_t start_us;
+        uint64_t end_us;
+    };
+
+    static void Append(TraceSpan span, uint16_t stream, uint64_t sequence, uint64_t start_us, uint64_t end_us);
+    Ring* AcquireRing(void);
+    static void ReleaseRing(Ring* ring);
+    static void ReadRing(const Ring& ring, uint64_t since_us, std::vector<Span>& spans);
+
+private:
+    static inline std::atomic<bool> enabled_ { false };
+
+    TraceInfo info_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::vector<std::string> streams_;
+    // spans that started before are not rendered, the rings are never cleared
+    std::atomic<uint64_t> since_us_ { 0 };
+    std::atomic<uint64_t> stop_us_ { 0 };
+};
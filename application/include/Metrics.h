@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Counter {
+public:
+    void Add(uint64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t Get(void) const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_ { 0 };
+};
+
+class Gauge {
+public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    int64_t Get(void) const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_ { 0 };
+};
+
+/*
+ * Fixed bucket latency histogram in microseconds, Observe is a short
+ * compare loop and three relaxed atomic adds.
+ */
+class LatencyHistogram {
+public:
+    static constexpr std::array<uint64_t, 16> kBounds = {
+        50, 100, 250, 500,
+        1000, 2000, 4000, 8000,
+        16000, 33000, 50000, 100000,
+        250000, 500000, 1000000, 2000000
+    };
+
+    void Observe(uint64_t us)
+    {
+        size_t i = 0;
+        while (i < kBounds.size() && us > kBounds[i]) {
+            i++;
+        }
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+        sum_us_.fetch_add(us, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // cumulative count of bucket i, i == kBounds.size() is +Inf
+    uint64_t Bucket(size_t i) const;
+    uint64_t Sum(void) const { return sum_us_.load(std::memory_order_relaxed); }
+    uint64_t Count(void) const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    std::array<std::atomic<uint64_t>, kBounds.size() + 1> buckets_ {};
+    std::atomic<uint64_t> sum_us_ { 0 };
+    std::atomic<uint64_t> count_ { 0 };
+};
+
+/*
+ * Everything measured along one capture -> encode -> sink pipeline. Writers
+ * only touch atomics, the registry reads them when scraped.
+ */
+struct PipelineMetrics {
+    // select + VIDIOC_DQBUF
+    LatencyHistogram dequeue_wait;
+    // capture callback, i.e. the handoff to the encoder
+    LatencyHistogram callback;
+    // frame made ready for the encoder: dma import (cached per buffer) or copy
+    LatencyHistogram encode_prepare;
+    // encode_put_frame
+    LatencyHistogram encode_submit;
+    // encode_put_frame -> packet out of encode_get_packet
+    LatencyHistogram encode_packet;
+    // StreamSink::SendPackage
+    LatencyHistogram send_package;
+    // capture timestamp -> SendPackage returned
+    LatencyHistogram capture_to_send;
+    // player joined -> first IDR sent after it
+    LatencyHistogram join_to_idr;
+    // V4L2 source change -> first frame with the new format
+    LatencyHistogram source_change;
+    // one batched recorder write, submitted -> on disk (page cache without O_DIRECT)
+    LatencyHistogram record_write;
+    // snapshot frame taken -> jpeg out of the encoder
+    LatencyHistogram snapshot_encode;
+    // sub-stream frame scaled on the encode thread
+    LatencyHistogram scale;
+
+    Counter frames_captured;
+    // gaps in the driver sequence
+    Counter frames_dropped;
+    // frames dropped between capture and encoder, all reasons
+    Counter queue_dropped;
+    // by drop decision: queue full and the new frame dropped, queue full and
+    // the oldest dropped, too many source frames in flight
+    Counter queue_dropped_newest;
+    Counter queue_dropped_oldest;
+    Counter queue_dropped_in_flight;
+    // capture_to_send above late_threshold_us
+    Counter frames_late;
+    Counter packets_encoded;
+    Counter packet_bytes;
+    Counter send_errors;
+    // frames not encoded because nobody watched
+    Counter idle_dropped;
+    Counter forced_idr;
+    // resolution changes and replugs handled without a reset
+    Counter source_changes;
+    // from the NAL units of the packets sent
+    Counter key_frames;
+    Counter key_frame_bytes;
+    Counter parameter_set_bytes;
+    // recorder: packets written, TS bytes written, packets lost because the
+    // disk fell behind or failed, segments started, failed writes
+    Counter record_packets;
+    Counter record_bytes;
+    Counter record_dropped;
+    Counter record_segments;
+    Counter record_write_errors;
+    // player seeks served from the timeshift ring
+    Counter timeshift_seeks;
+    // snapshot requests, jpegs encoded for them (the rest shared a cached
+    // one), requests that got no frame in time
+    Counter snapshot_requests;
+    Counter snapshot_encodes;
+    Counter snapshot_timeouts;
+    // sub-stream frames dropped, every scaled buffer still in the encoder
+    Counter scale_dropped;
+    // encoded packet buffers allocated, flat once the pool is warm
+    Counter packet_pool_allocations;
+
+    Gauge queue_depth;
+    Gauge fps;
+    // players joined since the stream last had none, an upper bound (DemandGate)
+    Gauge readers;
+    // 1 while encoding at full rate
+    Gauge demand_active;
+    // packets waiting for the recorder writer
+    Gauge record_queued_bytes;
+    // stream held by the timeshift ring, and how far behind live the players are
+    Gauge timeshift_depth_ms;
+    Gauge timeshift_delay_ms;
+    // newest captured frame -> frame of the last packet out of this stream's
+    // encoder, how far it trails the capture (and the other encodings of it)
+    Gauge encode_lag_ms;
+    // encoded packet buffers held by the pool, free or referenced
+    Gauge packet_pool_bytes;
+
+    uint64_t late_threshold_us = 100000;
+    // FrameTracer stream id of the spans recorded along this pipeline
+    uint16_t trace_stream = 0;
+
+    // capture thread only, updates fps once a second
+    void FrameCaptured(uint64_t now_us)
+    {
+        frames_captured.Add();
+        window_frames_++;
+        if (window_start_us_ == 0) {
+            window_start_us_ = now_us;
+        } else if (now_us - window_start_us_ >= 1000000) {
+            fps.Set(window_frames_ * 1000000 / (now_us - window_start_us_));
+            window_start_us_ = now_us;
+            window_frames_ = 0;
+        }
+    }
+
+private:
+    uint64_t window_start_us_ = 0;
+    uint64_t window_frames_ = 0;
+};
+
+/*
+ * Renders the registered pipelines in Prometheus text format.
+ */
+class MetricsRegistry {
+public:
+    // metrics must outlive the registration
+    void Register(const std::string& stream, PipelineMetrics* metrics);
+    void Unregister(PipelineMetrics* metrics);
+
+    std::string Render(void);
+
+private:
+    struct Entry {
+        std::string stream;
+        PipelineMetrics* metrics;
+    };
+
+    std::mutex mutex_;
+    std::vector<Entry> entries_;
+};
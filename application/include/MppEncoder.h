@@ -0,0 +1,106 @@
+#pragma once
+
+#include <rockchip/rk_mpi.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <readerwriterqueue/readerwriterqueue.h>
+
+#include "VideoEncoder.h"
+
+/*
+ * Hardware encoder on the Rockchip VPU, packets come out on a receive thread.
+ */
+class MppEncoder : public VideoEncoder {
+    // drives the per frame and per packet paths without an mpp context
+    friend struct MppEncoderBench;
+
+public:
+    MppEncoder(const FrameInfo& frame_info, const StreamInfo& stream_info, 
+        int timeout = -1, bool is_camera_dma = false);
+    ~MppEncoder(void);
+
+    using VideoEncoder::Init;
+    bool Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback) override;
+
+    // copied like AvEncoder, dma_fd is ignored: dma frames are imported (and
+    // the imports cached) through the FrameRef overload
+    bool PutFrame(uint8_t* data, uint32_t size, int dma_fd = -1) override;
+    // keeps the frame referenced until its packet is out of the encoder
+    bool PutFrame(FrameRef frame) override;
+
+    void Stop(void) override;
+
+    bool GetParameterSets(std::vector<uint8_t>& parameter_sets) override;
+    // MPP_ENC_SET_PREP_CFG on the running context
+    bool Reconfigure(const FrameInfo& frame_info) override;
+
+private:
+    // from frame_info_
+    bool SetPrepConfig(void);
+    uint32_t TargetBps(void) const;
+    void SetRcBps(uint32_t bps);
+    // MPP_ENC_GET_HDR_SYNC into parameter_sets_
+    bool ReadParameterSets(void);
+
+    static void EncRecvThread(MppEncoder* self);
+    // everything EncRecvThread does with a packet besides getting and freeing it
+    void OnPacket(MppPacket packet);
+    // memory frames, copied into an encoder owned buffer
+    bool PutFrame(uint8_t* data, uint32_t size, const FrameMeta& meta);
+    bool CopyFrame(uint8_t* data, uint32_t size, MppBuffer& buffer);
+    MppFrame NewFrame(MppBuffer buffer);
+    bool SubmitFrame(MppFrame frame, const FrameMeta& meta, uint64_t start_ns);
+    // submit_us is when the packet's frame went into encode_put_frame
+    FrameMeta ReleaseFrames(int64_t pts, uint64_t& submit_us);
+
+    struct ImportSlot {
+        int dma_fd = -1;
+        MppBuffer buffer = nullptr;
+        MppFrame frame = nullptr;
+    };
+    MppFrame ImportFrame(const VideoFrame& frame);
+    void ReleaseImportSlot(ImportSlot& slot);
+    void ClearImportCache(void);
+
+private:
+    MppCtx ctx_ = nullptr;
+    MppApi* api_ = nullptr;
+    MppEncRcCfg rc_cfg_;
+    MppEncPrepCfg prep_cfg_;
+    MppEncCodecCfg codec_cfg_;
+    // for frames without dma_fd
+    MppBufferGroup frame_group_ = nullptr;
+    uint32_t frame_buf_size_ = 0;
+
+    int timeout = -1;
+    bool is_camera_dma_ = false;
+    FrameInfo frame_info_;
+    StreamInfo stream_info_;
+
+    std::atomic<bool> is_running_ { false };
+    std::thread recv_thread_;
+    std::function<void(uint8_t*, uint32_t, const FrameMeta&)> package_callback_;
+    // MPP_ENC_GET_HDR_SYNC after the codec config
+    std::vector<uint8_t> parameter_sets_;
+
+    // every frame handed to mpp, in pts order, PutFrame -> EncRecvThread
+    // frame is only set for dma frames, mpp reads them until the packet is out
+    struct InFlightFrame {
+        FrameMeta meta;
+        FrameRef frame;
+        uint64_t submit_us;
+    };
+    moodycamel::ReaderWriterQueue<InFlightFrame> in_flight_ { 16 };
+    // for PutFrame without FrameRef
+    uint64_t sequence_ = 0;
+
+    // dma buffers imported once per source buffer index, dropped when the generation changes
+    MppBufferGroup import_group_ = nullptr;
+    std::vector<ImportSlot> import_slots_;
+    uint32_t import_generation_ = 0;
+};
\ No newline at end of file
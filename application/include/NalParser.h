@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+enum class NalCodec {
+    H264,
+    H265,
+};
+
+enum class StartCodeKernel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+};
+
+// offset of the first 00 00 01 in [pos, size), size if there is none
+uint32_t FindStartCodeScalar(const uint8_t* data, uint32_t size, uint32_t pos);
+#if defined(__x86_64__)
+uint32_t FindStartCodeSse2(const uint8_t* data, uint32_t size, uint32_t pos);
+uint32_t FindStartCodeAvx2(const uint8_t* data, uint32_t size, uint32_t pos);
+#endif
+#if defined(__aarch64__)
+uint32_t FindStartCodeNeon(const uint8_t* data, uint32_t size, uint32_t pos);
+#endif
+
+// false if the kernel is not built in or the cpu lacks it
+bool StartCodeKernelSupported(StartCodeKernel kernel);
+// fastest supported kernel
+StartCodeKernel BestStartCodeKernel(void);
+std::string_view StartCodeKernelName(StartCodeKernel kernel);
+
+uint32_t FindStartCode(StartCodeKernel kernel, const uint8_t* data, uint32_t size, uint32_t pos);
+
+// one NAL unit, a view into the packet
+struct NalUnit {
+    // from its start code up to the next one, trailing zero bytes of a 4 byte start code go to the next
+    const uint8_t* data;
+    uint32_t size;
+    // start code length, data + header is the NAL header
+    uint8_t header;
+    uint8_t type;
+};
+
+/*
+ * What the encoder put into one packet. The views are valid as long as the
+ * packet and until the parser parses the next one.
+ */
+struct AccessUnit {
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+    std::vector<NalUnit> nals;
+    // IDR (H.264) or IRAP (H.265) slices
+    bool key = false;
+    // VPS/SPS/PPS in the packet
+    bool has_parameter_sets = false;
+    uint32_t parameter_set_bytes = 0;
+    uint32_t slice_bytes = 0;
+};
+
+bool IsParameterSet(NalCodec codec, uint8_t type);
+bool IsSlice(NalCodec codec, uint8_t type);
+bool IsKeySlice(NalCodec codec, uint8_t type);
+
+/*
+ * Annex-B splitter for encoder output, nothing is copied.
+ */
+class NalParser {
+public:
+    explicit NalParser(NalCodec codec, StartCodeKernel kernel = BestStartCodeKernel());
+
+    const AccessUnit& Parse(const uint8_t* data, uint32_t size);
+
+    NalCodec Codec(void) const { return codec_; }
+    StartCodeKernel Kernel(void) const { return kernel_; }
+
+private:
+    NalCodec codec_;
+    StartCodeKernel kernel_;
+    // reused, no allocation once it has seen the largest packet
+    AccessUnit unit_;
+};
+
+// "H264" or "H265", like StreamInfo::StreamType
+bool ParseNalCodec(std::string_view name, NalCodec& codec);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ReplayCapture.h"
+
+/*
+ * Synthetic moving color bars, buf_count frames are rendered once in Init and
+ * handed out round robin like a V4L2 buffer ring.
+ */
+class PatternCapture : public ReplayCapture {
+public:
+    explicit PatternCapture(const CaptureSourceInfo& info);
+    ~PatternCapture(void);
+
+    bool Init(void) override;
+    void Deinit(void) override;
+
+protected:
+    bool NextFrame(PlaneData& frame) override;
+
+private:
+    void Render(uint8_t* data, uint32_t offset);
+
+private:
+    CaptureSourceInfo info_;
+    uint32_t frame_size_ = 0;
+    std::vector<std::vector<uint8_t>> frames_;
+    size_t frame_index_ = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "CaptureReactor.h"
+#include "CaptureSource.h"
+#include "ColorConverter.h"
+#include "Config.h"
+#include "DemandGate.h"
+#include "EncodedPacket.h"
+#include "FrameQueue.h"
+#include "FrameScaler.h"
+#include "Metrics.h"
+#include "Recorder.h"
+#include "Snapshot.h"
+#include "StreamServer.h"
+#include "StreamSink.h"
+#include "VideoEncoder.h"
+
+/*
+ * One input published as one or more streams: capture -> queue -> (convert
+ * or scale) -> encode -> sink per output. Outputs share the capture buffers,
+ * a buffer goes back to the driver once every encoder (or scaler) is done
+ * with it. Pipelines share the server and nothing else, an input that fails
+ * to open or goes away is retried on its own without touching the others.
+ */
+class Pipeline {
+public:
+    // server, registry and reactor (optional, shared by every V4L2 input) must outlive the pipeline
+    Pipeline(const PipelineConfig& config, StreamServer& server, MetricsRegistry& registry,
+        CaptureReactor* reactor = nullptr);
+    ~Pipeline(void);
+
+    // non blocking, the input is opened on the pipeline thread
+    void Start(void);
+    void Stop(void);
+
+    const std::string& Name(void) const { return config_.name; }
+
+private:
+    // one encoding of the input and its stream, the pipeline's own stream
+    // first. Lives as long as the pipeline, everything after the metrics is
+    // created by Open and dropped by Close
+    struct Output {
+        OutputConfig config;
+        // for logs and thread names, the pipeline name or <pipeline>/<stream_id>
+        std::string name;
+        PipelineMetrics metrics;
+        // packets for the consumers on other threads, one copy out of the encoder
+        PacketPool packets;
+
+        std::unique_ptr<VideoEncoder> encoder;
+        // sub-streams, frames are scaled on the encode thread
+        std::unique_ptr<FrameScaler> scaler;
+        std::unique_ptr<DemandGate> gate;
+        std::unique_ptr<FrameQueue> queue;
+        std::unique_ptr<StreamSink> sink;
+        // fed next to the sink, the disk never holds up the packet callback
+        std::unique_ptr<Recorder> recorder;
+        // the one parse of each packet, package callback only
+        std::unique_ptr<NalParser> parser;
+
+        std::atomic<bool> encoding { false };
+        // set by player joins, the encode thread forwards it to the encoder
+        std::atomic<bool> idr_requested { false };
+        std::thread encode_thread;
+    };
+
+    // pipeline thread, open, capture until Stop, retry on failure
+    void Run(void);
+    bool Open(void);
+    bool OpenOutput(Output& output, const FrameInfo& frame_info, const FrameQueueInfo& queue_info);
+    void Close(void);
+    // frame layout and converter for what the capture delivers
+    bool PrepareFrames(const CaptureVideoInfo& cap_info, FrameInfo& frame_info);
+    // scaler of a sub-stream and the layout its encoder gets, frame_info for the others
+    bool PrepareScaler(Output& output, const FrameInfo& frame_info, FrameInfo& output_info);
+    // create and init, Mpp falls back to Av
+    bool OpenEncoder(Output& output, const FrameInfo& frame_info);
+    // capture thread, the source changed format, the sinks keep their players
+    bool Reformat(const CaptureVideoInfo& cap_info);
+    void StartEncoding(void);
+    // every frame is back from the encoders, the encode threads are joined
+    void StopEncoding(void);
+    void Encode(Output& output);
+    // false if stopped while waiting
+    bool WaitRetry(void);
+    // capture paused while no output is watched and no snapshot waits for a frame
+    void UpdatePaused(void);
+    std::string SnapshotPath(void) const;
+
+private:
+    PipelineConfig config_;
+    StreamServer& server_;
+    MetricsRegistry& registry_;
+    CaptureReactor* reactor_;
+    // the capture and snapshot metrics go with the first output
+    std::vector<std::unique_ptr<Output>> outputs_;
+
+    // capture_ is swapped under mutex_, Stop reaches it from another thread
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    std::atomic<bool> running_ { false };
+    bool done_ = true;
+
+    std::shared_ptr<CaptureSource> capture_;
+    // one output only, several read the capture format directly
+    std::unique_ptr<ColorConverter> converter_;
+    // capture timestamp of the newest frame, for the encode lag of every output
+    std::atomic<uint64_t> newest_capture_us_ { 0 };
+    // outlives Open and Close, shared with the http handler
+    std::shared_ptr<Snapshot> snapshot_;
+    std::mutex pause_mutex_;
+
+    std::thread thread_;
+};
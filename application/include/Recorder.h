@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EncodedPacket.h"
+#include "Metrics.h"
+#include "NalParser.h"
+#include "TsMuxer.h"
+#include "VideoFrame.h"
+
+struct io_uring;
+
+struct RecordInfo {
+    // directory of the segments, empty records nothing
+    std::string path;
+    // a new segment starts on the first key frame after this long
+    uint32_t segment_ms = 60000;
+    // packets waiting for the disk, past it packets are dropped up to the next key frame
+    uint32_t max_buffer_bytes = 16 << 20;
+    // one write to the disk, rounded up to 4096
+    uint32_t write_bytes = 1 << 20;
+};
+
+/*
+ * Writes the encoded stream to MPEG-TS segments, <path>/<name>-<time>-<n>.ts.
+ * Push queues a reference to the packet and returns, the writer thread muxes and writes
+ * in large aligned batches (O_DIRECT where the filesystem takes it) with
+ * io_uring, or pwrite without it. A disk that falls behind costs dropped
+ * packets, never a stall of the encoder.
+ */
+class Recorder {
+public:
+    Recorder(const RecordInfo& info, NalCodec codec, const std::string& name);
+    ~Recorder(void);
+
+    bool Start(void);
+    // writes what is queued and closes the segment
+    void Stop(void);
+
+    // encoder thread, never waits for the disk. Needs the key flag of the packet
+    void Push(PacketRef packet);
+    // any thread, VPS/SPS/PPS for key frames that come without them
+    void SetParameterSets(const std::vector<uint8_t>& parameter_sets);
+
+    // optional, must outlive the recorder
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+
+private:
+    struct WriteBuffer {
+        uint8_t* data = nullptr;
+        uint32_t size = 0;
+        // bytes submitted, size padded to 4096 for O_DIRECT
+        uint32_t length = 0;
+        // submitted and not completed yet
+        bool busy = false;
+        uint64_t submit_us = 0;
+    };
+
+    void Run(void);
+    void WritePacket(const EncodedPacket& packet);
+
+    // writer thread, the segment file
+    bool OpenSegment(void);
+    void CloseSegment(void);
+    void Append(const uint8_t* data, uint32_t size);
+    void Submit(void);
+    // completions of io_uring writes, wait for at least one if asked
+    void Reap(bool wait);
+    void WriteFailed(int error);
+
+private:
+    RecordInfo info_;
+    std::string name_;
+    PipelineMetrics* metrics_ = nullptr;
+
+    // encoder thread, segments start on a key frame, nothing is queued until the next one
+    bool skip_to_key_ = true;
+    // skipping because of a drop, counted
+    bool dropping_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<PacketRef> packets_;
+    uint64_t queued_bytes_ = 0;
+    // from SetParameterSets, taken by the writer
+    std::vector<uint8_t> next_parameter_sets_;
+    bool has_next_parameter_sets_ = false;
+    bool running_ = false;
+    std::thread thread_;
+
+    // writer thread
+    NalParser parser_;
+    std::vector<uint8_t> parameter_sets_;
+    // a key packet without parameter sets, prefixed with the last ones
+    std::vector<uint8_t> joined_;
+    TsMuxer muxer_;
+    std::vector<uint8_t> ts_;
+    std::vector<WriteBuffer> buffers_;
+    size_t current_ = 0;
+    io_uring* ring_ = nullptr;
+    int fd_ = -1;
+    bool direct_ = false;
+    std::string segment_path_;
+    uint32_t segment_index_ = 0;
+    uint64_t segment_start_us_ = 0;
+    uint64_t base_us_ = 0;
+    bool has_base_ = false;
+    // next write, and the TS bytes in the segment (the last write may be padded)
+    uint64_t file_offset_ = 0;
+    uint64_t file_size_ = 0;
+    bool write_error_ = false;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "CaptureSource.h"
+
+/*
+ * Base of the memory backed sources, frames are contiguous (num_planes = 1)
+ * and delivered at fps, or as fast as possible when fps is 0.
+ */
+class ReplayCapture : public CaptureSource {
+public:
+    ReplayCapture(uint32_t fps, int buf_count);
+    virtual ~ReplayCapture(void) = default;
+
+    bool GetVideoInfo(CaptureVideoInfo& info) override;
+
+    bool Setup(const std::function<void(PlaneData&, int dma_fd)>& callback) override;
+    bool Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback) override;
+    bool Setup(const std::function<void(FrameRef)>& callback) override;
+
+    // frame memory belongs to the backend, a slot is free once its refcount
+    // drops to 0, this only wakes whoever waits for it
+    void ReleaseFrame(VideoFrame& frame) override;
+
+    void Stop(void) override;
+    bool Reset(void) override;
+    uint32_t InFlight(void) const override;
+
+protected:
+    // false at the end of stream
+    virtual bool NextFrame(PlaneData& frame) = 0;
+    // false if frames are still held after timeout_ms, Deinit frees nothing then
+    bool WaitFramesReturned(uint32_t timeout_ms);
+
+protected:
+    CaptureVideoInfo video_info_;
+    uint32_t fps_;
+    std::atomic<bool> is_running_ { false };
+
+private:
+    bool Loop(const std::function<void(FrameRef)>& callback);
+
+private:
+    std::vector<VideoFrame> slots_;
+    size_t slot_index_ = 0;
+    uint64_t sequence_ = 0;
+    // every slot referenced, the loop (or Deinit) sleeps until a consumer drops one
+    std::mutex release_mutex_;
+    std::condition_variable release_cond_;
+
+    std::function<void(FrameRef)> callback_;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+#include "VideoEncoder.h"
+#include "VideoFrame.h"
+
+struct SnapshotInfo {
+    // jpeg width, the height keeps the aspect ratio. 0 or wider than the capture is the capture size
+    uint32_t width = 0;
+    // a jpeg of a frame captured this recently is served without waiting for a new one
+    uint32_t max_age_ms = 1000;
+    // a request waits this long for a frame, then gets the last jpeg or nothing
+    uint32_t timeout_ms = 2000;
+};
+
+/*
+ * JPEG of the latest captured frame, encoded only when asked for. Requests
+ * that come while a jpeg is fresh share it, the others wait for the next
+ * frame and share its encode: any number of pollers cost one encode per
+ * max_age_ms at most. The capture path only checks an atomic until a request
+ * waits, then hands one frame reference over to the snapshot thread.
+ *
+ * The jpeg comes from an MJPEG encoder of the pipeline's backend, created on
+ * the first request and kept. Downscaled snapshots always use libavcodec.
+ */
+class Snapshot {
+public:
+    using Responder = std::function<void(std::shared_ptr<const std::string> jpeg)>;
+
+    Snapshot(const SnapshotInfo& info, VideoEncoderType encoder, const std::string& name);
+    ~Snapshot(void);
+
+    bool Start(void);
+    // waiting requests get the cached jpeg, later ones are answered right away
+    void Stop(void);
+
+    // capture thread, takes a reference only while a request waits for a frame
+    void Offer(const FrameRef& frame);
+    // layout of the frames offered from now on
+    void SetFrameInfo(const FrameInfo& frame_info);
+    // before the capture goes: drops a taken frame and waits for one being
+    // encoded, waiters get a later frame or time out
+    void DropFrame(void);
+
+    // any thread. respond gets the jpeg, nullptr if there is none, from the
+    // snapshot thread or right away for a fresh cached one
+    void Request(const Responder& respond);
+
+    // requests are waiting for a frame, any thread
+    bool Wanted(void) const { return wanted_.load(std::memory_order_acquire); }
+    // snapshot thread, when the first request starts waiting and after the
+    // last one is answered, e.g. to resume a paused capture. Clearing it waits
+    // for a running call
+    void SetWantedCallback(const std::function<void(bool wanted)>& callback);
+
+    // optional, must outlive the snapshot
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+
+private:
+    struct Waiter {
+        Responder respond;
+        uint64_t deadline_us;
+    };
+
+    void Run(void);
+    // snapshot thread, nullptr on failure
+    std::shared_ptr<const std::string> Encode(FrameRef frame, const FrameInfo& frame_info);
+    bool OpenEncoder(const FrameInfo& frame_info);
+    void NotifyWanted(bool wanted);
+
+private:
+    SnapshotInfo info_;
+    VideoEncoderType encoder_type_;
+    std::string name_;
+    PipelineMetrics* metrics_ = nullptr;
+
+    // capture thread -> snapshot thread
+    std::atomic<bool> want_frame_ { false };
+    std::atomic<bool> wanted_ { false };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    FrameInfo frame_info_ {};
+    bool has_frame_info_ = false;
+    // taken by Offer with the layout it was captured in
+    FrameRef frame_;
+    FrameInfo taken_info_ {};
+    std::vector<Waiter> waiters_;
+    // the snapshot thread encodes a taken frame, waiters coming meanwhile share it
+    bool encoding_ = false;
+    // encoding_ cleared, for DropFrame
+    std::condition_variable encoding_cv_;
+    std::shared_ptr<const std::string> cache_;
+    // capture stamp of the cached frame, also what tells it apart
+    uint64_t cache_timestamp_us_ = 0;
+    bool running_ = false;
+    std::thread thread_;
+
+    std::mutex callback_mutex_;
+    std::function<void(bool wanted)> wanted_callback_;
+
+    // snapshot thread, the encoder and the layout it was opened for
+    std::unique_ptr<VideoEncoder> encoder_;
+    FrameInfo encoder_info_ {};
+    // package callback -> Encode, the MPP one comes from its receive thread
+    std::mutex encoded_mutex_;
+    std::condition_variable encoded_cv_;
+    std::shared_ptr<const std::string> encoded_;
+    uint64_t encoded_timestamp_us_ = 0;
+};
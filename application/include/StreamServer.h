@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
-#include "mk_media.h"
+#include "mk_mediakit.h"
 
 #include "StreamSink.h"
 
@@ -12,8 +15,22 @@ struct StreamServerInfo {
     uint16_t rtsp_port;
     uint16_t rtmp_port;
     uint16_t http_port;
+    // ZLMediaKit event poller threads, 0 is one per cpu
+    uint16_t poller_threads = 0;
 };
 
+struct HttpResponse {
+    int code = 200;
+    std::string content_type = "text/plain";
+    std::string body;
+};
+
+// runs on a ZLMediaKit poller thread, params is the url query string
+using HttpHandler = std::function<void(const std::string& params, HttpResponse& response)>;
+// answers later, respond is called once from any thread
+using HttpResponder = std::function<void(const HttpResponse& response)>;
+using HttpAsyncHandler = std::function<void(const std::string& params, const HttpResponder& respond)>;
+
 class StreamServer {
 public:
     StreamServer(const StreamServerInfo& info);
@@ -21,10 +38,37 @@ public:
 
     bool Init(void);
 
+    // the sink gets the player events of its app and stream until it is stopped
     std::unique_ptr<StreamSink> CreateSink(const StreamSinkInfo& sink_info);
 
+    // serve path on http_port, requests that match no handler go on to ZLMediaKit
+    void AddHttpHandler(const std::string& path, const HttpHandler& handler);
+    // the poller thread goes on serving while the response is prepared
+    void AddHttpHandler(const std::string& path, const HttpAsyncHandler& handler);
+    void RemoveHttpHandler(const std::string& path);
+
     void Stop(void);
 
+private:
+    friend class StreamSink;
+    void RemoveSink(StreamSink* sink);
+
+    static void OnMkHttpRequest(const mk_parser parser, const mk_http_response_invoker invoker,
+        int* consumed, const mk_sock_info sender);
+    static void OnMkMediaPlay(const mk_media_info url_info, const mk_auth_invoker invoker,
+        const mk_sock_info sender);
+    static void OnMkMediaNoReader(const mk_media_source sender);
+
 private:
     StreamServerInfo info_;
+
+    std::mutex http_mutex_;
+    std::map<std::string, HttpAsyncHandler> http_handlers_;
+
+    // "app/stream", player events go to the sink of the stream
+    std::mutex sink_mutex_;
+    std::map<std::string, StreamSink*> sinks_;
+
+    // mk_events carries no user data
+    static StreamServer* instance_;
 };
\ No newline at end of file
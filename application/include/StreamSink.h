@@ -1,9 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <mk_media.h>
 
+#include "DemandGate.h"
+#include "Metrics.h"
+#include "NalParser.h"
+#include "TimeshiftRing.h"
+#include "VideoFrame.h"
+
 struct StreamSinkInfo {
     std::string app;
     std::string stream_id;
@@ -11,8 +22,14 @@ struct StreamSinkInfo {
     uint8_t fps;
     uint32_t width;
     uint32_t height;
+    // seek and speed of the players are served from the last seconds kept here.
+    // Every session reads the one published stream, a seek or speed change
+    // replays it for all of them, speed 0 goes back to live
+    TimeshiftInfo timeshift;
 };
 
+class StreamServer;
+
 typedef int (*SendPackage_t)(mk_media, const void*, int, uint64_t, uint64_t);
 
 class StreamSink {
@@ -22,17 +39,84 @@ public:
 
     bool Init(void);
     bool SendPackage(uint8_t* data, uint32_t size, uint64_t dts_ms, uint64_t pts_ms);
+    // stamps are the capture time relative to the first package
+    bool SendPackage(uint8_t* data, uint32_t size, const FrameMeta& meta);
+    // unit is the packet already parsed (by a PacketFanout), shared with the other consumers
+    bool SendPackage(uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit);
     void Stop(void);
 
+    // optional, must outlive the sink
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+    // optional, gets the player events of this stream, must outlive the sink
+    void SetDemandGate(DemandGate* gate) { gate_ = gate; }
+
+    // Annex-B VPS/SPS/PPS, sent ahead of every IDR that comes without them.
+    // Any thread, taken by the next package. Parameter sets seen in band replace them
+    void SetParameterSets(const std::vector<uint8_t>& parameter_sets);
+    // every player join, e.g. to ask the encoder for an IDR, any thread
+    void SetJoinCallback(const std::function<void(void)>& callback);
+
+    const StreamSinkInfo& Info(void) const { return info_; }
+
 private:
+    friend class StreamServer;
+    // ZLMediaKit player events routed here by StreamServer, poller threads
+    void OnPlayerJoin(void);
+    void OnNoReader(void);
+
     static void OnMkMediaClose(void* self);
     static int OnMkMediaPause(void* self, int pause);
     static void OnMkMediaSourceRegist(void* self, mk_media_source sender, int regist);
     static int OnMkMediaSeek(void* self, uint32_t stamp_ms);
     static int OnMkMediaSpeed(void* self, float speed);
 
+    // SendPackage thread, takes seek and speed requests and sends the ring
+    // units that are due. False while live
+    bool ServeTimeshift(uint64_t now_us);
+    void StartReplay(uint64_t position, uint64_t now_us);
+    void StopReplay(void);
+
 private:
     mk_media media_ = nullptr;
     StreamSinkInfo info_;
     SendPackage_t send_ = nullptr;
+    // capture time of the first package, microseconds
+    uint64_t base_us_ = 0;
+    bool has_base_ = false;
+
+    PipelineMetrics* metrics_ = nullptr;
+    DemandGate* gate_ = nullptr;
+
+    // SendPackage thread only
+    NalParser parser_;
+    std::vector<uint8_t> parameter_sets_;
+    // SetParameterSets -> SendPackage, e.g. new headers after a source change
+    std::mutex parameter_mutex_;
+    std::vector<uint8_t> next_parameter_sets_;
+    std::atomic<bool> has_next_parameter_sets_ { false };
+
+    // created by Init if the info asks for it, SendPackage thread
+    std::unique_ptr<TimeshiftRing> timeshift_;
+    // poller threads -> SendPackage
+    std::atomic<bool> seek_pending_ { false };
+    std::atomic<uint64_t> seek_stamp_ms_ { 0 };
+    std::atomic<float> speed_ { 1.0f };
+    // replaying from the ring instead of live, paced from the ring stamp
+    // replay_stamp_ms_ at replay_start_us_, sent on from replay_sent_ms_
+    bool replaying_ = false;
+    uint64_t replay_position_ = 0;
+    float replay_speed_ = 1.0f;
+    uint64_t replay_stamp_ms_ = 0;
+    uint64_t replay_start_us_ = 0;
+    uint64_t replay_sent_ms_ = 0;
+    // last dts handed to ZLMediaKit, what goes out never goes back
+    uint64_t sent_ms_ = 0;
+
+    std::mutex join_mutex_;
+    std::function<void(void)> join_callback_;
+    // players waiting for their first IDR, joined at
+    std::vector<uint64_t> join_us_;
+    std::atomic<bool> join_pending_ { false };
+    // set by StreamServer::CreateSink, the sink unregisters on Stop
+    StreamServer* server_ = nullptr;
 };
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+enum class ThreadRole {
+    // capture loop, V4L2 dequeue and the handoff to the queue
+    Capture,
+    // pipeline encode thread, convert band 0 and PutFrame
+    Encode,
+    // MppEncoder packet thread
+    EncoderRecv,
+    // BandWorkers of the ColorConverter and the FrameScaler
+    Convert,
+    // ZLMediaKit event pollers, rtsp/rtmp/http io
+    Poller,
+};
+
+constexpr size_t kThreadRoles = 5;
+
+struct CpuInfo {
+    int cpu;
+    // sysfs cpu_capacity (1024 is the fastest core), cpuinfo_max_freq in kHz without it
+    uint32_t capacity;
+    // fastest / slowest cores of the system, both on a homogeneous one
+    bool big;
+    bool little;
+};
+
+// online cpus of sysfs_root, e.g. /sys/devices/system/cpu
+std::vector<CpuInfo> ReadCpuTopology(const std::string& sysfs_root = "/sys/devices/system/cpu");
+
+struct ThreadPolicy {
+    // "big", "little", "all" or a cpu list like "4-7,2", empty leaves the affinity alone
+    std::string cpus;
+    // 1 - 99 runs SCHED_FIFO at that priority, 0 is SCHED_OTHER at nice
+    int priority = 0;
+    int nice = 0;
+};
+
+struct PlacementInfo {
+    std::array<ThreadPolicy, kThreadRoles> roles;
+
+    ThreadPolicy& operator[](ThreadRole role) { return roles[(size_t)role]; }
+    const ThreadPolicy& operator[](ThreadRole role) const { return roles[(size_t)role]; }
+};
+
+/*
+ * Pins pipeline threads to cores by role and sets their scheduling. On the
+ * RK3588 the capture and encode threads belong on the A76 cores, where the
+ * scheduler moving them to an A55 shows up as capture_to_send jitter.
+ * Threads apply their own role when they start. Failures (no CAP_SYS_NICE
+ * for SCHED_FIFO, a cpu list outside the system) are logged and the thread
+ * runs on as it is, what it ended up with is reported by Render.
+ */
+class ThreadPlacement {
+public:
+    // process wide, encoder and converter threads have no pipeline to ask
+    static ThreadPlacement& Instance(void);
+
+    // before the threads start, false if a cpu list does not parse
+    bool Configure(const PlacementInfo& info);
+    const PlacementInfo& Info(void) const { return info_; }
+
+    // calling thread, name shows up in top and the metrics (15 characters)
+    bool Apply(ThreadRole role, const std::string& name);
+    // threads this library did not start, e.g. the ZLMediaKit pollers, by
+    // thread name prefix, returns how many were placed
+    int ApplyByName(ThreadRole role, std::string_view prefix);
+
+    // Prometheus text: cpu capacities and every placed thread, its cpu and
+    // involuntary context switches
+    std::string Render(void);
+
+private:
+    bool ApplyTo(pid_t tid, ThreadRole role, const std::string& name);
+
+private:
+    struct Placed {
+        pid_t tid;
+        ThreadRole role;
+        std::string name;
+        std::string cpus;
+        std::string policy;
+        int priority;
+    };
+
+    std::mutex mutex_;
+    PlacementInfo info_;
+    std::vector<CpuInfo> topology_;
+    // resolved affinity per role, empty leaves it alone
+    std::array<std::vector<int>, kThreadRoles> cpus_;
+    std::vector<Placed> placed_;
+};
+
+// "capture", "encode", "encoder_recv", "convert" or "poller"
+bool ParseThreadRole(std::string_view name, ThreadRole& role);
+const char* ThreadRoleName(ThreadRole role);
+
+// "big", "little", "all" or "0-3,6" against topology
+bool ParseCpuList(std::string_view list, const std::vector<CpuInfo>& topology, std::vector<int>& cpus);
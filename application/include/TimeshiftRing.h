@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct TimeshiftInfo {
+    // bytes of encoded stream kept for seek and speed, 0 keeps nothing
+    uint32_t max_bytes = 0;
+    // older access units go even if there is room
+    uint32_t max_seconds = 30;
+};
+
+/*
+ * The last seconds of encoded access units in one buffer allocated up front.
+ * Units are copied in back to back and wrap to the start when the end is
+ * reached, the oldest go to make room. Positions count every unit ever
+ * appended, a position stays readable until its unit is evicted.
+ *
+ * Append, Find and Get are for one thread (the sink's), the stamp range
+ * may be read from any thread.
+ */
+class TimeshiftRing {
+public:
+    struct Unit {
+        const uint8_t* data = nullptr;
+        uint32_t size = 0;
+        uint64_t stamp_ms = 0;
+        bool key = false;
+    };
+
+    // the index holds max_seconds at fps, twice over
+    TimeshiftRing(const TimeshiftInfo& info, uint32_t fps);
+
+    // prefix (e.g. parameter sets) is stored ahead of data as one unit,
+    // false if the unit is larger than the ring
+    bool Append(const uint8_t* prefix, uint32_t prefix_size, const uint8_t* data, uint32_t size, uint64_t stamp_ms,
+        bool key);
+
+    // last key unit at or before stamp_ms, the oldest key if stamp_ms is older
+    bool FindKey(uint64_t stamp_ms, uint64_t& position) const;
+    bool Get(uint64_t position, Unit& unit) const;
+
+    // [Begin, End) are held
+    uint64_t Begin(void) const { return begin_; }
+    uint64_t End(void) const { return end_; }
+
+    // any thread, 0 while empty
+    uint64_t OldestStamp(void) const { return oldest_stamp_ms_.load(std::memory_order_relaxed); }
+    uint64_t NewestStamp(void) const { return newest_stamp_ms_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t size;
+        uint64_t stamp_ms;
+        bool key;
+    };
+
+    const Entry& At(uint64_t position) const { return index_[position % index_.size()]; }
+    void Evict(void);
+
+private:
+    TimeshiftInfo info_;
+    std::vector<uint8_t> data_;
+    std::vector<Entry> index_;
+    uint64_t begin_ = 0;
+    uint64_t end_ = 0;
+
+    std::atomic<uint64_t> oldest_stamp_ms_ { 0 };
+    std::atomic<uint64_t> newest_stamp_ms_ { 0 };
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "NalParser.h"
+
+/*
+ * MPEG-TS for one Annex-B video stream: PAT, PMT and one PES per access
+ * unit with a PCR on the video PID. A segment that starts with the tables
+ * and a key unit opens in any player from its first byte.
+ */
+class TsMuxer {
+public:
+    static constexpr uint32_t kPacketSize = 188;
+    static constexpr uint16_t kPmtPid = 0x1000;
+    static constexpr uint16_t kVideoPid = 0x100;
+
+    explicit TsMuxer(NalCodec codec);
+
+    // PAT and PMT, appended to out
+    void WriteTables(std::vector<uint8_t>& out);
+    // one access unit on the 90 kHz clock, the PCR trails the pts by
+    // kPcrDelay90k. Key units carry the random access indicator
+    void WriteAccessUnit(const uint8_t* data, uint32_t size, uint64_t pts_90k, bool key, std::vector<uint8_t>& out);
+
+    static constexpr uint64_t kPcrDelay90k = 9000;
+
+private:
+    void WriteSection(uint16_t pid, uint8_t& counter, const uint8_t* section, uint32_t size, std::vector<uint8_t>& out);
+
+private:
+    NalCodec codec_;
+    uint8_t pat_counter_ = 0;
+    uint8_t pmt_counter_ = 0;
+    uint8_t video_counter_ = 0;
+};
+
+// CRC-32/MPEG-2 of the PSI sections
+uint32_t TsCrc32(const uint8_t* data, uint32_t size);
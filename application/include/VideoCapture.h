@@ -1,29 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
 
-struct PlaneData {
-    void* start;
-    uint32_t size;
-};
-
-struct BufferData {
-    int dma_fd;
-    std::vector<PlaneData> data;
-};
-
-struct CaptureVideoInfo {
-    uint32_t height;
-    uint32_t width;
-    std::string pixelformat;
-    uint8_t num_planes;
-    std::vector<uint32_t> sizeimage;
-    std::string colorspace;
-};
+#include "CaptureSource.h"
 
 struct CaputreAbility {
     bool is_capture_mplane;
@@ -34,31 +20,78 @@ struct CaputreAbility {
     bool is_readwrite;
 };
 
-class VideoCapture {
+class VideoCapture : public CaptureSource {
 public:
     VideoCapture() = delete;
     VideoCapture(std::string_view video_path, int buf_size = 5, uint32_t timeout = 10);
+    // size, pixelformat and formats of info steer the format negotiation
+    explicit VideoCapture(const CaptureSourceInfo& info);
 
-    bool Init(void);
+    bool Init(void) override;
 
     ~VideoCapture(void);
-    bool GetVideoInfo(CaptureVideoInfo& info);
+    bool GetVideoInfo(CaptureVideoInfo& info) override;
     bool SetVideoFormat(CaptureVideoInfo& video_info);
 
-    bool Setup(const std::function<void(PlaneData&, int dma_fd)>& callback);
-    bool Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback);
+    bool Setup(const std::function<void(PlaneData&, int dma_fd)>& callback) override;
+    bool Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback) override;
+    bool Setup(const std::function<void(FrameRef)>& callback) override;
+
+    // VIDIOC_QBUF once the last FrameRef is dropped, may run on any thread
+    void ReleaseFrame(VideoFrame& frame) override;
 
-    void Deinit(void);
-    bool Reset(void);
+    void Stop(void) override;
+    void Deinit(void) override;
+    bool Reset(void) override;
+    uint32_t InFlight(void) const override { return in_flight_.load(std::memory_order_acquire); }
 
 private:
     bool CheckCaptureAbility(void);
     bool CheckVideoFormat(void);
-    std::vector<std::string> EnumVideoFormat(void);
+    std::vector<uint32_t> EnumVideoFormat(void);
+    // discrete sizes only, empty if the device takes any size in a range
+    std::vector<std::pair<uint32_t, uint32_t>> EnumFrameSizes(uint32_t fourcc);
+    // cheapest format both the device and the consumer take, then S_FMT and read it back
+    bool NegotiateVideoFormat(void);
 
     uint32_t ReqVideoBuffers(uint32_t buf_count);
     bool QueryVideoBuffers(void);
     bool QueueVideoBuffers(void);
+    // STREAMON / STREAMOFF, buffers released while off are queued again by StreamOn
+    bool StreamOn(void);
+    bool StreamOff(void);
+    // unmap and close the buffers, the fd stays open
+    void ReleaseBuffers(void);
+    // consumers give frames back on their own threads, false after timeout_ms
+    bool WaitFramesReturned(uint32_t timeout_ms);
+
+    // V4L2_EVENT_SOURCE_CHANGE: STREAMOFF, re-query, realloc only if the
+    // layout changed, STREAMON. The fd, the callbacks and downstream
+    // sessions stay as they are
+    bool HandleEvents(void);
+    bool Renegotiate(void);
+    // HDMI receivers, false while there is no stable signal
+    bool ApplyDvTimings(void);
+
+    bool Loop(const std::function<void(FrameRef)>& callback);
+    // non blocking DQBUF and the callback, false if no buffer was ready
+    bool DequeueFrame(uint64_t wait_start_us);
+
+    // what made the reactor hand the fd back to the Setup thread
+    enum class ReactorEvent {
+        None,
+        // V4L2 event pending, handled on the Setup thread, Renegotiate blocks
+        Events,
+        Timeout,
+        Error,
+        // pause or Stop, checked by the loop
+        Wake,
+    };
+    // Setup thread, frames are dequeued on a reactor thread until it returns
+    bool ReactorWait(void);
+    // reactor thread, see CaptureReactor::Handler
+    int OnReactorEvent(uint32_t events);
+    int HandBack(ReactorEvent event);
 
 private:
     int fd_ = -1;
@@ -67,8 +100,10 @@ private:
     int buf_count_;
 
     CaputreAbility ability_;
+    // what the user asked for, see CaptureSourceInfo
+    CaptureSourceInfo request_;
 
-    bool is_running_ = false;
+    std::atomic<bool> is_running_ { false };
 
     uint32_t buf_type_;
 
@@ -80,7 +115,38 @@ private:
     // for mplane
     std::vector<struct v4l2_plane*> planes_buffers_;
 
-    std::function<void(PlaneData&, int dma_fd)> callback_op_;
-    std::function<void(std::vector<PlaneData>&, int dma_fd)> callback_mp_;
-
+    // one slot for each buf, handed out to consumers between DQBUF and QBUF
+    std::vector<VideoFrame> frames_;
+    uint32_t generation_ = 0;
+    std::atomic<uint32_t> in_flight_ { 0 };
+
+    enum class BufferState {
+        Queued,
+        InUse,
+        // dequeued by STREAMOFF or released while off
+        Free,
+    };
+    std::mutex stream_mutex_;
+    bool streaming_ = false;
+    std::vector<BufferState> buffer_state_;
+
+    std::function<void(FrameRef)> callback_;
+
+    // subscribed to V4L2_EVENT_SOURCE_CHANGE
+    bool source_events_ = false;
+    // stream off until the next source change
+    bool no_signal_ = false;
+    // source change seen, until the first frame after it
+    uint64_t change_start_us_ = 0;
+
+    // frame drops from the sequence gaps, reset whenever the stream restarts
+    bool has_sequence_ = false;
+    uint32_t last_sequence_ = 0;
+    std::vector<struct v4l2_plane> dequeue_planes_;
+
+    std::mutex reactor_mutex_;
+    std::condition_variable reactor_cv_;
+    ReactorEvent reactor_event_ = ReactorEvent::None;
+    // reactor thread only, since the fd was last armed
+    uint64_t wait_start_us_ = 0;
 };
\ No newline at end of file
@@ -1,49 +1,97 @@
 #pragma once
 
-#include <rockchip/rk_mpi.h>
-
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
-#include <thread>
+#include <string_view>
+#include <vector>
+
+#include "Metrics.h"
+#include "VideoFrame.h"
 
 struct FrameInfo {
     uint32_t height;
     uint32_t width;
     std::string format;
     uint8_t fps;
+    // layout of the frames handed in, bytes per line of the first plane and
+    // lines to the second plane, 0 is tightly packed
+    uint32_t hor_stride = 0;
+    uint32_t ver_stride = 0;
 };
 
 struct StreamInfo {
+    // H264, H265 or MJPEG
     std::string StreamType;
     uint32_t gop;
+    // bits per second, 0 is width * height * fps / 8
+    uint32_t bitrate = 0;
+    // encoded size, 0 is the frame size. Only libavcodec scales
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+enum class VideoEncoderType {
+    // Rockchip VPU
+    Mpp,
+    // libavcodec software encoder
+    Av,
 };
 
+/*
+ * Raw frames in, Annex-B packets out through the package callback. Backends
+ * may call the callback from their own thread.
+ */
 class VideoEncoder {
 public:
-    VideoEncoder(const FrameInfo& frame_info, const StreamInfo& stream_info, 
-        int timeout = -1, bool is_camera_dma = false);
-    ~VideoEncoder(void);
+    virtual ~VideoEncoder(void) = default;
 
     bool Init(const std::function<void(uint8_t*, uint32_t)>& package_callback);
+    // meta is the one of the frame the packet was encoded from
+    virtual bool Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback) = 0;
 
-    bool PutFrame(uint8_t* data, uint32_t size, int dma_fd = -1);
+    virtual bool PutFrame(uint8_t* data, uint32_t size, int dma_fd = -1) = 0;
+    // keeps the frame referenced until the encoder is done reading it
+    virtual bool PutFrame(FrameRef frame) = 0;
 
-private:
-    static void EncRecvThread(VideoEncoder* self);
+    virtual void Stop(void) = 0;
+
+    // the next frame put is encoded as an IDR, any thread. Requests within
+    // the idr interval of the last forced IDR wait for it, a burst of joins
+    // costs one IDR
+    void ForceIdr(void) { force_idr_.store(true, std::memory_order_release); }
+    void SetIdrInterval(uint32_t interval_ms) { idr_interval_us_ = interval_ms * 1000ULL; }
+
+    // VPS/SPS/PPS (Annex-B) the stream starts with, false if they are only in band
+    virtual bool GetParameterSets(std::vector<uint8_t>& parameter_sets) { return false; }
+
+    // new input size or layout, e.g. after an HDMI resolution change. Called
+    // with no frame in the encoder, false if the backend has to be created again
+    virtual bool Reconfigure(const FrameInfo& frame_info) { return false; }
+
+    // optional, must outlive the encoder
+    void SetMetrics(PipelineMetrics* metrics) { metrics_ = metrics; }
+
+protected:
+    // encode thread, true once per ForceIdr and idr interval
+    bool TakeIdrRequest(void);
+
+protected:
+    PipelineMetrics* metrics_ = nullptr;
 
 private:
-    MppCtx ctx_ = nullptr;
-    MppApi* api_ = nullptr;
-    MppEncRcCfg rc_cfg_;
-    MppEncPrepCfg prep_cfg_;
-    MppEncCodecCfg codec_cfg_;
-
-    int timeout = -1;
-    bool is_camera_dma_ = false;
-    FrameInfo frame_info_;
-    StreamInfo stream_info_;
-
-    bool is_running_ = false;
-    std::thread recv_thread_;
-    std::function<void(uint8_t*, uint32_t)> package_callback_;
-};
\ No newline at end of file
+    std::atomic<bool> force_idr_ { false };
+    uint64_t idr_interval_us_ = 1000000;
+    uint64_t last_idr_us_ = 0;
+};
+
+std::unique_ptr<VideoEncoder> CreateVideoEncoder(VideoEncoderType type, const FrameInfo& frame_info,
+    const StreamInfo& stream_info, int timeout = -1);
+
+// pixel formats the backend takes, see CaptureFormats
+std::vector<std::string> VideoEncoderFormats(VideoEncoderType type);
+
+// "mpp" or "av"
+bool ParseVideoEncoderType(std::string_view name, VideoEncoderType& type);
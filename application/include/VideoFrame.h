@@ -0,0 +1,133 @@
+#pragma once
+
+#include <time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct PlaneData {
+    void* start;
+    uint32_t size;
+};
+
+struct VideoFrame;
+
+// Travels with a frame from VIDIOC_DQBUF to the encoded packet
+struct FrameMeta {
+    uint64_t sequence = 0;
+    // CLOCK_MONOTONIC, microseconds, also the mpp pts
+    uint64_t timestamp_us = 0;
+};
+
+static inline uint64_t MonotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t MonotonicUs(void)
+{
+    return MonotonicNs() / 1000;
+}
+
+// Who gets the frame back when the last FrameRef is dropped
+class FrameOwner {
+public:
+    virtual ~FrameOwner(void) = default;
+    virtual void ReleaseFrame(VideoFrame& frame) = 0;
+};
+
+/*
+ * One capture buffer slot. The slot is owned by the source, consumers only
+ * hold it through FrameRef.
+ */
+struct VideoFrame {
+    // buffer index of the source
+    uint32_t index = 0;
+    // bumped each time the source reallocates its buffers
+    uint32_t generation = 0;
+    int dma_fd = -1;
+    // bytes behind dma_fd as allocated, planes hold what the last frame used
+    uint32_t dma_size = 0;
+    std::vector<PlaneData> planes;
+    FrameMeta meta;
+
+    FrameOwner* owner = nullptr;
+    std::atomic<uint32_t> refcount { 0 };
+};
+
+/*
+ * Intrusive reference to a VideoFrame, the frame goes back to its owner
+ * (e.g. VIDIOC_QBUF) when the last reference is dropped.
+ */
+class FrameRef {
+public:
+    FrameRef(void) = default;
+
+    // take the first reference of a free slot
+    static FrameRef Adopt(VideoFrame* frame)
+    {
+        frame->refcount.store(1, std::memory_order_relaxed);
+        return FrameRef(frame);
+    }
+
+    FrameRef(const FrameRef& other)
+        : frame_(other.frame_)
+    {
+        if (frame_ != nullptr) {
+            frame_->refcount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    FrameRef(FrameRef&& other) noexcept
+        : frame_(std::exchange(other.frame_, nullptr))
+    {
+    }
+
+    FrameRef& operator=(const FrameRef& other)
+    {
+        FrameRef(other).Swap(*this);
+        return *this;
+    }
+
+    FrameRef& operator=(FrameRef&& other) noexcept
+    {
+        FrameRef(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~FrameRef(void)
+    {
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        auto frame = std::exchange(frame_, nullptr);
+        if (frame != nullptr && frame->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            frame->owner->ReleaseFrame(*frame);
+        }
+    }
+
+    void Swap(FrameRef& other) noexcept
+    {
+        std::swap(frame_, other.frame_);
+    }
+
+    VideoFrame* Get(void) const { return frame_; }
+    VideoFrame* operator->(void) const { return frame_; }
+    VideoFrame& operator*(void) const { return *frame_; }
+    explicit operator bool(void) const { return frame_ != nullptr; }
+
+private:
+    explicit FrameRef(VideoFrame* frame)
+        : frame_(frame)
+    {
+    }
+
+private:
+    VideoFrame* frame_ = nullptr;
+};
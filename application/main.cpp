@@ -1,69 +1,125 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
 
+#include <CaptureReactor.h>
+#include <CaptureSource.h>
+#include <Config.h>
+#include <FrameQueue.h>
+#include <FrameTracer.h>
+#include <Metrics.h>
+#include <Pipeline.h>
 #include <StreamServer.h>
-#include <VideoCapture.h>
+#include <ThreadPlacement.h>
 #include <VideoEncoder.h>
 
 #include <spdlog/spdlog.h>
 
-int main(int argc, char **argv) {
-  auto capture = std::make_shared<VideoCapture>("/dev/video0", 5, 2);
+namespace {
 
-  if (!capture->Init()) {
-    return -1;
+std::atomic<bool> g_running = true;
+std::atomic<bool> g_dump_trace = false;
+
+void OnSignal(int) { g_running = false; }
+
+// the file is written by the main loop, not in the handler
+void OnDumpTrace(int) { g_dump_trace = true; }
+
+} // namespace
+
+int main(int argc, char **argv) {
+  ServerConfig config;
+  if (argc > 2 && std::strcmp(argv[1], "-c") == 0) {
+    if (!LoadConfig(argv[2], config)) {
+      return -1;
+    }
+  } else {
+    // a single pipeline from the command line, e.g. "file:input.y4m?fps=60" or "pattern:3840x2160?fmt=NV12&fps=0"
+    PipelineConfig pipeline;
+    if ((argc > 1 && !ParseCaptureSource(argv[1], pipeline.source)) ||
+        (argc > 2 && !ParseVideoEncoderType(argv[2], pipeline.encoder)) ||
+        (argc > 3 && !ParseDropPolicy(argv[3], pipeline.queue.policy))) {
+      spdlog::error("Usage: {} -c config.ini", argv[0]);
+      spdlog::error("       {} [/dev/videoN | file:path?w=&h=&fmt=&fps= | pattern:WxH?fmt=&fps=] [mpp | av] "
+                    "[newest | oldest | latest]",
+                    argv[0]);
+      return -1;
+    }
+    pipeline.stream_id = "1";
+    config.pipelines.push_back(std::move(pipeline));
   }
-  CaptureVideoInfo cap_info;
-  if (!capture->GetVideoInfo(cap_info)) {
+
+  // before any thread starts, every thread places itself by role
+  if (!ThreadPlacement::Instance().Configure(config.threads)) {
     return -1;
   }
-  FrameInfo frame_info;
-  frame_info.format = std::move(cap_info.pixelformat);
-  frame_info.fps = 60;
-  frame_info.height = cap_info.height;
-  frame_info.width = cap_info.width;
-
-  StreamInfo stream_info;
-  stream_info.gop = 120;
-  stream_info.StreamType = "H265";
+  FrameTracer::Instance().Configure(config.trace);
 
-  VideoEncoder encoder(frame_info, stream_info, 10, true);
-  StreamServerInfo server_info;
-  server_info.http_port = 10000;
-  server_info.rtmp_port = 10001;
-  server_info.rtsp_port = 10002;
+  // declared first, the pipelines register their metrics here
+  MetricsRegistry metrics_registry;
 
-  StreamServer server(server_info);
+  StreamServer server(config.server);
   if (!server.Init()) {
     return -1;
   }
-  StreamSinkInfo sink_info;
-  sink_info.app = "live";
-  sink_info.stream_id = "1";
-  sink_info.height = cap_info.height;
-  sink_info.width = cap_info.width;
-  sink_info.stream_type = stream_info.StreamType;
+  server.AddHttpHandler("/metrics", [&](const std::string &, HttpResponse &response) {
+    response.content_type = "text/plain; version=0.0.4";
+    response.body = metrics_registry.Render() + ThreadPlacement::Instance().Render();
+  });
+  // /trace is the Chrome trace JSON of what was recorded, /trace?start[=seconds] and /trace?stop record
+  server.AddHttpHandler("/trace", [](const std::string &params, HttpResponse &response) {
+    auto &tracer = FrameTracer::Instance();
+    if (params.rfind("start", 0) == 0) {
+      uint32_t seconds = params.size() > 6 ? std::strtoul(params.c_str() + 6, nullptr, 10) : 0;
+      tracer.Start(seconds);
+      response.body = "started\n";
+    } else if (params == "stop") {
+      tracer.Stop();
+      response.body = "stopped\n";
+    } else {
+      response.content_type = "application/json";
+      response.body = tracer.Render();
+    }
+  });
 
-  auto sink = server.CreateSink(sink_info);
-  if (!sink->Init()) {
-    return -1;
+  // V4L2 inputs are dequeued by a few epoll threads instead of one blocked thread each
+  std::unique_ptr<CaptureReactor> reactor;
+  if (config.capture_threads > 0) {
+    reactor = std::make_unique<CaptureReactor>(config.capture_threads);
+    if (!reactor->Start()) {
+      return -1;
+    }
   }
 
-  if (!encoder.Init([&](uint8_t *data, uint32_t size) {
-        sink->SendPackage(data, size, 0, 0);
-        // spdlog::info("Get Package {} {}", fmt::ptr(data), size);
-      })) {
-    return -1;
+  // every input opens and retries on its own thread, a missing camera does not hold up the others
+  std::vector<std::unique_ptr<Pipeline>> pipelines;
+  for (auto &pipeline_config : config.pipelines) {
+    spdlog::info("Pipeline {} -> {}/{}", pipeline_config.name, pipeline_config.app, pipeline_config.stream_id);
+    pipelines.push_back(std::make_unique<Pipeline>(pipeline_config, server, metrics_registry, reactor.get()));
+    pipelines.back()->Start();
   }
 
-  if (!capture->Setup([&](std::vector<PlaneData> &data, int dma_fd) {
-        encoder.PutFrame((uint8_t *)data[0].start, data[0].size, dma_fd);
-      })) {
-    while (true) {
-      capture->Reset();
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+  std::signal(SIGUSR1, OnDumpTrace);
+  while (g_running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    FrameTracer::Instance().Poll(MonotonicUs());
+    if (g_dump_trace.exchange(false)) {
+      FrameTracer::Instance().Dump();
     }
-    return -1;
   }
 
+  for (auto &pipeline : pipelines) {
+    pipeline->Stop();
+  }
+  pipelines.clear();
+  reactor.reset();
+  server.Stop();
   return 0;
 }
@@ -0,0 +1,341 @@
+#include "AvEncoder.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+#include <spdlog/spdlog.h>
+
+#include "FrameTracer.h"
+
+static inline std::string AvError(int error)
+{
+    char buf[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+    av_strerror(error, buf, sizeof(buf));
+    return buf;
+}
+
+static inline AVPixelFormat AdaptFrameType(std::string_view frame_type)
+{
+    if (frame_type.compare("BGR24") == 0) {
+        return AV_PIX_FMT_BGR24;
+    } else if (frame_type.compare("NV12") == 0) {
+        return AV_PIX_FMT_NV12;
+    } else if (frame_type.compare("I420") == 0) {
+        return AV_PIX_FMT_YUV420P;
+    } else if (frame_type.compare("NV16") == 0) {
+        return AV_PIX_FMT_NV16;
+    } else if (frame_type.compare("YUYV") == 0) {
+        return AV_PIX_FMT_YUYV422;
+    }
+
+    spdlog::error("Unkonw Frame Type {}", frame_type);
+    return AV_PIX_FMT_NONE;
+}
+
+// the source format if the encoder takes it, saves the conversion
+static inline AVPixelFormat SelectFormat(const AVCodec* codec, AVPixelFormat src_format)
+{
+    if (codec->pix_fmts == nullptr) {
+        return AV_PIX_FMT_YUV420P;
+    }
+    bool has_yuv420p = false;
+    for (auto format = codec->pix_fmts; *format != AV_PIX_FMT_NONE; format++) {
+        if (*format == src_format) {
+            return src_format;
+        }
+        has_yuv420p |= *format == AV_PIX_FMT_YUV420P;
+    }
+    return has_yuv420p ? AV_PIX_FMT_YUV420P : codec->pix_fmts[0];
+}
+
+AvEncoder::AvEncoder(const FrameInfo& frame_info, const StreamInfo& stream_info)
+    : frame_info_(frame_info)
+    , stream_info_(stream_info)
+{
+}
+
+AvEncoder::~AvEncoder(void)
+{
+    Stop();
+    // drops the capture frames libavcodec still references
+    avcodec_free_context(&ctx_);
+    sws_freeContext(sws_);
+    av_frame_free(&src_frame_);
+    av_frame_free(&dst_frame_);
+    av_packet_free(&packet_);
+}
+
+bool AvEncoder::Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback)
+{
+    AVCodecID codec_id;
+    const char* codec_name;
+    if (stream_info_.StreamType.compare("H264") == 0) {
+        codec_id = AV_CODEC_ID_H264;
+        codec_name = "libx264";
+    } else if (stream_info_.StreamType.compare("H265") == 0) {
+        codec_id = AV_CODEC_ID_HEVC;
+        codec_name = "libx265";
+    } else if (stream_info_.StreamType.compare("MJPEG") == 0) {
+        codec_id = AV_CODEC_ID_MJPEG;
+        codec_name = "mjpeg";
+    } else {
+        spdlog::error("Unkown support type {}", stream_info_.StreamType);
+        return false;
+    }
+    auto codec = avcodec_find_encoder_by_name(codec_name);
+    if (codec == nullptr) {
+        codec = avcodec_find_encoder(codec_id);
+    }
+    if (codec == nullptr) {
+        spdlog::error("libavcodec has no {} encoder", stream_info_.StreamType);
+        return false;
+    }
+
+    src_format_ = AdaptFrameType(frame_info_.format);
+    if (src_format_ == AV_PIX_FMT_NONE) {
+        return false;
+    }
+
+    ctx_ = avcodec_alloc_context3(codec);
+    if (ctx_ == nullptr) {
+        spdlog::error("Alloc codec context error");
+        return false;
+    }
+    ctx_->width = stream_info_.width != 0 ? stream_info_.width : frame_info_.width;
+    ctx_->height = stream_info_.height != 0 ? stream_info_.height : frame_info_.height;
+    ctx_->pix_fmt = SelectFormat(codec, src_format_);
+    // pts are capture timestamps in microseconds
+    ctx_->time_base = { 1, 1000000 };
+    ctx_->framerate = { frame_info_.fps, 1 };
+    ctx_->gop_size = stream_info_.gop;
+    ctx_->max_b_frames = 0;
+    // same target as the mpp encoder
+    auto bps = stream_info_.bitrate != 0 ? stream_info_.bitrate
+                                         : frame_info_.width * frame_info_.height / 8 * frame_info_.fps;
+    if (codec_id == AV_CODEC_ID_MJPEG) {
+        // single pictures, a fixed quantizer instead of a rate. Captures are
+        // limited range, swscale expands them to the full range jpeg format
+        ctx_->flags |= AV_CODEC_FLAG_QSCALE;
+        ctx_->global_quality = FF_QP2LAMBDA * 4;
+        ctx_->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    } else {
+        ctx_->bit_rate = bps;
+        ctx_->rc_max_rate = bps * 17 / 16;
+        ctx_->rc_buffer_size = bps;
+    }
+    // frame threads add a frame of delay each, slice threads do not
+    ctx_->thread_count = 0;
+    ctx_->thread_type = FF_THREAD_SLICE;
+    // no global header, parameter sets are repeated in band before every IDR
+    if (av_opt_set(ctx_->priv_data, "preset", "ultrafast", 0) < 0) {
+        spdlog::debug("{} has no preset option", codec->name);
+    }
+    if (av_opt_set(ctx_->priv_data, "tune", "zerolatency", 0) < 0) {
+        spdlog::debug("{} has no tune option", codec->name);
+    }
+    // ForceIdr: an I frame picture type starts a new gop instead of a plain I frame
+    if (av_opt_set(ctx_->priv_data, "forced-idr", "1", 0) < 0) {
+        spdlog::debug("{} has no forced-idr option", codec->name);
+    }
+
+    auto ret = avcodec_open2(ctx_, codec, nullptr);
+    if (ret < 0) {
+        spdlog::error("Open {} error {}", codec->name, AvError(ret));
+        return false;
+    }
+
+    src_frame_ = av_frame_alloc();
+    packet_ = av_packet_alloc();
+    if (src_frame_ == nullptr || packet_ == nullptr) {
+        spdlog::error("Alloc frame error");
+        return false;
+    }
+    if (ctx_->pix_fmt != src_format_ || ctx_->width != (int)frame_info_.width
+        || ctx_->height != (int)frame_info_.height) {
+        sws_ = sws_getContext(frame_info_.width, frame_info_.height, src_format_,
+            ctx_->width, ctx_->height, ctx_->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        dst_frame_ = av_frame_alloc();
+        if (sws_ == nullptr || dst_frame_ == nullptr) {
+            spdlog::error("Create converter {} -> {} error",
+                av_get_pix_fmt_name(src_format_), av_get_pix_fmt_name(ctx_->pix_fmt));
+            return false;
+        }
+        dst_frame_->format = ctx_->pix_fmt;
+        dst_frame_->width = ctx_->width;
+        dst_frame_->height = ctx_->height;
+        ret = av_frame_get_buffer(dst_frame_, 0);
+        if (ret < 0) {
+            spdlog::error("Alloc frame buffer error {}", AvError(ret));
+            return false;
+        }
+    }
+
+    spdlog::info("Av encoder {} {}x{} {} -> {}x{} {}, threads {}", codec->name, frame_info_.width,
+        frame_info_.height, av_get_pix_fmt_name(src_format_), ctx_->width, ctx_->height,
+        av_get_pix_fmt_name(ctx_->pix_fmt), ctx_->thread_count);
+
+    package_callback_ = package_callback;
+    is_running_ = true;
+    return true;
+}
+
+bool AvEncoder::FillPlanes(AVFrame* frame, const std::vector<PlaneData>& planes)
+{
+    frame->format = src_format_;
+    frame->width = frame_info_.width;
+    frame->height = frame_info_.height;
+    av_image_fill_linesizes(frame->linesize, src_format_, frame_info_.width);
+    // capture strides, chroma planes scale with the luma one
+    if (frame_info_.hor_stride != 0 && frame->linesize[0] != 0) {
+        auto packed = frame->linesize[0];
+        for (int i = 0; i < 4; i++) {
+            frame->linesize[i] = (int64_t)frame->linesize[i] * frame_info_.hor_stride / packed;
+        }
+    }
+
+    if (planes.size() == 1) {
+        auto rows = frame_info_.ver_stride != 0 ? frame_info_.ver_stride : frame_info_.height;
+        auto size = av_image_fill_pointers(frame->data, src_format_, rows,
+            (uint8_t*)planes[0].start, frame->linesize);
+        if (size < 0 || (uint32_t)size > planes[0].size) {
+            spdlog::error("Frame too small, {} < {}", planes[0].size, size);
+            return false;
+        }
+        return true;
+    }
+
+    // multi planar capture, planes in separate buffers
+    for (size_t i = 0; i < planes.size() && i < AV_NUM_DATA_POINTERS; i++) {
+        frame->data[i] = (uint8_t*)planes[i].start;
+    }
+    return true;
+}
+
+bool AvEncoder::Convert(void)
+{
+    // libavcodec may still hold the previous picture
+    auto ret = av_frame_make_writable(dst_frame_);
+    if (ret < 0) {
+        spdlog::error("Make frame writable error {}", AvError(ret));
+        return false;
+    }
+    sws_scale(sws_, src_frame_->data, src_frame_->linesize, 0, frame_info_.height,
+        dst_frame_->data, dst_frame_->linesize);
+    return true;
+}
+
+void AvEncoder::ReleaseFrameRef(void* opaque, uint8_t* data)
+{
+    delete (FrameRef*)opaque;
+}
+
+bool AvEncoder::PutFrame(uint8_t* data, uint32_t size, int dma_fd)
+{
+    FrameMeta meta;
+    meta.sequence = sequence_++;
+    meta.timestamp_us = MonotonicUs();
+    if (!is_running_ || !FillPlanes(src_frame_, { PlaneData { data, size } })) {
+        return false;
+    }
+    if (sws_ != nullptr) {
+        return Convert() && Encode(dst_frame_, meta);
+    }
+    // not reference counted, libavcodec copies it
+    return Encode(src_frame_, meta);
+}
+
+bool AvEncoder::PutFrame(FrameRef frame)
+{
+    if (!is_running_ || !FillPlanes(src_frame_, frame->planes)) {
+        return false;
+    }
+    auto meta = frame->meta;
+    if (sws_ != nullptr) {
+        // the capture buffer goes back as soon as it is converted
+        return Convert() && Encode(dst_frame_, meta);
+    }
+
+    // libavcodec references the capture buffer instead of copying it
+    auto& plane = frame->planes[0];
+    auto ref = new FrameRef(std::move(frame));
+    src_frame_->buf[0] = av_buffer_create((uint8_t*)plane.start, plane.size,
+        AvEncoder::ReleaseFrameRef, ref, AV_BUFFER_FLAG_READONLY);
+    if (src_frame_->buf[0] == nullptr) {
+        spdlog::error("Create frame buffer error");
+        delete ref;
+        return false;
+    }
+    auto ret = Encode(src_frame_, meta);
+    av_frame_unref(src_frame_);
+    return ret;
+}
+
+bool AvEncoder::Encode(AVFrame* frame, const FrameMeta& meta)
+{
+    auto pts = (int64_t)meta.timestamp_us;
+    if (pts <= last_pts_) {
+        pts = last_pts_ + 1;
+    }
+    last_pts_ = pts;
+    frame->pts = pts;
+    frame->pict_type = TakeIdrRequest() ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    // the qscale encoders take the quantizer of the picture
+    frame->quality = ctx_->global_quality;
+
+    auto start_us = MonotonicUs();
+    in_flight_.push_back({ meta, pts, start_us });
+    auto ret = avcodec_send_frame(ctx_, frame);
+    if (metrics_ != nullptr) {
+        auto send_end_us = MonotonicUs();
+        metrics_->encode_submit.Observe(send_end_us - start_us);
+        FrameTracer::Record(TraceSpan::PutFrame, metrics_->trace_stream, meta.sequence, start_us, send_end_us);
+    }
+    if (ret < 0) {
+        in_flight_.pop_back();
+        spdlog::error("Encode frame error {}", AvError(ret));
+        return false;
+    }
+    return ReceivePackets();
+}
+
+bool AvEncoder::ReceivePackets(void)
+{
+    while (true) {
+        auto ret = avcodec_receive_packet(ctx_, packet_);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return true;
+        }
+        if (ret < 0) {
+            spdlog::error("Get Package error, {}", AvError(ret));
+            return false;
+        }
+
+        FrameMeta meta;
+        meta.timestamp_us = packet_->pts;
+        uint64_t submit_us = 0;
+        // the packet is out, its input frame and any older one the encoder skipped are done
+        while (!in_flight_.empty() && in_flight_.front().pts <= packet_->pts) {
+            meta = in_flight_.front().meta;
+            submit_us = in_flight_.front().submit_us;
+            in_flight_.pop_front();
+        }
+        if (metrics_ != nullptr) {
+            if (submit_us != 0) {
+                auto packet_us = MonotonicUs();
+                metrics_->encode_packet.Observe(packet_us - submit_us);
+                FrameTracer::Record(TraceSpan::Encode, metrics_->trace_stream, meta.sequence, submit_us, packet_us);
+            }
+            metrics_->packets_encoded.Add();
+            metrics_->packet_bytes.Add(packet_->size);
+        }
+        package_callback_(packet_->data, packet_->size, meta);
+        av_packet_unref(packet_);
+    }
+}
+
+void AvEncoder::Stop(void)
+{
+    is_running_ = false;
+}
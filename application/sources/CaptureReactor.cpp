@@ -0,0 +1,255 @@
+#include "CaptureReactor.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ThreadPlacement.h"
+#include "VideoFrame.h"
+
+CaptureReactor::CaptureReactor(int threads)
+    : thread_count_(std::max(threads, 1))
+{
+}
+
+CaptureReactor::~CaptureReactor(void)
+{
+    Stop();
+}
+
+bool CaptureReactor::Start(void)
+{
+    if (running_) {
+        return true;
+    }
+    for (int i = 0; i < thread_count_; i++) {
+        auto loop = std::make_unique<Loop>();
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+            spdlog::error("Create capture reactor error {}", strerror(errno));
+            return false;
+        }
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = loop->wake_fd;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+        loops_.push_back(std::move(loop));
+    }
+    running_ = true;
+    for (size_t i = 0; i < loops_.size(); i++) {
+        auto& loop = *loops_[i];
+        loop.thread = std::thread(&CaptureReactor::Run, this, std::ref(loop), (int)i);
+    }
+    spdlog::info("Capture reactor {} threads", loops_.size());
+    return true;
+}
+
+void CaptureReactor::Stop(void)
+{
+    running_ = false;
+    for (auto& loop : loops_) {
+        WakeLoop(*loop);
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+        if (loop->epoll_fd >= 0) {
+            ::close(loop->epoll_fd);
+        }
+        if (loop->wake_fd >= 0) {
+            ::close(loop->wake_fd);
+        }
+    }
+    loops_.clear();
+    std::lock_guard<std::mutex> lock(owners_mutex_);
+    owners_.clear();
+}
+
+bool CaptureReactor::Add(int fd, uint32_t events, uint32_t timeout_ms, const Handler& handler)
+{
+    if (loops_.empty()) {
+        spdlog::error("Capture reactor not started");
+        return false;
+    }
+    // the least busy thread, a few devices per board
+    Loop* target = nullptr;
+    size_t fewest = SIZE_MAX;
+    for (auto& loop : loops_) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        if (loop->entries.size() < fewest) {
+            fewest = loop->entries.size();
+            target = loop.get();
+        }
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->fd = fd;
+    entry->events = events;
+    entry->timeout_ms = timeout_ms;
+    entry->handler = handler;
+    {
+        std::lock_guard<std::mutex> lock(target->mutex);
+        epoll_event event {};
+        event.events = events | EPOLLONESHOT;
+        event.data.fd = fd;
+        if (epoll_ctl(target->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            spdlog::error("Capture reactor add {} error {}", fd, strerror(errno));
+            return false;
+        }
+        entry->deadline_us = timeout_ms != 0 ? MonotonicUs() + timeout_ms * 1000ULL : 0;
+        target->entries[fd] = entry;
+    }
+    {
+        std::lock_guard<std::mutex> lock(owners_mutex_);
+        owners_[fd] = target;
+    }
+    // the deadline may be sooner than the thread waits
+    WakeLoop(*target);
+    return true;
+}
+
+CaptureReactor::Loop* CaptureReactor::Owner(int fd)
+{
+    std::lock_guard<std::mutex> lock(owners_mutex_);
+    auto it = owners_.find(fd);
+    return it == owners_.end() ? nullptr : it->second;
+}
+
+void CaptureReactor::Remove(int fd)
+{
+    auto loop = Owner(fd);
+    if (loop == nullptr) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        loop->entries.erase(fd);
+        if (std::this_thread::get_id() != loop->thread_id) {
+            loop->idle_cv.wait(lock, [&]() { return loop->running_fd != fd; });
+        }
+    }
+    std::lock_guard<std::mutex> lock(owners_mutex_);
+    owners_.erase(fd);
+}
+
+void CaptureReactor::WakeLoop(Loop& loop)
+{
+    uint64_t one = 1;
+    if (loop.wake_fd >= 0 && ::write(loop.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        spdlog::warn("Capture reactor wake error {}", strerror(errno));
+    }
+}
+
+bool CaptureReactor::Arm(Loop& loop, Entry& entry, uint64_t now_us)
+{
+    epoll_event event {};
+    event.events = entry.events | EPOLLONESHOT;
+    event.data.fd = entry.fd;
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, entry.fd, &event) < 0) {
+        spdlog::error("Capture reactor arm {} error {}", entry.fd, strerror(errno));
+        return false;
+    }
+    entry.armed = true;
+    entry.rearm_us = 0;
+    entry.deadline_us = entry.timeout_ms != 0 ? now_us + entry.timeout_ms * 1000ULL : 0;
+    return true;
+}
+
+void CaptureReactor::Dispatch(Loop& loop, int fd, uint32_t events)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        auto it = loop.entries.find(fd);
+        // removed, or an event of a fd that waits out a delay (one shot, quiet until armed)
+        if (it == loop.entries.end() || (!it->second->armed && events != 0)) {
+            return;
+        }
+        entry = it->second;
+        entry->armed = false;
+        entry->deadline_us = 0;
+        loop.running_fd = fd;
+    }
+
+    auto next = entry->handler(events);
+
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    loop.running_fd = -1;
+    auto it = loop.entries.find(fd);
+    if (it != loop.entries.end() && it->second == entry) {
+        auto now_us = MonotonicUs();
+        if (next < 0 || (next == 0 && !Arm(loop, *entry, now_us))) {
+            epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            loop.entries.erase(it);
+        } else if (next > 0) {
+            entry->rearm_us = now_us + next * 1000ULL;
+        }
+    }
+    loop.idle_cv.notify_all();
+}
+
+void CaptureReactor::Run(Loop& loop, int index)
+{
+    loop.thread_id = std::this_thread::get_id();
+    ThreadPlacement::Instance().Apply(ThreadRole::Capture, "capture " + std::to_string(index));
+
+    constexpr int kMaxEvents = 16;
+    epoll_event events[kMaxEvents];
+    std::vector<std::pair<int, uint32_t>> due;
+    while (running_) {
+        // sleep until the next timeout or delayed re-arm
+        int wait_ms = -1;
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            auto now_us = MonotonicUs();
+            for (auto& [fd, entry] : loop.entries) {
+                auto at = entry->armed ? entry->deadline_us : entry->rearm_us;
+                if (at == 0) {
+                    continue;
+                }
+                int ms = at > now_us ? (int)((at - now_us + 999) / 1000) : 0;
+                wait_ms = wait_ms < 0 ? ms : std::min(wait_ms, ms);
+            }
+        }
+
+        auto count = epoll_wait(loop.epoll_fd, events, kMaxEvents, wait_ms);
+        if (count < 0 && errno != EINTR) {
+            spdlog::error("Capture reactor wait error {}", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == loop.wake_fd) {
+                uint64_t value;
+                while (::read(loop.wake_fd, &value, sizeof(value)) > 0) { }
+                continue;
+            }
+            Dispatch(loop, events[i].data.fd, events[i].events);
+        }
+
+        // timeouts go to the handler, delays that ran out are armed again
+        due.clear();
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            auto now_us = MonotonicUs();
+            for (auto& [fd, entry] : loop.entries) {
+                if (entry->armed && entry->deadline_us != 0 && entry->deadline_us <= now_us) {
+                    due.emplace_back(fd, 0);
+                } else if (!entry->armed && entry->rearm_us != 0 && entry->rearm_us <= now_us) {
+                    if (!Arm(loop, *entry, now_us)) {
+                        entry->rearm_us = 0;
+                    }
+                }
+            }
+        }
+        for (auto& [fd, unused] : due) {
+            Dispatch(loop, fd, 0);
+        }
+    }
+}
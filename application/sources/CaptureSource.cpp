@@ -0,0 +1,151 @@
+#include "CaptureSource.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+
+#include "FileCapture.h"
+#include "PatternCapture.h"
+#include "VideoCapture.h"
+
+void CaptureSource::SetPaused(bool paused)
+{
+    {
+        std::lock_guard<std::mutex> lock(pause_mutex_);
+        paused_.store(paused, std::memory_order_release);
+    }
+    pause_cv_.notify_all();
+}
+
+void CaptureSource::WaitWhilePaused(const std::atomic<bool>& is_running)
+{
+    std::unique_lock<std::mutex> lock(pause_mutex_);
+    // Stop only clears is_running, look at it now and then
+    while (paused_.load(std::memory_order_acquire) && is_running) {
+        pause_cv_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
+uint32_t CaptureFrameSize(std::string_view pixelformat, uint32_t width, uint32_t height)
+{
+    if (pixelformat.compare("BGR24") == 0) {
+        return width * height * 3;
+    } else if (pixelformat.compare("NV12") == 0 || pixelformat.compare("I420") == 0) {
+        return width * height * 3 / 2;
+    } else if (pixelformat.compare("NV16") == 0 || pixelformat.compare("YUYV") == 0) {
+        return width * height * 2;
+    }
+    spdlog::error("Unkonw frame type {}", pixelformat);
+    return 0;
+}
+
+uint32_t CaptureLineSize(std::string_view pixelformat, uint32_t width)
+{
+    if (pixelformat.compare("BGR24") == 0) {
+        return width * 3;
+    } else if (pixelformat.compare("YUYV") == 0) {
+        return width * 2;
+    } else if (pixelformat.compare("NV12") == 0 || pixelformat.compare("I420") == 0
+        || pixelformat.compare("NV16") == 0) {
+        return width;
+    }
+    spdlog::error("Unkonw frame type {}", pixelformat);
+    return 0;
+}
+
+const std::vector<std::string>& CaptureFormats(void)
+{
+    static const std::vector<std::string> formats = { "NV12", "I420", "NV16", "YUYV", "BGR24" };
+    return formats;
+}
+
+std::shared_ptr<CaptureSource> CreateCaptureSource(const CaptureSourceInfo& info)
+{
+    switch (info.type) {
+    case CaptureSourceType::V4l2:
+        return std::make_shared<VideoCapture>(info);
+    case CaptureSourceType::File:
+        return std::make_shared<FileCapture>(info);
+    case CaptureSourceType::Pattern:
+        return std::make_shared<PatternCapture>(info);
+    }
+    return nullptr;
+}
+
+static inline bool ParseNumber(std::string_view str, uint32_t& value)
+{
+    auto ret = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ret.ec == std::errc() && ret.ptr == str.data() + str.size();
+}
+
+bool ParseCaptureSource(std::string_view uri, CaptureSourceInfo& info)
+{
+    std::string_view query;
+    auto query_pos = uri.find('?');
+    if (query_pos != std::string_view::npos) {
+        query = uri.substr(query_pos + 1);
+        uri = uri.substr(0, query_pos);
+    }
+
+    constexpr std::string_view file_scheme = "file:";
+    constexpr std::string_view pattern_scheme = "pattern:";
+    if (uri.compare(0, file_scheme.size(), file_scheme) == 0) {
+        info.type = CaptureSourceType::File;
+        info.path = uri.substr(file_scheme.size());
+    } else if (uri.compare(0, pattern_scheme.size(), pattern_scheme) == 0) {
+        info.type = CaptureSourceType::Pattern;
+        auto size = uri.substr(pattern_scheme.size());
+        auto x_pos = size.find('x');
+        if (x_pos == std::string_view::npos
+            || !ParseNumber(size.substr(0, x_pos), info.width)
+            || !ParseNumber(size.substr(x_pos + 1), info.height)) {
+            spdlog::error("Pattern size error {}", size);
+            return false;
+        }
+    } else {
+        info.type = CaptureSourceType::V4l2;
+        info.path = uri;
+    }
+
+    while (!query.empty()) {
+        auto item = query.substr(0, query.find('&'));
+        query.remove_prefix(std::min(query.size(), item.size() + 1));
+
+        auto eq_pos = item.find('=');
+        if (eq_pos == std::string_view::npos) {
+            spdlog::error("Capture option error {}", item);
+            return false;
+        }
+        auto key = item.substr(0, eq_pos);
+        auto value = item.substr(eq_pos + 1);
+        uint32_t number = 0;
+        bool ok = true;
+        if (key == "fmt") {
+            info.pixelformat = value;
+        } else if (key == "w") {
+            ok = ParseNumber(value, info.width);
+        } else if (key == "h") {
+            ok = ParseNumber(value, info.height);
+        } else if (key == "fps") {
+            ok = ParseNumber(value, info.fps);
+        } else if (key == "loop") {
+            ok = ParseNumber(value, number);
+            info.loop = number != 0;
+        } else if (key == "bufs") {
+            ok = ParseNumber(value, number);
+            info.buf_count = number;
+        } else if (key == "timeout") {
+            ok = ParseNumber(value, info.timeout);
+        } else {
+            spdlog::error("Unkonw capture option {}", key);
+            return false;
+        }
+        if (!ok) {
+            spdlog::error("Capture option value error {}", item);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,305 @@
+#include "ColorConvert.h"
+
+#include <array>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+inline uint8_t LumaOf(int b, int g, int r)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+inline uint8_t ChromaUOf(int b, int g, int r)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+inline uint8_t ChromaVOf(int b, int g, int r)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// columns [x_begin, width) of the row pair starting at row, SIMD kernels finish their tail here
+void RowPairScalar(const BgrToNv12Job& job, uint32_t row, uint32_t x_begin)
+{
+    const uint8_t* src0 = job.bgr + (size_t)row * job.bgr_stride;
+    const uint8_t* src1 = src0 + job.bgr_stride;
+    uint8_t* y0 = job.y + (size_t)row * job.stride;
+    uint8_t* y1 = y0 + job.stride;
+    uint8_t* uv = job.uv + (size_t)row / 2 * job.stride;
+
+    for (uint32_t x = x_begin; x + 1 < job.width; x += 2) {
+        const uint8_t* p00 = src0 + x * 3;
+        const uint8_t* p01 = p00 + 3;
+        const uint8_t* p10 = src1 + x * 3;
+        const uint8_t* p11 = p10 + 3;
+        y0[x] = LumaOf(p00[0], p00[1], p00[2]);
+        y0[x + 1] = LumaOf(p01[0], p01[1], p01[2]);
+        y1[x] = LumaOf(p10[0], p10[1], p10[2]);
+        y1[x + 1] = LumaOf(p11[0], p11[1], p11[2]);
+
+        int b = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+        int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        int r = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+        uv[x] = ChromaUOf(b, g, r);
+        uv[x + 1] = ChromaVOf(b, g, r);
+    }
+}
+
+} // namespace
+
+void BgrToNv12Scalar(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end)
+{
+    for (uint32_t row = row_begin; row < row_end; row += 2) {
+        RowPairScalar(job, row, 0);
+    }
+}
+
+#if defined(__x86_64__)
+
+namespace {
+
+// pshufb masks gathering channel k of 16 BGR pixels out of the 16 byte chunk c
+constexpr std::array<int8_t, 16> ChannelMask(int k, int c)
+{
+    std::array<int8_t, 16> mask {};
+    for (int i = 0; i < 16; i++) {
+        int byte = 3 * i + k - 16 * c;
+        mask[i] = byte >= 0 && byte < 16 ? byte : -128;
+    }
+    return mask;
+}
+
+constexpr std::array<int8_t, 16> kMasks[3][3] = {
+    { ChannelMask(0, 0), ChannelMask(0, 1), ChannelMask(0, 2) },
+    { ChannelMask(1, 0), ChannelMask(1, 1), ChannelMask(1, 2) },
+    { ChannelMask(2, 0), ChannelMask(2, 1), ChannelMask(2, 2) },
+};
+
+struct Bgr16 {
+    __m256i b;
+    __m256i g;
+    __m256i r;
+};
+
+// 16 pixels, each channel widened to 16 bit
+__attribute__((target("avx2"))) inline Bgr16 LoadBgr16(const uint8_t* src)
+{
+    __m128i chunk[3] = {
+        _mm_loadu_si128((const __m128i*)src),
+        _mm_loadu_si128((const __m128i*)(src + 16)),
+        _mm_loadu_si128((const __m128i*)(src + 32)),
+    };
+    __m256i channel[3];
+    for (int k = 0; k < 3; k++) {
+        __m128i value = _mm_setzero_si128();
+        for (int c = 0; c < 3; c++) {
+            auto mask = _mm_loadu_si128((const __m128i*)kMasks[k][c].data());
+            value = _mm_or_si128(value, _mm_shuffle_epi8(chunk[c], mask));
+        }
+        channel[k] = _mm256_cvtepu8_epi16(value);
+    }
+    return { channel[0], channel[1], channel[2] };
+}
+
+__attribute__((target("avx2"))) inline void StoreLuma16(uint8_t* dst, const Bgr16& px)
+{
+    __m256i y = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(px.r, _mm256_set1_epi16(66)),
+            _mm256_mullo_epi16(px.g, _mm256_set1_epi16(129))),
+        _mm256_add_epi16(_mm256_mullo_epi16(px.b, _mm256_set1_epi16(25)), _mm256_set1_epi16(128)));
+    // at most 56228, fits unsigned 16 bit
+    y = _mm256_add_epi16(_mm256_srli_epi16(y, 8), _mm256_set1_epi16(16));
+    // packus works per 128 bit lane, put the two halves back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(y, y), 0xD8);
+    _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+}
+
+// rounded mean of the 2x2 blocks of 16 pixels on two rows, 8 values
+__attribute__((target("avx2"))) inline __m128i BlockMean(__m256i top, __m256i bottom)
+{
+    __m256i sum = _mm256_add_epi16(top, bottom);
+    sum = _mm256_permute4x64_epi64(_mm256_hadd_epi16(sum, sum), 0xD8);
+    return _mm_srli_epi16(_mm_add_epi16(_mm256_castsi256_si128(sum), _mm_set1_epi16(2)), 2);
+}
+
+__attribute__((target("avx2"))) inline __m128i Chroma8(__m128i b, __m128i g, __m128i r,
+    int16_t cr, int16_t cg, int16_t cb)
+{
+    __m128i c = _mm_add_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg))),
+        _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+
+} // namespace
+
+__attribute__((target("avx2"))) void BgrToNv12Avx2(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end)
+{
+    for (uint32_t row = row_begin; row < row_end; row += 2) {
+        const uint8_t* src0 = job.bgr + (size_t)row * job.bgr_stride;
+        const uint8_t* src1 = src0 + job.bgr_stride;
+        uint8_t* y0 = job.y + (size_t)row * job.stride;
+        uint8_t* y1 = y0 + job.stride;
+        uint8_t* uv = job.uv + (size_t)row / 2 * job.stride;
+
+        uint32_t x = 0;
+        for (; x + 16 <= job.width; x += 16) {
+            auto top = LoadBgr16(src0 + x * 3);
+            auto bottom = LoadBgr16(src1 + x * 3);
+            StoreLuma16(y0 + x, top);
+            StoreLuma16(y1 + x, bottom);
+
+            auto b = BlockMean(top.b, bottom.b);
+            auto g = BlockMean(top.g, bottom.g);
+            auto r = BlockMean(top.r, bottom.r);
+            auto u = Chroma8(b, g, r, -38, -74, 112);
+            auto v = Chroma8(b, g, r, 112, -94, -18);
+            // u in the low byte, v in the high byte of each 16 bit lane
+            _mm_storeu_si128((__m128i*)(uv + x), _mm_or_si128(u, _mm_slli_epi16(v, 8)));
+        }
+        RowPairScalar(job, row, x);
+    }
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+namespace {
+
+inline uint8x8_t Luma8(uint8x8_t b, uint8x8_t g, uint8x8_t r)
+{
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+    y = vmlal_u8(y, g, vdup_n_u8(129));
+    y = vmlal_u8(y, b, vdup_n_u8(25));
+    // (y + 128) >> 8
+    return vadd_u8(vrshrn_n_u16(y, 8), vdup_n_u8(16));
+}
+
+inline uint8x16_t Luma16(const uint8x16x3_t& px)
+{
+    return vcombine_u8(
+        Luma8(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]), vget_low_u8(px.val[2])),
+        Luma8(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]), vget_high_u8(px.val[2])));
+}
+
+// rounded mean of the 2x2 blocks, (sum + 2) >> 2
+inline int16x8_t BlockMean(uint8x16_t top, uint8x16_t bottom)
+{
+    return vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(top), vpaddlq_u8(bottom)), 2));
+}
+
+inline uint8x8_t Chroma8(int16x8_t b, int16x8_t g, int16x8_t r, int16_t cr, int16_t cg, int16_t cb)
+{
+    int16x8_t c = vmulq_n_s16(r, cr);
+    c = vmlaq_n_s16(c, g, cg);
+    c = vmlaq_n_s16(c, b, cb);
+    // (c + 128) >> 8 arithmetic, then + 128
+    c = vaddq_s16(vrshrq_n_s16(c, 8), vdupq_n_s16(128));
+    return vmovn_u16(vreinterpretq_u16_s16(c));
+}
+
+} // namespace
+
+void BgrToNv12Neon(const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end)
+{
+    for (uint32_t row = row_begin; row < row_end; row += 2) {
+        const uint8_t* src0 = job.bgr + (size_t)row * job.bgr_stride;
+        const uint8_t* src1 = src0 + job.bgr_stride;
+        uint8_t* y0 = job.y + (size_t)row * job.stride;
+        uint8_t* y1 = y0 + job.stride;
+        uint8_t* uv = job.uv + (size_t)row / 2 * job.stride;
+
+        uint32_t x = 0;
+        for (; x + 16 <= job.width; x += 16) {
+            auto top = vld3q_u8(src0 + x * 3);
+            auto bottom = vld3q_u8(src1 + x * 3);
+            vst1q_u8(y0 + x, Luma16(top));
+            vst1q_u8(y1 + x, Luma16(bottom));
+
+            auto b = BlockMean(top.val[0], bottom.val[0]);
+            auto g = BlockMean(top.val[1], bottom.val[1]);
+            auto r = BlockMean(top.val[2], bottom.val[2]);
+            uint8x8x2_t chroma = { {
+                Chroma8(b, g, r, -38, -74, 112),
+                Chroma8(b, g, r, 112, -94, -18),
+            } };
+            vst2_u8(uv + x, chroma);
+        }
+        RowPairScalar(job, row, x);
+    }
+}
+
+#endif
+
+bool ConvertKernelSupported(ConvertKernel kernel)
+{
+    switch (kernel) {
+    case ConvertKernel::Scalar:
+        return true;
+    case ConvertKernel::Avx2:
+#if defined(__x86_64__)
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    case ConvertKernel::Neon:
+#if defined(__aarch64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+ConvertKernel BestConvertKernel(void)
+{
+    if (ConvertKernelSupported(ConvertKernel::Neon)) {
+        return ConvertKernel::Neon;
+    }
+    if (ConvertKernelSupported(ConvertKernel::Avx2)) {
+        return ConvertKernel::Avx2;
+    }
+    return ConvertKernel::Scalar;
+}
+
+std::string_view ConvertKernelName(ConvertKernel kernel)
+{
+    switch (kernel) {
+    case ConvertKernel::Scalar:
+        return "scalar";
+    case ConvertKernel::Avx2:
+        return "avx2";
+    case ConvertKernel::Neon:
+        return "neon";
+    }
+    return "unknown";
+}
+
+void BgrToNv12(ConvertKernel kernel, const BgrToNv12Job& job, uint32_t row_begin, uint32_t row_end)
+{
+    switch (kernel) {
+#if defined(__x86_64__)
+    case ConvertKernel::Avx2:
+        BgrToNv12Avx2(job, row_begin, row_end);
+        return;
+#endif
+#if defined(__aarch64__)
+    case ConvertKernel::Neon:
+        BgrToNv12Neon(job, row_begin, row_end);
+        return;
+#endif
+    default:
+        BgrToNv12Scalar(job, row_begin, row_end);
+        return;
+    }
+}
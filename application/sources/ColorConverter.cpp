@@ -0,0 +1,63 @@
+#include "ColorConverter.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+ColorConverter::ColorConverter(uint32_t width, uint32_t height, uint32_t src_stride,
+    int buf_count, int threads, ConvertKernel kernel)
+    : width_(width)
+    , height_(height)
+    , src_stride_(src_stride != 0 ? src_stride : width * 3)
+    , stride_((width + FramePool::kAlign - 1) / FramePool::kAlign * FramePool::kAlign)
+    , buf_count_(std::max(buf_count, 1))
+    , kernel_(ConvertKernelSupported(kernel) ? kernel : ConvertKernel::Scalar)
+    , pool_("Convert")
+    , workers_(threads)
+{
+}
+
+ColorConverter::~ColorConverter(void) = default;
+
+bool ColorConverter::Init(void)
+{
+    if (width_ == 0 || height_ == 0 || width_ % 2 != 0 || height_ % 2 != 0) {
+        spdlog::error("Convert size error {}x{}", width_, height_);
+        return false;
+    }
+    if (!pool_.Init(buf_count_, FrameSize())) {
+        return false;
+    }
+    workers_.Start(height_ / 2, "convert", [this](int band) { RunBand(band); });
+
+    spdlog::info("Convert BGR24 -> NV12 {}x{} stride {}, {} kernel, {} threads",
+        width_, height_, stride_, ConvertKernelName(kernel_), workers_.Bands());
+    return true;
+}
+
+void ColorConverter::RunBand(int band)
+{
+    BgrToNv12(kernel_, job_, workers_.BandBegin(band, height_), workers_.BandBegin(band + 1, height_));
+}
+
+FrameRef ColorConverter::Convert(const FrameRef& frame)
+{
+    auto& src = frame->planes[0];
+    if (src.size < src_stride_ * (height_ - 1) + width_ * 3) {
+        spdlog::error("Convert source too small {}", src.size);
+        return FrameRef();
+    }
+
+    auto slot = pool_.Acquire();
+    if (slot == nullptr) {
+        spdlog::debug("Convert pool empty, drop frame {}", frame->meta.sequence);
+        return FrameRef();
+    }
+
+    auto dst = (uint8_t*)slot->planes[0].start;
+    job_ = { (const uint8_t*)src.start, src_stride_, dst, dst + (size_t)stride_ * height_, stride_, width_ };
+    workers_.Run();
+
+    slot->meta = frame->meta;
+    return FrameRef::Adopt(slot);
+}
@@ -0,0 +1,343 @@
+#include "Config.h"
+
+#include <spdlog/spdlog.h>
+
+#include <charconv>
+#include <fstream>
+#include <set>
+#include <string_view>
+
+PipelineConfig::PipelineConfig(void)
+{
+    source.path = "/dev/video0";
+    source.buf_count = 5;
+    source.timeout = 2;
+    // sized from the buffer count by the pipeline
+    queue.capacity = 0;
+    queue.max_in_flight = 0;
+}
+
+std::vector<OutputConfig> PipelineConfig::Outputs(void) const
+{
+    std::vector<OutputConfig> all;
+    all.push_back({ stream_id, encoder, stream, record, timeshift, ScaleInfo() });
+    all.insert(all.end(), outputs.begin(), outputs.end());
+    return all;
+}
+
+namespace {
+
+std::string_view Trim(std::string_view str)
+{
+    auto begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    auto end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+template <typename T>
+bool ParseNumber(std::string_view str, T& value)
+{
+    T number = 0;
+    auto result = std::from_chars(str.data(), str.data() + str.size(), number);
+    if (result.ec != std::errc() || result.ptr != str.data() + str.size()) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+bool ParseBool(std::string_view str, bool& value)
+{
+    if (str == "1" || str == "true" || str == "yes") {
+        value = true;
+    } else if (str == "0" || str == "false" || str == "no") {
+        value = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool SetServerKey(ServerConfig& config, std::string_view key, std::string_view value)
+{
+    auto& server = config.server;
+    if (key == "http_port") {
+        return ParseNumber(value, server.http_port);
+    } else if (key == "rtsp_port") {
+        return ParseNumber(value, server.rtsp_port);
+    } else if (key == "rtmp_port") {
+        return ParseNumber(value, server.rtmp_port);
+    } else if (key == "poller_threads") {
+        return ParseNumber(value, server.poller_threads);
+    } else if (key == "capture_threads") {
+        return ParseNumber(value, config.capture_threads);
+    } else if (key == "trace") {
+        return ParseBool(value, config.trace.enabled);
+    } else if (key == "trace_events") {
+        // 32 bytes a span, a million per thread is plenty
+        return ParseNumber(value, config.trace.events) && config.trace.events > 0 && config.trace.events <= (1 << 20);
+    } else if (key == "trace_path") {
+        config.trace.path = value;
+        return true;
+    }
+    spdlog::error("Unknown server key {}", key);
+    return false;
+}
+
+// <role>_cpus, <role>_priority or <role>_nice
+bool SetThreadKey(PlacementInfo& placement, std::string_view key, std::string_view value)
+{
+    auto underscore = key.rfind('_');
+    ThreadRole role;
+    if (underscore == std::string_view::npos || !ParseThreadRole(key.substr(0, underscore), role)) {
+        spdlog::error("Unknown threads key {}", key);
+        return false;
+    }
+    auto field = key.substr(underscore + 1);
+    if (field == "cpus") {
+        placement[role].cpus = value;
+        return true;
+    } else if (field == "priority") {
+        return ParseNumber(value, placement[role].priority);
+    } else if (field == "nice") {
+        return ParseNumber(value, placement[role].nice);
+    }
+    spdlog::error("Unknown threads key {}", key);
+    return false;
+}
+
+// keys of pipelines and outputs, known is false for any other key
+bool SetEncodingKey(VideoEncoderType& encoder, StreamInfo& stream, RecordInfo& record, TimeshiftInfo& timeshift,
+    std::string_view key, std::string_view value, bool& known)
+{
+    known = true;
+    if (key == "encoder") {
+        return ParseVideoEncoderType(value, encoder);
+    } else if (key == "codec") {
+        if (value != "H264" && value != "H265") {
+            spdlog::error("Unknown codec {}", value);
+            return false;
+        }
+        stream.StreamType = value;
+        return true;
+    } else if (key == "gop") {
+        return ParseNumber(value, stream.gop);
+    } else if (key == "bitrate") {
+        return ParseNumber(value, stream.bitrate);
+    } else if (key == "record_path") {
+        record.path = value;
+        return true;
+    } else if (key == "record_segment_ms") {
+        return ParseNumber(value, record.segment_ms) && record.segment_ms != 0;
+    } else if (key == "record_buffer_bytes") {
+        return ParseNumber(value, record.max_buffer_bytes);
+    } else if (key == "record_write_bytes") {
+        return ParseNumber(value, record.write_bytes);
+    } else if (key == "timeshift_bytes") {
+        return ParseNumber(value, timeshift.max_bytes);
+    } else if (key == "timeshift_seconds") {
+        return ParseNumber(value, timeshift.max_seconds) && timeshift.max_seconds != 0;
+    }
+    known = false;
+    return false;
+}
+
+bool SetPipelineKey(PipelineConfig& pipeline, std::string_view key, std::string_view value)
+{
+    if (key == "source") {
+        // the uri sets the source type and its query, keep the pipeline wide buffer settings
+        auto buf_count = pipeline.source.buf_count;
+        auto timeout = pipeline.source.timeout;
+        pipeline.source = CaptureSourceInfo();
+        pipeline.source.buf_count = buf_count;
+        pipeline.source.timeout = timeout;
+        return ParseCaptureSource(value, pipeline.source);
+    } else if (key == "format") {
+        pipeline.source.pixelformat = value;
+        return true;
+    } else if (key == "width") {
+        return ParseNumber(value, pipeline.source.width);
+    } else if (key == "height") {
+        return ParseNumber(value, pipeline.source.height);
+    } else if (key == "buffers") {
+        return ParseNumber(value, pipeline.source.buf_count);
+    } else if (key == "fps") {
+        return ParseNumber(value, pipeline.fps) && pipeline.fps != 0;
+    } else if (key == "app") {
+        pipeline.app = value;
+        return !value.empty();
+    } else if (key == "stream_id") {
+        pipeline.stream_id = value;
+        return !value.empty();
+    } else if (key == "drop") {
+        return ParseDropPolicy(value, pipeline.queue.policy);
+    } else if (key == "queue") {
+        return ParseNumber(value, pipeline.queue.capacity);
+    } else if (key == "max_in_flight") {
+        return ParseNumber(value, pipeline.queue.max_in_flight);
+    } else if (key == "idle_linger_ms") {
+        return ParseNumber(value, pipeline.demand.idle_linger_ms);
+    } else if (key == "keepalive_fps") {
+        return ParseNumber(value, pipeline.demand.keepalive_fps);
+    } else if (key == "start_idle") {
+        return ParseBool(value, pipeline.demand.start_idle);
+    } else if (key == "idr_interval_ms") {
+        return ParseNumber(value, pipeline.idr_interval_ms);
+    } else if (key == "retry_ms") {
+        return ParseNumber(value, pipeline.retry_ms);
+    } else if (key == "snapshot_width") {
+        return ParseNumber(value, pipeline.snapshot.width);
+    } else if (key == "snapshot_max_age_ms") {
+        return ParseNumber(value, pipeline.snapshot.max_age_ms);
+    } else if (key == "snapshot_timeout_ms") {
+        return ParseNumber(value, pipeline.snapshot.timeout_ms) && pipeline.snapshot.timeout_ms != 0;
+    }
+    bool known = false;
+    auto ok = SetEncodingKey(pipeline.encoder, pipeline.stream, pipeline.record, pipeline.timeshift, key, value, known);
+    if (!known) {
+        spdlog::error("Unknown pipeline key {}", key);
+    }
+    return ok;
+}
+
+// 1/2, 1/4 or <width>x<height>, both even
+bool ParseScale(std::string_view value, ScaleInfo& scale)
+{
+    scale = ScaleInfo();
+    if (value == "1/2" || value == "1/4") {
+        scale.divisor = value.back() - '0';
+        return true;
+    }
+    auto x = value.find('x');
+    if (x == std::string_view::npos || !ParseNumber(value.substr(0, x), scale.width)
+        || !ParseNumber(value.substr(x + 1), scale.height)) {
+        return false;
+    }
+    return scale.width != 0 && scale.height != 0 && scale.width % 2 == 0 && scale.height % 2 == 0;
+}
+
+bool SetOutputKey(OutputConfig& output, std::string_view key, std::string_view value)
+{
+    if (key == "scale") {
+        // the filter is kept whatever order the keys come in
+        auto filter = output.scale.filter;
+        bool ok = ParseScale(value, output.scale);
+        output.scale.filter = filter;
+        return ok;
+    } else if (key == "scale_filter") {
+        return ParseScaleFilter(value, output.scale.filter);
+    }
+    bool known = false;
+    auto ok = SetEncodingKey(output.encoder, output.stream, output.record, output.timeshift, key, value, known);
+    if (!known) {
+        spdlog::error("Unknown output key {}", key);
+    }
+    return ok;
+}
+
+} // namespace
+
+bool LoadConfig(const std::string& path, ServerConfig& config)
+{
+    std::ifstream file(path);
+    if (!file) {
+        spdlog::error("Can not open config {}", path);
+        return false;
+    }
+
+    config.pipelines.clear();
+    // no section yet, server, threads, the last pipeline or its last output
+    enum class Section {
+        None,
+        Server,
+        Threads,
+        Pipeline,
+        Output,
+    } section = Section::None;
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        auto text = Trim(std::string_view(line).substr(0, line.find_first_of(";#")));
+        if (text.empty()) {
+            continue;
+        }
+
+        if (text.front() == '[' && text.back() == ']') {
+            auto name = Trim(text.substr(1, text.size() - 2));
+            if (name == "server") {
+                section = Section::Server;
+            } else if (name == "threads") {
+                section = Section::Threads;
+            } else if (name.substr(0, 9) == "pipeline ") {
+                section = Section::Pipeline;
+                config.pipelines.emplace_back();
+                config.pipelines.back().name = Trim(name.substr(9));
+                config.pipelines.back().stream_id = config.pipelines.back().name;
+            } else if (name.substr(0, 7) == "output ") {
+                if (config.pipelines.empty()) {
+                    spdlog::error("{}:{} {} outside of a pipeline", path, number, name);
+                    return false;
+                }
+                // the pipeline's encoding so far, nothing recorded or kept for timeshift
+                auto& pipeline = config.pipelines.back();
+                section = Section::Output;
+                OutputConfig output;
+                output.stream_id = Trim(name.substr(7));
+                output.encoder = pipeline.encoder;
+                output.stream = pipeline.stream;
+                if (output.stream_id.empty()) {
+                    spdlog::error("{}:{} output without a stream id", path, number);
+                    return false;
+                }
+                pipeline.outputs.push_back(output);
+            } else {
+                spdlog::error("{}:{} unknown section {}", path, number, name);
+                return false;
+            }
+            continue;
+        }
+
+        auto equal = text.find('=');
+        if (equal == std::string_view::npos) {
+            spdlog::error("{}:{} expected key = value", path, number);
+            return false;
+        }
+        auto key = Trim(text.substr(0, equal));
+        auto value = Trim(text.substr(equal + 1));
+        bool ok = false;
+        if (section == Section::Server) {
+            ok = SetServerKey(config, key, value);
+        } else if (section == Section::Threads) {
+            ok = SetThreadKey(config.threads, key, value);
+        } else if (section == Section::Pipeline) {
+            ok = SetPipelineKey(config.pipelines.back(), key, value);
+        } else if (section == Section::Output) {
+            ok = SetOutputKey(config.pipelines.back().outputs.back(), key, value);
+        } else {
+            spdlog::error("{}:{} {} outside of a section", path, number, key);
+        }
+        if (!ok) {
+            spdlog::error("{}:{} bad value for {}: {}", path, number, key, value);
+            return false;
+        }
+    }
+
+    if (config.pipelines.empty()) {
+        spdlog::error("{} has no pipeline", path);
+        return false;
+    }
+    // two pipelines can not feed one stream
+    std::set<std::string> streams;
+    for (auto& pipeline : config.pipelines) {
+        for (auto& output : pipeline.Outputs()) {
+            if (!streams.insert(pipeline.app + "/" + output.stream_id).second) {
+                spdlog::error("{} stream {}/{} used twice", path, pipeline.app, output.stream_id);
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#include "DemandGate.h"
+
+#include <spdlog/spdlog.h>
+
+DemandGate::DemandGate(const DemandInfo& info)
+    : info_(info)
+    , active_(!info.start_idle)
+{
+    // not watched yet, the linger runs from the start
+    idle_since_us_ = MonotonicUs();
+}
+
+void DemandGate::ReaderJoined(void)
+{
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        readers_++;
+        idle_since_us_ = 0;
+        changed = SetActive(true);
+        if (metrics_ != nullptr) {
+            metrics_->readers.Set(readers_);
+        }
+    }
+    if (changed) {
+        spdlog::info("Reader joined, encoding resumed");
+        Notify();
+    }
+}
+
+void DemandGate::ReadersGone(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    readers_ = 0;
+    if (idle_since_us_ == 0) {
+        idle_since_us_ = MonotonicUs();
+    }
+    if (metrics_ != nullptr) {
+        metrics_->readers.Set(0);
+    }
+    spdlog::info("No reader left, idle in {}ms", info_.idle_linger_ms);
+}
+
+int DemandGate::Readers(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return readers_;
+}
+
+bool DemandGate::Active(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_;
+}
+
+bool DemandGate::Admit(uint64_t now_us, bool& idr)
+{
+    idr = false;
+    bool changed = false;
+    bool admit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (active_ && readers_ == 0 && idle_since_us_ != 0
+            && now_us - idle_since_us_ >= info_.idle_linger_ms * 1000ULL) {
+            changed = SetActive(false);
+        }
+
+        if (active_) {
+            admit = true;
+        } else if (info_.keepalive_fps != 0 && now_us - last_keepalive_us_ >= 1000000 / info_.keepalive_fps) {
+            last_keepalive_us_ = now_us;
+            admit = true;
+        } else {
+            admit = false;
+        }
+
+        if (admit && active_ && need_idr_) {
+            need_idr_ = false;
+            idr = true;
+        }
+    }
+
+    if (changed) {
+        spdlog::info("Nobody watching for {}ms, encoding {}", info_.idle_linger_ms,
+            info_.keepalive_fps == 0 ? "paused" : fmt::format("at {} fps", info_.keepalive_fps));
+        Notify();
+    }
+    if (!admit && metrics_ != nullptr) {
+        metrics_->idle_dropped.Add();
+    }
+    return admit;
+}
+
+void DemandGate::SetStateCallback(const std::function<void(bool active)>& callback)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_callback_ = callback;
+}
+
+void DemandGate::SetMetrics(PipelineMetrics* metrics)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    metrics_ = metrics;
+    if (metrics_ != nullptr) {
+        metrics_->readers.Set(readers_);
+        metrics_->demand_active.Set(active_ ? 1 : 0);
+    }
+}
+
+bool DemandGate::SetActive(bool active)
+{
+    if (active_ == active) {
+        return false;
+    }
+    active_ = active;
+    // keep alive frames leave the gop somewhere in the middle
+    need_idr_ = active;
+    if (metrics_ != nullptr) {
+        metrics_->demand_active.Set(active ? 1 : 0);
+    }
+    return true;
+}
+
+void DemandGate::Notify(void)
+{
+    // a join and the idle timeout can race, whoever comes last passes the current state
+    std::lock_guard<std::mutex> notify_lock(notify_mutex_);
+    std::function<void(bool)> callback;
+    bool active;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callback = state_callback_;
+        active = active_;
+    }
+    if (callback) {
+        callback(active);
+    }
+}
@@ -0,0 +1,140 @@
+#include "EncodedPacket.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// cache line aligned, consumers may run SIMD scans over the data
+static constexpr uint32_t kAlign = 64;
+
+void PacketRef::Reset(void)
+{
+    auto packet = std::exchange(packet_, nullptr);
+    if (packet != nullptr && packet->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        packet->pool->Release(packet);
+    }
+}
+
+PacketPool::PacketPool(const PacketPoolInfo& info)
+    : info_(info)
+{
+    for (uint32_t capacity = std::max(info_.min_bytes, kAlign); capacity <= info_.max_bytes; capacity *= 2) {
+        classes_.push_back(capacity);
+    }
+    free_.resize(classes_.size());
+}
+
+PacketPool::~PacketPool(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (outstanding_ != 0) {
+        // the holders would write into freed memory, leak them instead
+        spdlog::warn("{} encoded packets still referenced", outstanding_);
+    }
+    for (auto& packets : free_) {
+        for (auto packet : packets) {
+            Free(packet);
+        }
+    }
+}
+
+EncodedPacket* PacketPool::Allocate(uint32_t capacity, int size_class)
+{
+    auto data = (uint8_t*)std::aligned_alloc(kAlign, (capacity + kAlign - 1) / kAlign * kAlign);
+    if (data == nullptr) {
+        return nullptr;
+    }
+    auto packet = new EncodedPacket;
+    packet->data = data;
+    packet->capacity = capacity;
+    packet->pool = this;
+    packet->size_class = size_class;
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    if (metrics_ != nullptr) {
+        metrics_->packet_pool_allocations.Add();
+    }
+    return packet;
+}
+
+void PacketPool::Free(EncodedPacket* packet)
+{
+    std::free(packet->data);
+    delete packet;
+}
+
+PacketRef PacketPool::Acquire(uint32_t size)
+{
+    auto it = std::lower_bound(classes_.begin(), classes_.end(), size);
+    int size_class = it != classes_.end() ? it - classes_.begin() : -1;
+
+    EncodedPacket* packet = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size_class >= 0 && !free_[size_class].empty()) {
+            packet = free_[size_class].back();
+            free_[size_class].pop_back();
+            outstanding_++;
+        }
+    }
+    // the class ran dry, the allocation runs unlocked
+    if (packet == nullptr) {
+        packet = Allocate(size_class >= 0 ? classes_[size_class] : size, size_class);
+        if (packet == nullptr) {
+            spdlog::error("Alloc packet buffer of {} bytes error", size);
+            return PacketRef();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_++;
+        bytes_ += packet->capacity;
+        if (metrics_ != nullptr) {
+            metrics_->packet_pool_bytes.Set(bytes_);
+        }
+    }
+
+    packet->size = 0;
+    packet->meta = FrameMeta();
+    packet->encoded_us = 0;
+    packet->key = false;
+    packet->has_parameter_sets = false;
+    return PacketRef::Adopt(packet);
+}
+
+PacketRef PacketPool::Copy(const uint8_t* data, uint32_t size, const FrameMeta& meta)
+{
+    auto packet = Acquire(size);
+    if (packet) {
+        std::memcpy(packet->data, data, size);
+        packet->size = size;
+        packet->meta = meta;
+        packet->encoded_us = MonotonicUs();
+    }
+    return packet;
+}
+
+PacketRef PacketPool::Copy(const uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit)
+{
+    auto packet = Copy(data, size, meta);
+    if (packet) {
+        packet->key = unit.key;
+        packet->has_parameter_sets = unit.has_parameter_sets;
+    }
+    return packet;
+}
+
+void PacketPool::Release(EncodedPacket* packet)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    outstanding_--;
+    if (packet->size_class >= 0 && free_[packet->size_class].size() < info_.max_free) {
+        free_[packet->size_class].push_back(packet);
+        return;
+    }
+    bytes_ -= packet->capacity;
+    if (metrics_ != nullptr) {
+        metrics_->packet_pool_bytes.Set(bytes_);
+    }
+    lock.unlock();
+    Free(packet);
+}
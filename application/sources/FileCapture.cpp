@@ -0,0 +1,201 @@
+#include "FileCapture.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+static constexpr std::string_view kY4mMagic = "YUV4MPEG2 ";
+static constexpr std::string_view kY4mFrame = "FRAME";
+
+FileCapture::FileCapture(const CaptureSourceInfo& info)
+    : ReplayCapture(info.fps, info.buf_count)
+    , info_(info)
+{
+}
+
+FileCapture::~FileCapture(void)
+{
+    Deinit();
+    if (map_ != nullptr) {
+        // a frame still held keeps reading the file, the mapping is leaked instead
+        spdlog::error("{} leaks its mapping, {} frames never returned", info_.path, InFlight());
+    }
+}
+
+bool FileCapture::ParseY4mHeader(size_t& data_offset)
+{
+    auto end = static_cast<uint8_t*>(std::memchr(map_, '\n', map_size_));
+    if (end == nullptr) {
+        spdlog::error("YUV4MPEG2 header not terminated");
+        return false;
+    }
+    std::string_view header((char*)map_ + kY4mMagic.size(), end - map_ - kY4mMagic.size());
+    data_offset = end - map_ + 1;
+
+    std::string colorspace = "420jpeg";
+    while (!header.empty()) {
+        auto token = header.substr(0, header.find(' '));
+        header.remove_prefix(std::min(header.size(), token.size() + 1));
+        if (token.empty()) {
+            continue;
+        }
+        auto value = token.substr(1);
+        switch (token[0]) {
+        case 'W':
+            std::from_chars(value.data(), value.data() + value.size(), info_.width);
+            break;
+        case 'H':
+            std::from_chars(value.data(), value.data() + value.size(), info_.height);
+            break;
+        case 'F': {
+            uint32_t num = 0, den = 1;
+            auto ret = std::from_chars(value.data(), value.data() + value.size(), num);
+            if (ret.ptr != value.data() + value.size() && *ret.ptr == ':') {
+                std::from_chars(ret.ptr + 1, value.data() + value.size(), den);
+            }
+            // replay rate comes from CaptureSourceInfo::fps
+            spdlog::info("YUV4MPEG2 rate {}:{}", num, den);
+        } break;
+        case 'C':
+            colorspace = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (colorspace.compare(0, 3, "420") != 0) {
+        spdlog::error("YUV4MPEG2 colorspace {} not support", colorspace);
+        return false;
+    }
+    info_.pixelformat = "I420";
+    return true;
+}
+
+bool FileCapture::IndexY4mFrames(size_t offset)
+{
+    while (offset < map_size_) {
+        if (map_size_ - offset < kY4mFrame.size()
+            || std::memcmp(map_ + offset, kY4mFrame.data(), kY4mFrame.size()) != 0) {
+            spdlog::error("YUV4MPEG2 frame header error at {}", offset);
+            return false;
+        }
+        auto end = static_cast<uint8_t*>(std::memchr(map_ + offset, '\n', map_size_ - offset));
+        if (end == nullptr) {
+            break;
+        }
+        offset = end - map_ + 1;
+        if (map_size_ - offset < frame_size_) {
+            spdlog::warn("YUV4MPEG2 truncated frame at {}", offset);
+            break;
+        }
+        frames_.push_back(offset);
+        offset += frame_size_;
+    }
+    return true;
+}
+
+bool FileCapture::Init(void)
+{
+    fd_ = ::open(info_.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        spdlog::error("Can not open {} {}", info_.path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0 || st.st_size == 0) {
+        spdlog::error("Can not stat {} {}", info_.path, strerror(errno));
+        return false;
+    }
+    map_size_ = st.st_size;
+    map_ = (uint8_t*)mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        spdlog::error("mmap {} failed {}", info_.path, strerror(errno));
+        return false;
+    }
+    madvise(map_, map_size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    bool is_y4m = map_size_ > kY4mMagic.size() && std::memcmp(map_, kY4mMagic.data(), kY4mMagic.size()) == 0;
+    size_t data_offset = 0;
+    if (is_y4m && !ParseY4mHeader(data_offset)) {
+        return false;
+    }
+
+    frame_size_ = CaptureFrameSize(info_.pixelformat, info_.width, info_.height);
+    if (frame_size_ == 0) {
+        spdlog::error("Replay frame size error {} {}x{}", info_.pixelformat, info_.width, info_.height);
+        return false;
+    }
+
+    frames_.clear();
+    if (is_y4m) {
+        if (!IndexY4mFrames(data_offset)) {
+            return false;
+        }
+    } else {
+        for (size_t offset = 0; offset + frame_size_ <= map_size_; offset += frame_size_) {
+            frames_.push_back(offset);
+        }
+    }
+    if (frames_.empty()) {
+        spdlog::error("No frame in {}", info_.path);
+        return false;
+    }
+
+    video_info_.width = info_.width;
+    video_info_.height = info_.height;
+    video_info_.pixelformat = info_.pixelformat;
+    video_info_.num_planes = 1;
+    video_info_.sizeimage = { frame_size_ };
+    video_info_.bytesperline = { CaptureLineSize(info_.pixelformat, info_.width) };
+    video_info_.colorspace = "None";
+    frame_index_ = 0;
+
+    spdlog::info("Replay {} {} {}x{} frames {}", info_.path, info_.pixelformat,
+        info_.width, info_.height, frames_.size());
+    is_running_ = true;
+    return true;
+}
+
+bool FileCapture::NextFrame(PlaneData& frame)
+{
+    if (frame_index_ == frames_.size()) {
+        if (!info_.loop) {
+            return false;
+        }
+        frame_index_ = 0;
+    }
+    frame.start = map_ + frames_[frame_index_++];
+    frame.size = frame_size_;
+    return true;
+}
+
+void FileCapture::Deinit(void)
+{
+    is_running_ = false;
+
+    // frames are the mapping itself, nothing is unmapped under a consumer
+    // (the snapshot thread up to its timeout), the next Deinit tries again
+    if (!WaitFramesReturned(1000)) {
+        return;
+    }
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
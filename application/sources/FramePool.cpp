@@ -0,0 +1,114 @@
+#include "FramePool.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "ThreadPlacement.h"
+
+FramePool::FramePool(const std::string& name)
+    : name_(name)
+{
+}
+
+FramePool::~FramePool(void)
+{
+    for (auto& frame : frames_) {
+        if (frame.refcount.load(std::memory_order_acquire) != 0) {
+            spdlog::warn("{} frame {} still referenced", name_, frame.index);
+        }
+    }
+    for (auto buffer : buffers_) {
+        std::free(buffer);
+    }
+}
+
+bool FramePool::Init(int buf_count, uint32_t frame_size)
+{
+    frames_ = std::vector<VideoFrame>(buf_count);
+    for (int i = 0; i < buf_count; i++) {
+        auto buffer = (uint8_t*)std::aligned_alloc(kAlign, (frame_size + kAlign - 1) / kAlign * kAlign);
+        if (buffer == nullptr) {
+            spdlog::error("Alloc {} buffer error", name_);
+            return false;
+        }
+        buffers_.push_back(buffer);
+        frames_[i].index = i;
+        frames_[i].planes = { PlaneData { buffer, frame_size } };
+        frames_[i].owner = this;
+    }
+    return true;
+}
+
+VideoFrame* FramePool::Acquire(void)
+{
+    for (size_t i = 0; i < frames_.size(); i++) {
+        auto& candidate = frames_[(index_ + i) % frames_.size()];
+        if (candidate.refcount.load(std::memory_order_acquire) == 0) {
+            index_ = (candidate.index + 1) % frames_.size();
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+BandWorkers::BandWorkers(int threads)
+    : bands_(threads > 0 ? threads : std::clamp((int)std::thread::hardware_concurrency(), 1, 4))
+{
+}
+
+BandWorkers::~BandWorkers(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    job_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void BandWorkers::Start(int max_bands, const std::string& name, const Work& work)
+{
+    work_ = work;
+    bands_ = std::max(std::min(bands_, max_bands), 1);
+    for (int band = 1; band < bands_; band++) {
+        workers_.emplace_back(&BandWorkers::Worker, this, band, name);
+    }
+}
+
+void BandWorkers::Worker(int band, const std::string& name)
+{
+    ThreadPlacement::Instance().Apply(ThreadRole::Convert, name + " " + std::to_string(band));
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        job_cv_.wait(lock, [&]() { return stopping_ || job_id_ != seen; });
+        if (stopping_) {
+            return;
+        }
+        seen = job_id_;
+        lock.unlock();
+        work_(band);
+        lock.lock();
+        if (--pending_ == 0) {
+            done_cv_.notify_one();
+        }
+    }
+}
+
+void BandWorkers::Run(void)
+{
+    {
+        // the job written before is published to the workers with the id
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = bands_ - 1;
+        job_id_++;
+    }
+    job_cv_.notify_all();
+    work_(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&]() { return pending_ == 0; });
+}
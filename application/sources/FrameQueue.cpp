@@ -0,0 +1,135 @@
+#include "FrameQueue.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+
+FrameQueue::FrameQueue(size_t capacity)
+    : FrameQueue(FrameQueueInfo { DropPolicy::DropNewest, capacity, 0 })
+{
+}
+
+FrameQueue::FrameQueue(const FrameQueueInfo& info)
+    : policy_(info.policy)
+    , capacity_(info.policy == DropPolicy::KeepLatest ? 1 : std::max<size_t>(info.capacity, 1))
+    , max_in_flight_(info.max_in_flight)
+    , queue_(info.policy == DropPolicy::DropNewest ? capacity_ : 1)
+{
+}
+
+void FrameQueue::CountDrop(DropReason reason)
+{
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    if (metrics_ == nullptr) {
+        return;
+    }
+    metrics_->queue_dropped.Add();
+    switch (reason) {
+    case DropReason::Newest:
+        metrics_->queue_dropped_newest.Add();
+        break;
+    case DropReason::Oldest:
+        metrics_->queue_dropped_oldest.Add();
+        break;
+    case DropReason::InFlight:
+        metrics_->queue_dropped_in_flight.Add();
+        break;
+    }
+}
+
+bool FrameQueue::Push(FrameRef frame, uint32_t in_flight)
+{
+    const bool over = max_in_flight_ != 0 && in_flight > max_in_flight_;
+    if (policy_ == DropPolicy::DropNewest) {
+        if (over) {
+            CountDrop(DropReason::InFlight);
+            return false;
+        }
+        // the queue rounds its size up (4 holds 7), the depth is enforced here. Only
+        // this thread enqueues, the count can be stale by a dequeue but never short
+        if (queue_.size_approx() >= capacity_ || !queue_.try_enqueue(std::move(frame))) {
+            CountDrop(DropReason::Newest);
+            return false;
+        }
+        if (metrics_ != nullptr) {
+            metrics_->queue_depth.Set(queue_.size_approx());
+        }
+        return true;
+    }
+
+    // released after the lock, giving a buffer back may be an ioctl
+    FrameRef victim;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (over && frames_.empty()) {
+            // the encoder holds all of them, nothing older to give back
+            CountDrop(DropReason::InFlight);
+            return false;
+        }
+        if (over || frames_.size() >= capacity_) {
+            victim = std::move(frames_.front());
+            frames_.pop_front();
+            CountDrop(over ? DropReason::InFlight : DropReason::Oldest);
+        }
+        frames_.push_back(std::move(frame));
+        if (metrics_ != nullptr) {
+            metrics_->queue_depth.Set(frames_.size());
+        }
+    }
+    cv_.notify_one();
+    return true;
+}
+
+bool FrameQueue::Pop(FrameRef& frame, int64_t timeout_us)
+{
+    if (policy_ == DropPolicy::DropNewest) {
+        if (!queue_.wait_dequeue_timed(frame, timeout_us)) {
+            return false;
+        }
+        if (metrics_ != nullptr) {
+            metrics_->queue_depth.Set(queue_.size_approx());
+        }
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cv_.wait_for(lock, std::chrono::microseconds(timeout_us), [&]() { return !frames_.empty(); })) {
+        return false;
+    }
+    frame = std::move(frames_.front());
+    frames_.pop_front();
+    if (metrics_ != nullptr) {
+        metrics_->queue_depth.Set(frames_.size());
+    }
+    return true;
+}
+
+size_t FrameQueue::Size(void) const
+{
+    if (policy_ == DropPolicy::DropNewest) {
+        return queue_.size_approx();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_.size();
+}
+
+uint64_t FrameQueue::Dropped(void) const
+{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+bool ParseDropPolicy(std::string_view name, DropPolicy& policy)
+{
+    if (name == "newest") {
+        policy = DropPolicy::DropNewest;
+    } else if (name == "oldest") {
+        policy = DropPolicy::DropOldest;
+    } else if (name == "latest") {
+        policy = DropPolicy::KeepLatest;
+    } else {
+        spdlog::error("Unknown drop policy {}", name);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,544 @@
+#include "FrameScale.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// SIMD parts of one kernel, each returns how many outputs it wrote from the
+// start, the scalar code finishes the rest. nullptr is none
+struct ScaleOps {
+    // one destination line of the rounded block means, count in bytes
+    uint32_t (*box2_luma)(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count);
+    uint32_t (*box2_chroma)(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count);
+    uint32_t (*box4_luma)(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count);
+    uint32_t (*box4_chroma)(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count);
+    // bytewise a * (256 - weight) + b * weight, weight 1-255
+    uint32_t (*lerp_rows)(const uint8_t* a, const uint8_t* b, uint32_t weight, uint8_t* dst, uint32_t count);
+    // columns of a blended line, count in pixels or uv pairs
+    uint32_t (*lerp_luma)(const uint8_t* line, uint32_t line_size, const uint32_t* index, const uint16_t* weight,
+        uint8_t* dst, uint32_t count);
+    uint32_t (*lerp_chroma)(const uint8_t* line, uint32_t line_size, const uint32_t* index, const uint16_t* weight,
+        uint8_t* dst, uint32_t count);
+};
+
+inline uint8_t Lerp(int a, int b, int weight)
+{
+    return (a * (256 - weight) + b * weight + 128) >> 8;
+}
+
+// bytes [begin, end) of a destination line, step 2 for interleaved uv
+void BoxLineScalar(const uint8_t* src, size_t stride, uint32_t factor, uint32_t step, uint8_t* dst,
+    uint32_t begin, uint32_t end)
+{
+    int shift = factor == 4 ? 4 : 2;
+    for (uint32_t i = begin; i < end; i++) {
+        const uint8_t* block = src + (size_t)(i / step) * factor * step + i % step;
+        int sum = 0;
+        for (uint32_t row = 0; row < factor; row++) {
+            for (uint32_t k = 0; k < factor; k++) {
+                sum += block[row * stride + k * step];
+            }
+        }
+        dst[i] = (sum + (1 << (shift - 1))) >> shift;
+    }
+}
+
+void LerpRowsScalar(const uint8_t* a, const uint8_t* b, uint32_t weight, uint8_t* dst, uint32_t begin,
+    uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        dst[i] = Lerp(a[i], b[i], weight);
+    }
+}
+
+// the last column has weight 0, its right neighbour is not read
+void LerpLumaScalar(const uint8_t* line, const ScaleTaps& taps, uint8_t* dst, uint32_t begin, uint32_t end)
+{
+    for (uint32_t x = begin; x < end; x++) {
+        const uint8_t* p = line + taps.index[x];
+        int weight = taps.weight[x];
+        dst[x] = weight != 0 ? Lerp(p[0], p[1], weight) : p[0];
+    }
+}
+
+void LerpChromaScalar(const uint8_t* line, const ScaleTaps& taps, uint8_t* dst, uint32_t begin, uint32_t end)
+{
+    for (uint32_t x = begin; x < end; x++) {
+        const uint8_t* p = line + taps.index[x] * 2;
+        int weight = taps.weight[x];
+        dst[x * 2] = weight != 0 ? Lerp(p[0], p[2], weight) : p[0];
+        dst[x * 2 + 1] = weight != 0 ? Lerp(p[1], p[3], weight) : p[1];
+    }
+}
+
+void BoxLine(const ScaleOps& ops, uint32_t factor, uint32_t step, const uint8_t* src, size_t stride, uint8_t* dst,
+    uint32_t count)
+{
+    auto op = factor == 4 ? (step == 1 ? ops.box4_luma : ops.box4_chroma)
+                          : (step == 1 ? ops.box2_luma : ops.box2_chroma);
+    uint32_t done = op != nullptr ? op(src, stride, dst, count) : 0;
+    BoxLineScalar(src, stride, factor, step, dst, done, count);
+}
+
+// row blended into line, or the source row itself if it needs no blending
+const uint8_t* BlendRows(const ScaleOps& ops, const uint8_t* plane, size_t stride, const ScaleTaps& taps,
+    uint32_t row, uint32_t size, uint8_t* line)
+{
+    const uint8_t* a = plane + (size_t)taps.index[row] * stride;
+    uint32_t weight = taps.weight[row];
+    if (weight == 0) {
+        return a;
+    }
+    uint32_t done = ops.lerp_rows != nullptr ? ops.lerp_rows(a, a + stride, weight, line, size) : 0;
+    LerpRowsScalar(a, a + stride, weight, line, done, size);
+    return line;
+}
+
+void ScaleRows(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end, const ScaleOps& ops)
+{
+    if (job.filter == ScaleFilter::Box) {
+        size_t src_step = (size_t)job.src_stride * job.factor;
+        for (uint32_t row = row_begin; row < row_end; row += 2) {
+            for (uint32_t r = row; r < row + 2; r++) {
+                BoxLine(ops, job.factor, 1, job.src_y + r * src_step, job.src_stride,
+                    job.dst_y + (size_t)r * job.dst_stride, job.dst_width);
+            }
+            BoxLine(ops, job.factor, 2, job.src_uv + row / 2 * src_step, job.src_stride,
+                job.dst_uv + (size_t)row / 2 * job.dst_stride, job.dst_width);
+        }
+        return;
+    }
+
+    // one blended source line per thread, luma and chroma lines are src_width bytes
+    thread_local std::vector<uint8_t> scratch;
+    if (scratch.size() < job.src_width) {
+        scratch.resize(job.src_width);
+    }
+    auto& taps = *job.taps;
+    uint32_t pairs = job.dst_width / 2;
+    for (uint32_t row = row_begin; row < row_end; row += 2) {
+        for (uint32_t r = row; r < row + 2; r++) {
+            auto line = BlendRows(ops, job.src_y, job.src_stride, taps.luma_y, r, job.src_width, scratch.data());
+            uint8_t* dst = job.dst_y + (size_t)r * job.dst_stride;
+            uint32_t done = ops.lerp_luma != nullptr ? ops.lerp_luma(line, job.src_width, taps.luma_x.index.data(),
+                                                           taps.luma_x.weight.data(), dst, job.dst_width)
+                                                     : 0;
+            LerpLumaScalar(line, taps.luma_x, dst, done, job.dst_width);
+        }
+        auto line = BlendRows(ops, job.src_uv, job.src_stride, taps.chroma_y, row / 2, job.src_width, scratch.data());
+        uint8_t* dst = job.dst_uv + (size_t)row / 2 * job.dst_stride;
+        uint32_t done = ops.lerp_chroma != nullptr ? ops.lerp_chroma(line, job.src_width, taps.chroma_x.index.data(),
+                                                         taps.chroma_x.weight.data(), dst, pairs)
+                                                   : 0;
+        LerpChromaScalar(line, taps.chroma_x, dst, done, pairs);
+    }
+}
+
+ScaleTaps MakeTaps(uint32_t src, uint32_t dst)
+{
+    ScaleTaps taps;
+    taps.index.resize(dst);
+    taps.weight.resize(dst);
+    for (uint32_t d = 0; d < dst; d++) {
+        // pixel centers, (d + 0.5) * src / dst - 0.5 in 16.16 fixed point
+        int64_t pos = ((int64_t)(2 * d + 1) * src << 16) / (2 * (int64_t)dst) - (1 << 15);
+        pos = std::max<int64_t>(pos, 0);
+        uint32_t index = pos >> 16;
+        uint16_t weight = (pos & 0xFFFF) >> 8;
+        if (index >= src - 1) {
+            index = src - 1;
+            weight = 0;
+        }
+        taps.index[d] = index;
+        taps.weight[d] = weight;
+    }
+    return taps;
+}
+
+} // namespace
+
+BilinearTaps MakeBilinearTaps(uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height)
+{
+    return {
+        MakeTaps(src_width, dst_width),
+        MakeTaps(src_height, dst_height),
+        MakeTaps(src_width / 2, dst_width / 2),
+        MakeTaps(src_height / 2, dst_height / 2),
+    };
+}
+
+void ScaleNv12Scalar(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end)
+{
+    ScaleRows(job, row_begin, row_end, ScaleOps {});
+}
+
+#if defined(__x86_64__)
+
+namespace {
+
+// 16 lanes of 16 bit values up to 255 -> 16 bytes
+__attribute__((target("avx2"))) inline void Store16(uint8_t* dst, __m256i v)
+{
+    auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+    _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+}
+
+// u0 v0 u1 v1 -> u0 u1 v0 v1, pair sums then stay interleaved
+__attribute__((target("avx2"))) inline __m256i PairMask(void)
+{
+    return _mm256_setr_epi8(0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15,
+        0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15);
+}
+
+// u0 v0 .. u3 v3 -> u0 .. u3 v0 .. v3, quad sums then stay interleaved
+__attribute__((target("avx2"))) inline __m256i QuadMask(void)
+{
+    return _mm256_setr_epi8(0, 2, 4, 6, 1, 3, 5, 7, 8, 10, 12, 14, 9, 11, 13, 15,
+        0, 2, 4, 6, 1, 3, 5, 7, 8, 10, 12, 14, 9, 11, 13, 15);
+}
+
+// sums of adjacent byte pairs over rows, in order
+template <int Rows, bool Chroma>
+__attribute__((target("avx2"))) inline __m256i PairSums(const uint8_t* src, size_t stride)
+{
+    const __m256i ones = _mm256_set1_epi8(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int row = 0; row < Rows; row++) {
+        auto bytes = _mm256_loadu_si256((const __m256i*)(src + row * stride));
+        if (Chroma) {
+            bytes = _mm256_shuffle_epi8(bytes, Rows == 2 ? PairMask() : QuadMask());
+        }
+        sum = _mm256_add_epi16(sum, _mm256_maddubs_epi16(bytes, ones));
+    }
+    return sum;
+}
+
+template <bool Chroma>
+__attribute__((target("avx2"))) uint32_t Box2Avx2(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        auto sum = PairSums<2, Chroma>(src + x * 2, stride);
+        Store16(dst + x, _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2));
+    }
+    return x;
+}
+
+template <bool Chroma>
+__attribute__((target("avx2"))) uint32_t Box4Avx2(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i half = _mm256_set1_epi32(8);
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        // adjacent pair sums -> quad sums, 8 per 32 source bytes
+        auto low = _mm256_madd_epi16(PairSums<4, Chroma>(src + x * 4, stride), ones);
+        auto high = _mm256_madd_epi16(PairSums<4, Chroma>(src + x * 4 + 32, stride), ones);
+        low = _mm256_srli_epi32(_mm256_add_epi32(low, half), 4);
+        high = _mm256_srli_epi32(_mm256_add_epi32(high, half), 4);
+        Store16(dst + x, _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) uint32_t LerpRowsAvx2(const uint8_t* a, const uint8_t* b, uint32_t weight,
+    uint8_t* dst, uint32_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i wa = _mm256_set1_epi16(256 - weight);
+    const __m256i wb = _mm256_set1_epi16(weight);
+    const __m256i half = _mm256_set1_epi16(128);
+    uint32_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto va = _mm256_loadu_si256((const __m256i*)(a + i));
+        auto vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        // at most 255 * 256 + 128, fits unsigned 16 bit
+        auto low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb));
+        auto high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb));
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, half), 8);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, half), 8);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(low, high));
+    }
+    return i;
+}
+
+// 8 weights as 16 bit (256 - w, w) pairs for madd
+__attribute__((target("avx2"))) inline __m256i WeightPairs(const uint16_t* weight)
+{
+    auto w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)weight));
+    return _mm256_or_si256(_mm256_sub_epi32(_mm256_set1_epi32(256), w), _mm256_slli_epi32(w, 16));
+}
+
+// gathers 4 bytes at each index, the last one read must stay inside the line
+__attribute__((target("avx2"))) uint32_t LerpLumaAvx2(const uint8_t* line, uint32_t line_size,
+    const uint32_t* index, const uint16_t* weight, uint8_t* dst, uint32_t count)
+{
+    const __m256i pairs = _mm256_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+        0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+    const __m256i half = _mm256_set1_epi32(128);
+    uint32_t x = 0;
+    for (; x + 16 <= count && index[x + 15] + 4 <= line_size; x += 16) {
+        __m256i out[2];
+        for (int k = 0; k < 2; k++) {
+            auto offsets = _mm256_loadu_si256((const __m256i*)(index + x + k * 8));
+            auto bytes = _mm256_i32gather_epi32((const int*)line, offsets, 1);
+            auto sum = _mm256_madd_epi16(_mm256_shuffle_epi8(bytes, pairs), WeightPairs(weight + x + k * 8));
+            out[k] = _mm256_srli_epi32(_mm256_add_epi32(sum, half), 8);
+        }
+        Store16(dst + x, _mm256_permute4x64_epi64(_mm256_packus_epi32(out[0], out[1]), 0xD8));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) uint32_t LerpChromaAvx2(const uint8_t* line, uint32_t line_size,
+    const uint32_t* index, const uint16_t* weight, uint8_t* dst, uint32_t count)
+{
+    // u0 v0 u1 v1 -> (u0, u1) and (v0, v1) as 16 bit pairs
+    const __m256i u_pairs = _mm256_setr_epi8(0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1,
+        0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1);
+    const __m256i v_pairs = _mm256_setr_epi8(1, -1, 3, -1, 5, -1, 7, -1, 9, -1, 11, -1, 13, -1, 15, -1,
+        1, -1, 3, -1, 5, -1, 7, -1, 9, -1, 11, -1, 13, -1, 15, -1);
+    const __m256i half = _mm256_set1_epi32(128);
+    uint32_t x = 0;
+    for (; x + 8 <= count && index[x + 7] * 2 + 4 <= line_size; x += 8) {
+        auto offsets = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*)(index + x)), 1);
+        auto bytes = _mm256_i32gather_epi32((const int*)line, offsets, 1);
+        auto weights = WeightPairs(weight + x);
+        auto u = _mm256_madd_epi16(_mm256_shuffle_epi8(bytes, u_pairs), weights);
+        auto v = _mm256_madd_epi16(_mm256_shuffle_epi8(bytes, v_pairs), weights);
+        u = _mm256_srli_epi32(_mm256_add_epi32(u, half), 8);
+        v = _mm256_srli_epi32(_mm256_add_epi32(v, half), 8);
+        // u in the low, v in the high 16 bits of each pair
+        Store16(dst + x * 2, _mm256_or_si256(u, _mm256_slli_epi32(v, 16)));
+    }
+    return x;
+}
+
+const ScaleOps kAvx2Ops = {
+    Box2Avx2<false>,
+    Box2Avx2<true>,
+    Box4Avx2<false>,
+    Box4Avx2<true>,
+    LerpRowsAvx2,
+    LerpLumaAvx2,
+    LerpChromaAvx2,
+};
+
+} // namespace
+
+void ScaleNv12Avx2(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end)
+{
+    ScaleRows(job, row_begin, row_end, kAvx2Ops);
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+namespace {
+
+uint32_t Box2LumaNeon(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const uint8_t* top = src + x * 2;
+        const uint8_t* bottom = top + stride;
+        auto low = vpadalq_u8(vpaddlq_u8(vld1q_u8(top)), vld1q_u8(bottom));
+        auto high = vpadalq_u8(vpaddlq_u8(vld1q_u8(top + 16)), vld1q_u8(bottom + 16));
+        // (sum + 2) >> 2
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+    }
+    return x;
+}
+
+uint32_t Box2ChromaNeon(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        auto top = vld2q_u8(src + x * 2);
+        auto bottom = vld2q_u8(src + x * 2 + stride);
+        uint8x8x2_t uv = { {
+            vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(top.val[0]), bottom.val[0]), 2),
+            vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(top.val[1]), bottom.val[1]), 2),
+        } };
+        vst2_u8(dst + x, uv);
+    }
+    return x;
+}
+
+// pair sums of 16 bytes over 4 rows
+inline uint16x8_t PairSums4(const uint8_t* src, size_t stride)
+{
+    uint16x8_t sum = vpaddlq_u8(vld1q_u8(src));
+    for (int row = 1; row < 4; row++) {
+        sum = vpadalq_u8(sum, vld1q_u8(src + row * stride));
+    }
+    return sum;
+}
+
+uint32_t Box4LumaNeon(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const uint8_t* block = src + x * 4;
+        auto low = vpaddq_u16(PairSums4(block, stride), PairSums4(block + 16, stride));
+        auto high = vpaddq_u16(PairSums4(block + 32, stride), PairSums4(block + 48, stride));
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(low, 4), vrshrn_n_u16(high, 4)));
+    }
+    return x;
+}
+
+// pair sums of 16 u and 16 v over 4 rows
+inline uint16x8x2_t ChromaPairSums4(const uint8_t* src, size_t stride)
+{
+    auto uv = vld2q_u8(src);
+    uint16x8x2_t sum = { { vpaddlq_u8(uv.val[0]), vpaddlq_u8(uv.val[1]) } };
+    for (int row = 1; row < 4; row++) {
+        uv = vld2q_u8(src + row * stride);
+        sum.val[0] = vpadalq_u8(sum.val[0], uv.val[0]);
+        sum.val[1] = vpadalq_u8(sum.val[1], uv.val[1]);
+    }
+    return sum;
+}
+
+uint32_t Box4ChromaNeon(const uint8_t* src, size_t stride, uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        auto first = ChromaPairSums4(src + x * 4, stride);
+        auto second = ChromaPairSums4(src + x * 4 + 32, stride);
+        uint8x8x2_t uv = { {
+            vrshrn_n_u16(vpaddq_u16(first.val[0], second.val[0]), 4),
+            vrshrn_n_u16(vpaddq_u16(first.val[1], second.val[1]), 4),
+        } };
+        vst2_u8(dst + x, uv);
+    }
+    return x;
+}
+
+uint32_t LerpRowsNeon(const uint8_t* a, const uint8_t* b, uint32_t weight, uint8_t* dst, uint32_t count)
+{
+    const uint8x8_t wa = vdup_n_u8(256 - weight);
+    const uint8x8_t wb = vdup_n_u8(weight);
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto va = vld1q_u8(a + i);
+        auto vb = vld1q_u8(b + i);
+        auto low = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+        auto high = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+        // (x + 128) >> 8
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8)));
+    }
+    return i;
+}
+
+// a * (256 - weight) + b * weight, rounded, 16 bit lanes
+inline uint8x8_t Lerp8(uint16x8_t a, uint16x8_t b, uint16x8_t weight)
+{
+    auto sum = vmulq_u16(a, vsubq_u16(vdupq_n_u16(256), weight));
+    return vrshrn_n_u16(vmlaq_u16(sum, b, weight), 8);
+}
+
+uint32_t LerpLumaNeon(const uint8_t* line, uint32_t line_size, const uint32_t* index, const uint16_t* weight,
+    uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= count && index[x + 15] + 2 <= line_size; x += 16) {
+        uint8x8_t out[2];
+        for (int k = 0; k < 2; k++) {
+            // each neighbour pair as one little endian 16 bit lane
+            uint16_t taps[8];
+            for (int i = 0; i < 8; i++) {
+                std::memcpy(&taps[i], line + index[x + k * 8 + i], 2);
+            }
+            auto pairs = vld1q_u16(taps);
+            out[k] = Lerp8(vandq_u16(pairs, vdupq_n_u16(0xFF)), vshrq_n_u16(pairs, 8), vld1q_u16(weight + x + k * 8));
+        }
+        vst1q_u8(dst + x, vcombine_u8(out[0], out[1]));
+    }
+    return x;
+}
+
+uint32_t LerpChromaNeon(const uint8_t* line, uint32_t line_size, const uint32_t* index, const uint16_t* weight,
+    uint8_t* dst, uint32_t count)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= count && index[x + 7] * 2 + 4 <= line_size; x += 8) {
+        // u0 v0 u1 v1 of each destination pair
+        uint32_t taps[8];
+        for (int i = 0; i < 8; i++) {
+            std::memcpy(&taps[i], line + index[x + i] * 2, 4);
+        }
+        // (u0 v0) and (u1 v1) of the 8 pairs
+        auto split = vuzpq_u16(vreinterpretq_u16_u32(vld1q_u32(taps)), vreinterpretq_u16_u32(vld1q_u32(taps + 4)));
+        auto left = vreinterpretq_u8_u16(split.val[0]);
+        auto right = vreinterpretq_u8_u16(split.val[1]);
+        auto weights = vld1q_u16(weight + x);
+        // the same weight for u and v
+        auto both = vzipq_u16(weights, weights);
+        auto low = Lerp8(vmovl_u8(vget_low_u8(left)), vmovl_u8(vget_low_u8(right)), both.val[0]);
+        auto high = Lerp8(vmovl_u8(vget_high_u8(left)), vmovl_u8(vget_high_u8(right)), both.val[1]);
+        vst1q_u8(dst + x * 2, vcombine_u8(low, high));
+    }
+    return x;
+}
+
+const ScaleOps kNeonOps = {
+    Box2LumaNeon,
+    Box2ChromaNeon,
+    Box4LumaNeon,
+    Box4ChromaNeon,
+    LerpRowsNeon,
+    LerpLumaNeon,
+    LerpChromaNeon,
+};
+
+} // namespace
+
+void ScaleNv12Neon(const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end)
+{
+    ScaleRows(job, row_begin, row_end, kNeonOps);
+}
+
+#endif
+
+void ScaleNv12(ConvertKernel kernel, const Nv12ScaleJob& job, uint32_t row_begin, uint32_t row_end)
+{
+    switch (kernel) {
+#if defined(__x86_64__)
+    case ConvertKernel::Avx2:
+        ScaleNv12Avx2(job, row_begin, row_end);
+        return;
+#endif
+#if defined(__aarch64__)
+    case ConvertKernel::Neon:
+        ScaleNv12Neon(job, row_begin, row_end);
+        return;
+#endif
+    default:
+        ScaleNv12Scalar(job, row_begin, row_end);
+        return;
+    }
+}
+
+bool ParseScaleFilter(std::string_view name, ScaleFilter& filter)
+{
+    if (name == "box") {
+        filter = ScaleFilter::Box;
+    } else if (name == "bilinear") {
+        filter = ScaleFilter::Bilinear;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#include "FrameScaler.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+FrameScaler::FrameScaler(uint32_t src_width, uint32_t src_height, uint32_t src_stride, uint32_t src_ver_stride,
+    uint32_t dst_width, uint32_t dst_height, ScaleFilter filter, int buf_count, int threads, ConvertKernel kernel)
+    : src_width_(src_width)
+    , src_height_(src_height)
+    , src_stride_(src_stride != 0 ? src_stride : src_width)
+    , src_ver_stride_(std::max(src_ver_stride, src_height))
+    , dst_width_(dst_width)
+    , dst_height_(dst_height)
+    , stride_((dst_width + FramePool::kAlign - 1) / FramePool::kAlign * FramePool::kAlign)
+    , filter_(filter)
+    , buf_count_(std::max(buf_count, 1))
+    , kernel_(ConvertKernelSupported(kernel) ? kernel : ConvertKernel::Scalar)
+    , pool_("Scale")
+    , workers_(threads)
+{
+}
+
+FrameScaler::~FrameScaler(void) = default;
+
+bool FrameScaler::Init(void)
+{
+    if (src_width_ % 2 != 0 || src_height_ % 2 != 0 || dst_width_ == 0 || dst_height_ == 0
+        || dst_width_ % 2 != 0 || dst_height_ % 2 != 0 || dst_width_ > src_width_ || dst_height_ > src_height_) {
+        spdlog::error("Scale size error {}x{} -> {}x{}", src_width_, src_height_, dst_width_, dst_height_);
+        return false;
+    }
+    if (filter_ == ScaleFilter::Box) {
+        factor_ = src_width_ / dst_width_;
+        if ((factor_ != 2 && factor_ != 4) || (src_width_ / factor_ & ~1U) != dst_width_
+            || (src_height_ / factor_ & ~1U) != dst_height_) {
+            spdlog::error("Box scale needs a half or a quarter of {}x{}, not {}x{}", src_width_, src_height_,
+                dst_width_, dst_height_);
+            return false;
+        }
+    } else {
+        taps_ = MakeBilinearTaps(src_width_, src_height_, dst_width_, dst_height_);
+    }
+
+    if (!pool_.Init(buf_count_, FrameSize())) {
+        return false;
+    }
+    workers_.Start(dst_height_ / 2, "scale", [this](int band) { RunBand(band); });
+
+    spdlog::info("Scale NV12 {}x{} -> {}x{} stride {}, {} {} kernel, {} threads", src_width_, src_height_,
+        dst_width_, dst_height_, stride_, filter_ == ScaleFilter::Box ? "box" : "bilinear",
+        ConvertKernelName(kernel_), workers_.Bands());
+    return true;
+}
+
+void FrameScaler::RunBand(int band)
+{
+    // bands cover whole destination row pairs
+    ScaleNv12(kernel_, job_, workers_.BandBegin(band, dst_height_), workers_.BandBegin(band + 1, dst_height_));
+}
+
+FrameRef FrameScaler::Scale(const FrameRef& frame)
+{
+    // NV12M carries uv in its own plane
+    const uint8_t* src_y = (const uint8_t*)frame->planes[0].start;
+    const uint8_t* src_uv = nullptr;
+    size_t y_size = (size_t)src_stride_ * (src_height_ - 1) + src_width_;
+    size_t uv_size = (size_t)src_stride_ * (src_height_ / 2 - 1) + src_width_;
+    if (frame->planes.size() > 1) {
+        src_uv = (const uint8_t*)frame->planes[1].start;
+        if (frame->planes[0].size < y_size || frame->planes[1].size < uv_size) {
+            spdlog::error("Scale source too small {} + {}", frame->planes[0].size, frame->planes[1].size);
+            return FrameRef();
+        }
+    } else {
+        size_t uv_offset = (size_t)src_stride_ * src_ver_stride_;
+        src_uv = src_y + uv_offset;
+        if (frame->planes[0].size < uv_offset + uv_size) {
+            spdlog::error("Scale source too small {}", frame->planes[0].size);
+            return FrameRef();
+        }
+    }
+
+    auto slot = pool_.Acquire();
+    if (slot == nullptr) {
+        spdlog::debug("Scale pool empty, drop frame {}", frame->meta.sequence);
+        return FrameRef();
+    }
+
+    auto dst = (uint8_t*)slot->planes[0].start;
+    job_ = { src_y, src_uv, src_stride_, src_width_, src_height_, dst, dst + (size_t)stride_ * dst_height_, stride_,
+        dst_width_, dst_height_, filter_, factor_, &taps_ };
+    workers_.Run();
+
+    slot->meta = frame->meta;
+    return FrameRef::Adopt(slot);
+}
@@ -0,0 +1,243 @@
+#include "FrameTracer.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "VideoFrame.h"
+
+namespace {
+
+constexpr const char* kSpanNames[] = { "dequeue", "callback", "put_frame", "encode", "send" };
+
+// gives the ring back when its thread exits, the next thread reuses it
+struct RingHolder {
+    void* ring = nullptr;
+    void (*release)(void*) = nullptr;
+
+    ~RingHolder(void)
+    {
+        if (ring != nullptr) {
+            release(ring);
+        }
+    }
+};
+
+thread_local RingHolder t_ring;
+
+// names are stream ids and thread names, only quotes and backslashes need it
+std::string JsonEscape(const std::string& str)
+{
+    std::string out;
+    for (auto c : str) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+        }
+        if ((unsigned char)c >= 0x20) {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+FrameTracer& FrameTracer::Instance(void)
+{
+    static FrameTracer tracer;
+    return tracer;
+}
+
+void FrameTracer::Configure(const TraceInfo& info)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    info_ = info;
+    uint32_t events = 1;
+    while (events < info_.events) {
+        events *= 2;
+    }
+    info_.events = events;
+    if (info_.enabled) {
+        since_us_.store(MonotonicUs(), std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_relaxed);
+        spdlog::info("Frame trace on, {} spans per thread", info_.events);
+    }
+}
+
+void FrameTracer::Start(uint32_t seconds)
+{
+    auto now_us = MonotonicUs();
+    since_us_.store(now_us, std::memory_order_relaxed);
+    stop_us_.store(seconds != 0 ? now_us + seconds * 1000000ULL : 0, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+    spdlog::info("Frame trace started{}", seconds != 0 ? fmt::format(" for {}s", seconds) : "");
+}
+
+void FrameTracer::Stop(void)
+{
+    if (enabled_.exchange(false, std::memory_order_relaxed)) {
+        spdlog::info("Frame trace stopped");
+    }
+    stop_us_.store(0, std::memory_order_relaxed);
+}
+
+void FrameTracer::Poll(uint64_t now_us)
+{
+    auto stop_us = stop_us_.load(std::memory_order_relaxed);
+    if (stop_us != 0 && now_us >= stop_us) {
+        Stop();
+    }
+}
+
+uint16_t FrameTracer::Stream(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < streams_.size(); i++) {
+        if (streams_[i] == name) {
+            return i;
+        }
+    }
+    streams_.push_back(name);
+    return streams_.size() - 1;
+}
+
+void FrameTracer::Append(TraceSpan span, uint16_t stream, uint64_t sequence, uint64_t start_us, uint64_t end_us)
+{
+    auto ring = (Ring*)t_ring.ring;
+    if (ring == nullptr) {
+        // first span of this thread, the only time it takes the lock
+        ring = Instance().AcquireRing();
+        t_ring.ring = ring;
+        t_ring.release = [](void* ring) { ReleaseRing((Ring*)ring); };
+    }
+
+    auto head = ring->head.load(std::memory_order_relaxed);
+    ring->claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& slot = ring->slots[head & ring->mask];
+    slot.start_us.store(start_us, std::memory_order_relaxed);
+    slot.end_us.store(end_us, std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_relaxed);
+    slot.tag.store((uint64_t)span | (uint64_t)stream << 8, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+FrameTracer::Ring* FrameTracer::AcquireRing(void)
+{
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& ring : rings_) {
+        if (!ring->in_use.load(std::memory_order_relaxed)) {
+            // what the exited thread left is still rendered, under the new name
+            ring->in_use.store(true, std::memory_order_relaxed);
+            ring->thread = name;
+            return ring.get();
+        }
+    }
+    auto ring = std::make_unique<Ring>();
+    ring->thread = name;
+    ring->tid = rings_.size() + 1;
+    ring->slots = std::make_unique<Slot[]>(info_.events);
+    ring->mask = info_.events - 1;
+    ring->in_use.store(true, std::memory_order_relaxed);
+    rings_.push_back(std::move(ring));
+    return rings_.back().get();
+}
+
+void FrameTracer::ReleaseRing(Ring* ring)
+{
+    std::lock_guard<std::mutex> lock(Instance().mutex_);
+    ring->in_use.store(false, std::memory_order_relaxed);
+}
+
+void FrameTracer::ReadRing(const Ring& ring, uint64_t since_us, std::vector<Span>& spans)
+{
+    auto head = ring.head.load(std::memory_order_acquire);
+    auto size = ring.mask + 1;
+    auto first = head > size ? head - size : 0;
+    auto start = spans.size();
+    for (auto i = first; i < head; i++) {
+        auto& slot = ring.slots[i & ring.mask];
+        auto tag = slot.tag.load(std::memory_order_relaxed);
+        spans.push_back({ (TraceSpan)(tag & 0xff), (uint16_t)(tag >> 8), slot.sequence.load(std::memory_order_relaxed),
+            slot.start_us.load(std::memory_order_relaxed), slot.end_us.load(std::memory_order_relaxed) });
+    }
+    // slots the writer claimed meanwhile may be torn, they are the oldest read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto claimed = ring.claimed.load(std::memory_order_relaxed);
+    auto valid = claimed > size ? claimed - size : 0;
+    auto torn = valid > first ? std::min(valid - first, head - first) : 0;
+    spans.erase(spans.begin() + start, spans.begin() + start + torn);
+    spans.erase(std::remove_if(spans.begin() + start, spans.end(),
+                    [since_us](const Span& span) { return span.start_us < since_us; }),
+        spans.end());
+}
+
+std::string FrameTracer::Render(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto since_us = since_us_.load(std::memory_order_relaxed);
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+
+    fmt::format_to(it, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fmt::format_to(it, "{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"streamserver\"}}}}",
+        getpid());
+    std::vector<Span> spans;
+    for (auto& ring : rings_) {
+        fmt::format_to(it, ",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+            getpid(), ring->tid, JsonEscape(ring->thread));
+        spans.clear();
+        ReadRing(*ring, since_us, spans);
+        for (auto& span : spans) {
+            if ((size_t)span.span >= std::size(kSpanNames)) {
+                continue;
+            }
+            auto name = kSpanNames[(size_t)span.span];
+            auto stream = span.stream < streams_.size() ? JsonEscape(streams_[span.stream]) : std::string();
+            if (span.span == TraceSpan::Encode) {
+                // frames overlap in the encoder, async spans get a row each instead of nesting
+                fmt::format_to(it,
+                    ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"b\",\"id2\":{{\"local\":\"{}/{}\"}},\"ts\":{},"
+                    "\"pid\":{},\"tid\":{},\"args\":{{\"sequence\":{}}}}}",
+                    name, stream, stream, span.sequence, span.start_us, getpid(), ring->tid, span.sequence);
+                fmt::format_to(it,
+                    ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"e\",\"id2\":{{\"local\":\"{}/{}\"}},\"ts\":{},"
+                    "\"pid\":{},\"tid\":{}}}",
+                    name, stream, stream, span.sequence, span.end_us, getpid(), ring->tid);
+            } else {
+                fmt::format_to(it,
+                    ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":{},\"tid\":{},"
+                    "\"args\":{{\"sequence\":{}}}}}",
+                    name, stream, span.start_us, span.end_us - span.start_us, getpid(), ring->tid, span.sequence);
+            }
+        }
+    }
+    fmt::format_to(it, "\n]}}\n");
+    return fmt::to_string(out);
+}
+
+bool FrameTracer::Dump(void)
+{
+    auto path = fmt::format("{}/streamserver-{}-{}.json", info_.path, getpid(), time(nullptr));
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        spdlog::error("Open trace {} error", path);
+        return false;
+    }
+    auto trace = Render();
+    file.write(trace.data(), trace.size());
+    if (!file) {
+        spdlog::error("Write trace {} error", path);
+        return false;
+    }
+    spdlog::info("Frame trace written to {}", path);
+    return true;
+}
@@ -0,0 +1,152 @@
+#include "Metrics.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <iterator>
+
+uint64_t LatencyHistogram::Bucket(size_t i) const
+{
+    uint64_t count = 0;
+    for (size_t j = 0; j <= i && j < buckets_.size(); j++) {
+        count += buckets_[j].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void MetricsRegistry::Register(const std::string& stream, PipelineMetrics* metrics)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back({ stream, metrics });
+}
+
+void MetricsRegistry::Unregister(PipelineMetrics* metrics)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                       [metrics](const Entry& entry) { return entry.metrics == metrics; }),
+        entries_.end());
+}
+
+namespace {
+
+struct StageRef {
+    const char* name;
+    LatencyHistogram PipelineMetrics::*histogram;
+};
+
+constexpr StageRef kStages[] = {
+    { "dequeue_wait", &PipelineMetrics::dequeue_wait },
+    { "callback", &PipelineMetrics::callback },
+    { "encode_prepare", &PipelineMetrics::encode_prepare },
+    { "encode_submit", &PipelineMetrics::encode_submit },
+    { "encode_packet", &PipelineMetrics::encode_packet },
+    { "send_package", &PipelineMetrics::send_package },
+    { "capture_to_send", &PipelineMetrics::capture_to_send },
+    { "join_to_idr", &PipelineMetrics::join_to_idr },
+    { "source_change", &PipelineMetrics::source_change },
+    { "record_write", &PipelineMetrics::record_write },
+    { "snapshot_encode", &PipelineMetrics::snapshot_encode },
+    { "scale", &PipelineMetrics::scale },
+};
+
+struct CounterRef {
+    const char* name;
+    const char* help;
+    Counter PipelineMetrics::*counter;
+};
+
+constexpr CounterRef kCounters[] = {
+    { "frames_captured_total", "Frames delivered by the capture source", &PipelineMetrics::frames_captured },
+    { "frames_dropped_total", "Frames lost in the driver (sequence gaps)", &PipelineMetrics::frames_dropped },
+    { "queue_dropped_total", "Frames dropped between capture and encoder", &PipelineMetrics::queue_dropped },
+    { "queue_dropped_newest_total", "New frames dropped because the encoder queue was full", &PipelineMetrics::queue_dropped_newest },
+    { "queue_dropped_oldest_total", "Queued frames replaced by a newer one", &PipelineMetrics::queue_dropped_oldest },
+    { "queue_dropped_in_flight_total", "Frames dropped because too many were in flight", &PipelineMetrics::queue_dropped_in_flight },
+    { "frames_late_total", "Frames sent later than the late threshold after capture", &PipelineMetrics::frames_late },
+    { "packets_encoded_total", "Packets out of the encoder", &PipelineMetrics::packets_encoded },
+    { "packet_bytes_total", "Encoded bytes out of the encoder", &PipelineMetrics::packet_bytes },
+    { "send_errors_total", "SendPackage failures", &PipelineMetrics::send_errors },
+    { "idle_dropped_total", "Frames not encoded because nobody watched", &PipelineMetrics::idle_dropped },
+    { "forced_idr_total", "IDR frames forced for joining players", &PipelineMetrics::forced_idr },
+    { "source_changes_total", "Capture source changes (resolution, replug) handled in place", &PipelineMetrics::source_changes },
+    { "key_frames_total", "Key frames sent", &PipelineMetrics::key_frames },
+    { "key_frame_bytes_total", "Bytes of the key frame packets sent", &PipelineMetrics::key_frame_bytes },
+    { "parameter_set_bytes_total", "VPS/SPS/PPS bytes in band", &PipelineMetrics::parameter_set_bytes },
+    { "record_packets_total", "Packets written to the recording", &PipelineMetrics::record_packets },
+    { "record_bytes_total", "MPEG-TS bytes written to the recording", &PipelineMetrics::record_bytes },
+    { "record_dropped_total", "Packets not recorded because the disk fell behind or failed", &PipelineMetrics::record_dropped },
+    { "record_segments_total", "Recording segments started", &PipelineMetrics::record_segments },
+    { "record_write_errors_total", "Failed recording writes", &PipelineMetrics::record_write_errors },
+    { "timeshift_seeks_total", "Player seeks served from the timeshift ring", &PipelineMetrics::timeshift_seeks },
+    { "snapshot_requests_total", "Snapshot requests", &PipelineMetrics::snapshot_requests },
+    { "snapshot_encodes_total", "Snapshots encoded, cached ones are not counted", &PipelineMetrics::snapshot_encodes },
+    { "snapshot_timeouts_total", "Snapshot requests that got no frame in time", &PipelineMetrics::snapshot_timeouts },
+    { "scale_dropped_total", "Sub-stream frames dropped because every scaled buffer was still being encoded", &PipelineMetrics::scale_dropped },
+    { "packet_pool_allocations_total", "Encoded packet buffers allocated, flat once the pool is warm", &PipelineMetrics::packet_pool_allocations },
+};
+
+struct GaugeRef {
+    const char* name;
+    const char* help;
+    Gauge PipelineMetrics::*gauge;
+};
+
+constexpr GaugeRef kGauges[] = {
+    { "queue_depth", "Frames waiting for the encoder", &PipelineMetrics::queue_depth },
+    { "fps", "Captured frames per second over the last second", &PipelineMetrics::fps },
+    { "readers", "Players joined since the stream last had none, an upper bound", &PipelineMetrics::readers },
+    { "demand_active", "1 while encoding at full rate, 0 while idle", &PipelineMetrics::demand_active },
+    { "record_queued_bytes", "Encoded bytes waiting for the recording writer", &PipelineMetrics::record_queued_bytes },
+    { "timeshift_depth_ms", "Milliseconds of stream held for seek and speed", &PipelineMetrics::timeshift_depth_ms },
+    { "timeshift_delay_ms", "Milliseconds the players are behind live, 0 while live", &PipelineMetrics::timeshift_delay_ms },
+    { "encode_lag_ms", "Milliseconds the last encoded frame trails the newest captured one", &PipelineMetrics::encode_lag_ms },
+    { "packet_pool_bytes", "Bytes of encoded packet buffers held by the pool", &PipelineMetrics::packet_pool_bytes },
+};
+
+} // namespace
+
+std::string MetricsRegistry::Render(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+
+    fmt::format_to(it, "# HELP streamserver_stage_latency_seconds Per stage latency\n");
+    fmt::format_to(it, "# TYPE streamserver_stage_latency_seconds histogram\n");
+    for (auto& entry : entries_) {
+        for (auto& stage : kStages) {
+            auto& histogram = entry.metrics->*stage.histogram;
+            for (size_t i = 0; i < LatencyHistogram::kBounds.size(); i++) {
+                fmt::format_to(it, "streamserver_stage_latency_seconds_bucket{{stream=\"{}\",stage=\"{}\",le=\"{}\"}} {}\n",
+                    entry.stream, stage.name, LatencyHistogram::kBounds[i] / 1e6, histogram.Bucket(i));
+            }
+            fmt::format_to(it, "streamserver_stage_latency_seconds_bucket{{stream=\"{}\",stage=\"{}\",le=\"+Inf\"}} {}\n",
+                entry.stream, stage.name, histogram.Bucket(LatencyHistogram::kBounds.size()));
+            fmt::format_to(it, "streamserver_stage_latency_seconds_sum{{stream=\"{}\",stage=\"{}\"}} {}\n",
+                entry.stream, stage.name, histogram.Sum() / 1e6);
+            fmt::format_to(it, "streamserver_stage_latency_seconds_count{{stream=\"{}\",stage=\"{}\"}} {}\n",
+                entry.stream, stage.name, histogram.Count());
+        }
+    }
+
+    for (auto& counter : kCounters) {
+        fmt::format_to(it, "# HELP streamserver_{} {}\n", counter.name, counter.help);
+        fmt::format_to(it, "# TYPE streamserver_{} counter\n", counter.name);
+        for (auto& entry : entries_) {
+            fmt::format_to(it, "streamserver_{}{{stream=\"{}\"}} {}\n",
+                counter.name, entry.stream, (entry.metrics->*counter.counter).Get());
+        }
+    }
+
+    for (auto& gauge : kGauges) {
+        fmt::format_to(it, "# HELP streamserver_{} {}\n", gauge.name, gauge.help);
+        fmt::format_to(it, "# TYPE streamserver_{} gauge\n", gauge.name);
+        for (auto& entry : entries_) {
+            fmt::format_to(it, "streamserver_{}{{stream=\"{}\"}} {}\n",
+                gauge.name, entry.stream, (entry.metrics->*gauge.gauge).Get());
+        }
+    }
+
+    return fmt::to_string(out);
+}
@@ -0,0 +1,661 @@
+#include "MppEncoder.h"
+
+#include <spdlog/spdlog.h>
+
+#include "FrameTracer.h"
+#include "ThreadPlacement.h"
+
+#define MPP_ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+
+
+MppEncoder::MppEncoder(const FrameInfo& frame_info, const StreamInfo& stream_info,
+    int timeout, bool is_camera_dma)
+    : timeout(timeout)
+    , frame_info_(frame_info)
+    , stream_info_(stream_info)
+    , is_running_(true)
+    , is_camera_dma_(is_camera_dma)
+{
+}
+
+MppEncoder::~MppEncoder(void)
+{
+    Stop();
+    // the vpu may still read frames put before, only a destroyed context
+    // has let go of them. Then the capture buffers go back and the imports
+    if (ctx_ != nullptr) {
+        api_->reset(ctx_);
+        mpp_destroy(ctx_);
+        ctx_ = nullptr;
+    }
+    while (in_flight_.pop()) { }
+    ClearImportCache();
+    if (frame_group_ != nullptr) {
+        mpp_buffer_group_put(frame_group_);
+    }
+}
+
+static inline MppCodingType AdaptStreamType(std::string_view stream_type)
+{
+    if (stream_type.compare("H265") == 0) {
+        return MPP_VIDEO_CodingHEVC;
+    } else if (stream_type.compare("H264") == 0) {
+        return MPP_VIDEO_CodingAVC;
+    } else if (stream_type.compare("MJPEG") == 0) {
+        return MPP_VIDEO_CodingMJPEG;
+    }
+
+    spdlog::error("Unkown support type {}", stream_type);
+    return MPP_VIDEO_CodingUnused;
+}
+
+static inline MppFrameFormat AdaptFrameType(std::string_view stream_type)
+{
+    if (stream_type.compare("BGR24") == 0) {
+        return MPP_FMT_BGR888;
+    } else if (stream_type.compare("NV12") == 0) {
+        return MPP_FMT_YUV420SP;
+    } else if (stream_type.compare("I420") == 0) {
+        return MPP_FMT_YUV420P;
+    } else if (stream_type.compare("NV16") == 0) {
+        return MPP_FMT_YUV422SP;
+    } else if (stream_type.compare("YUYV") == 0) {
+        return MPP_FMT_YUV422_YUYV;
+    }
+
+    spdlog::error("Unkonw Frame Type {}", stream_type);
+    return MPP_FMT_BUTT;
+}
+
+bool MppEncoder::Init(const std::function<void(uint8_t*, uint32_t, const FrameMeta&)>& package_callback)
+{
+    auto encode_format = AdaptStreamType(stream_info_.StreamType);
+    auto ret = mpp_check_support_format(MPP_CTX_ENC, encode_format);
+    if (ret == MPP_SUCCESS) {
+        spdlog::info("Mpp Support {}", stream_info_.StreamType);
+    } else {
+        spdlog::error("Mpp Not Support {}", stream_info_.StreamType);
+        return false;
+    }
+
+    ret = mpp_create(&ctx_, &api_);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Create mpp error {}", (int)ret);
+        return false;
+    }
+
+    ret = mpp_init(ctx_, MPP_CTX_ENC, encode_format);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Init error {}", (int)ret);
+        return false;
+    }
+
+    // SetEncCfgDef(&rc_cfg_, &prep_cfg_);
+    // set timeout
+    ret = api_->control(ctx_, MPP_SET_INPUT_TIMEOUT, &timeout);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Set input time out error {}", (int)ret);
+        return false;
+    }
+
+    ret = api_->control(ctx_, MPP_SET_OUTPUT_TIMEOUT, &timeout);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Set output time out error {}", (int)ret);
+        return false;
+    }
+
+    if (!SetPrepConfig()) {
+        return false;
+    }
+
+    rc_cfg_.change = MPP_ENC_RC_CFG_CHANGE_ALL;
+    rc_cfg_.rc_mode = MPP_ENC_RC_MODE_VBR;
+    rc_cfg_.quality = MPP_ENC_RC_QUALITY_BEST;
+    rc_cfg_.fps_in_flex = 0;
+    rc_cfg_.fps_in_num = frame_info_.fps;
+    rc_cfg_.fps_in_denorm = 1;
+    rc_cfg_.fps_out_flex = 0;
+    rc_cfg_.fps_out_num = frame_info_.fps;
+    rc_cfg_.fps_out_denorm = 1;
+    rc_cfg_.gop = stream_info_.gop;
+    rc_cfg_.skip_cnt = 0;
+    rc_cfg_.drop_mode = MPP_ENC_RC_DROP_FRM_DISABLED;
+    rc_cfg_.drop_threshold = 20;
+    rc_cfg_.drop_gap = 1;
+    SetRcBps(TargetBps());
+
+    switch (encode_format) {
+    case MPP_VIDEO_CodingAVC:
+    case MPP_VIDEO_CodingHEVC: {
+        switch (rc_cfg_.rc_mode) {
+        case MPP_ENC_RC_MODE_FIXQP: {
+            RK_S32 fix_qp = 0;
+            rc_cfg_.qp_init = fix_qp;
+            rc_cfg_.qp_max = fix_qp;
+            rc_cfg_.qp_min = fix_qp;
+            rc_cfg_.qp_max_i = fix_qp;
+            rc_cfg_.qp_min_i = fix_qp;
+            // rc_cfg_.qp_ip = fix_qp;
+        } break;
+        case MPP_ENC_RC_MODE_CBR:
+        case MPP_ENC_RC_MODE_VBR:
+        case MPP_ENC_RC_MODE_AVBR: {
+            rc_cfg_.qp_init = -1;
+            rc_cfg_.qp_max = 51;
+            rc_cfg_.qp_min = 10;
+            rc_cfg_.qp_max_i = 51;
+            rc_cfg_.qp_min_i = 10;
+            // rc_cfg_.qp_ip = 2;
+        } break;
+        default: {
+            spdlog::error("unsupport encoder rc mode {}", (int)rc_cfg_.rc_mode);
+        } break;
+        }
+    } break;
+    case MPP_VIDEO_CodingVP8:
+        rc_cfg_.qp_init = 40;
+        rc_cfg_.qp_max = 127;
+        rc_cfg_.qp_min = 0;
+        rc_cfg_.qp_max_i = 127;
+        rc_cfg_.qp_min_i = 0;
+        // rc_cfg_.qp_ip = 6;
+        break;
+    case MPP_VIDEO_CodingMJPEG: {
+        /* jpeg use special codec config to control qtable */
+        // mpp_enc_cfg_set_s32(cfg, "jpeg:q_factor", 80);
+        // mpp_enc_cfg_set_s32(cfg, "jpeg:qf_max", 99);
+        // mpp_enc_cfg_set_s32(cfg, "jpeg:qf_min", 1);
+    } break;
+    default: {
+    } break;
+    }
+
+    ret = api_->control(ctx_, MPP_ENC_SET_RC_CFG, (MppParam)&rc_cfg_);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Set Rc error {}", (int)ret);
+        return false;
+    }
+
+    codec_cfg_.change = 0;
+    codec_cfg_.coding = AdaptStreamType(stream_info_.StreamType);
+    switch (codec_cfg_.coding) {
+    case MPP_VIDEO_CodingAVC:
+        codec_cfg_.h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE | MPP_ENC_H264_CFG_CHANGE_ENTROPY | MPP_ENC_H264_CFG_CHANGE_TRANS_8x8;
+        codec_cfg_.h264.profile = 100;
+        codec_cfg_.h264.level = 40;
+        codec_cfg_.h264.entropy_coding_mode = 1;
+        codec_cfg_.h264.cabac_init_idc = 0;
+        codec_cfg_.h264.transform8x8_mode = 1;
+        break;
+    case MPP_VIDEO_CodingMJPEG:
+        codec_cfg_.jpeg.change = MPP_ENC_JPEG_CFG_CHANGE_QP;
+        codec_cfg_.jpeg.quant = 10;
+        break;
+    case MPP_VIDEO_CodingVP8:
+    case MPP_VIDEO_CodingHEVC:
+        break;
+    default:
+        spdlog::error("Not support {}", stream_info_.StreamType);
+        return false;
+    }
+    ret = api_->control(ctx_, MPP_ENC_SET_CODEC_CFG, &codec_cfg_);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Set MPP_ENC_SET_CODEC_CFG error {}", (int)ret);
+        return false;
+    }
+
+    // every jpeg stands alone, no sei and no headers
+    if (encode_format != MPP_VIDEO_CodingMJPEG) {
+        auto sei_mode = MPP_ENC_SEI_MODE_ONE_FRAME;
+        ret = api_->control(ctx_, MPP_ENC_SET_SEI_CFG, &sei_mode);
+        if (ret) {
+            spdlog::error("mpi control enc set sei cfg failed ret %d\n", (int)ret);
+            return false;
+        }
+
+        ReadParameterSets();
+    }
+
+    package_callback_ = package_callback;
+    recv_thread_ = std::thread(&MppEncoder::EncRecvThread, this);
+
+    return true;
+}
+
+bool MppEncoder::SetPrepConfig(void)
+{
+    prep_cfg_.change = MPP_ENC_PREP_CFG_CHANGE_INPUT | MPP_ENC_PREP_CFG_CHANGE_ROTATION | MPP_ENC_PREP_CFG_CHANGE_FORMAT;
+    prep_cfg_.width = frame_info_.width;
+    prep_cfg_.height = frame_info_.height;
+    prep_cfg_.format = AdaptFrameType(frame_info_.format);
+    // dma frames are encoded in place, so the encoder takes the capture layout when it is known
+    if (frame_info_.hor_stride != 0) {
+        prep_cfg_.hor_stride = frame_info_.hor_stride;
+    } else if (MPP_FRAME_FMT_IS_RGB(prep_cfg_.format)) {
+        prep_cfg_.hor_stride = MPP_ALIGN(frame_info_.width * 3, 16);
+    } else if (prep_cfg_.format == MPP_FMT_YUV422_YUYV) {
+        prep_cfg_.hor_stride = MPP_ALIGN(frame_info_.width, 16) * 2;
+    } else if (MPP_FRAME_FMT_IS_YUV(prep_cfg_.format)) {
+        prep_cfg_.hor_stride = MPP_ALIGN(frame_info_.width, 16);
+    }
+    if (frame_info_.ver_stride != 0) {
+        prep_cfg_.ver_stride = frame_info_.ver_stride;
+    } else {
+        prep_cfg_.ver_stride = MPP_ALIGN(frame_info_.height, 16);
+    }
+    // hor_stride is in bytes, packed formats need no extra plane
+    frame_buf_size_ = prep_cfg_.hor_stride * prep_cfg_.ver_stride;
+    if (prep_cfg_.format == MPP_FMT_YUV420SP || prep_cfg_.format == MPP_FMT_YUV420P) {
+        frame_buf_size_ = frame_buf_size_ * 3 / 2;
+    } else if (prep_cfg_.format == MPP_FMT_YUV422SP) {
+        frame_buf_size_ = frame_buf_size_ * 2;
+    }
+
+    spdlog::info("width {}, height {}, hor_stride {}, ver_stride {}, format {}",
+        prep_cfg_.width, prep_cfg_.height, prep_cfg_.hor_stride, prep_cfg_.ver_stride, (int)prep_cfg_.format);
+    auto ret = api_->control(ctx_, MPP_ENC_SET_PREP_CFG, (MppParam)&prep_cfg_);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Mpp Set prep error {}", (int)ret);
+        return false;
+    }
+    return true;
+}
+
+uint32_t MppEncoder::TargetBps(void) const
+{
+    return stream_info_.bitrate != 0 ? stream_info_.bitrate
+                                     : frame_info_.width * frame_info_.height / 8 * frame_info_.fps;
+}
+
+void MppEncoder::SetRcBps(uint32_t bps)
+{
+    rc_cfg_.bps_target = bps;
+    switch (rc_cfg_.rc_mode) {
+    case MPP_ENC_RC_MODE_FIXQP:
+        break;
+    case MPP_ENC_RC_MODE_CBR:
+        rc_cfg_.bps_max = bps * 17 / 16;
+        rc_cfg_.bps_min = bps * 15 / 16;
+        break;
+    case MPP_ENC_RC_MODE_VBR:
+    case MPP_ENC_RC_MODE_AVBR:
+        rc_cfg_.bps_max = bps * 17 / 16;
+        rc_cfg_.bps_min = bps * 1 / 16;
+        break;
+    default:
+        rc_cfg_.bps_max = bps * 17 / 16;
+        rc_cfg_.bps_min = bps * 15 / 16;
+        break;
+    }
+}
+
+bool MppEncoder::ReadParameterSets(void)
+{
+    // headers of the current config, new sessions need them before any IDR
+    std::vector<uint8_t> header_buf(1024);
+    MppPacket header = nullptr;
+    mpp_packet_init(&header, header_buf.data(), header_buf.size());
+    mpp_packet_set_length(header, 0);
+    auto ret = api_->control(ctx_, MPP_ENC_GET_HDR_SYNC, header);
+    if (ret == MPP_SUCCESS) {
+        auto ptr = (uint8_t*)mpp_packet_get_pos(header);
+        parameter_sets_.assign(ptr, ptr + mpp_packet_get_length(header));
+        spdlog::info("Mpp parameter sets {} bytes", parameter_sets_.size());
+    } else {
+        parameter_sets_.clear();
+        spdlog::warn("Mpp get header error {}, parameter sets only in band", (int)ret);
+    }
+    mpp_packet_deinit(&header);
+    return ret == MPP_SUCCESS;
+}
+
+bool MppEncoder::Reconfigure(const FrameInfo& frame_info)
+{
+    frame_info_ = frame_info;
+    // the source buffers are new, so is their layout
+    ClearImportCache();
+    if (frame_group_ != nullptr) {
+        mpp_buffer_group_put(frame_group_);
+        frame_group_ = nullptr;
+    }
+    if (!SetPrepConfig()) {
+        return false;
+    }
+    if (stream_info_.bitrate == 0) {
+        SetRcBps(TargetBps());
+        rc_cfg_.change = MPP_ENC_RC_CFG_CHANGE_BPS;
+        auto ret = api_->control(ctx_, MPP_ENC_SET_RC_CFG, (MppParam)&rc_cfg_);
+        if (ret != MPP_SUCCESS) {
+            spdlog::error("Mpp Set Rc error {}", (int)ret);
+            return false;
+        }
+    }
+    if (codec_cfg_.coding != MPP_VIDEO_CodingMJPEG) {
+        ReadParameterSets();
+    }
+    // players need the new headers and a frame that does not reference the old size
+    ForceIdr();
+    return true;
+}
+
+void MppEncoder::EncRecvThread(MppEncoder* self)
+{
+    ThreadPlacement::Instance().Apply(ThreadRole::EncoderRecv, "mpp recv");
+    MppPacket packet = NULL;
+    while (self->is_running_) {
+        auto ret = self->api_->encode_get_packet(self->ctx_, &packet);
+        if (ret == MPP_ERR_TIMEOUT || (ret == MPP_SUCCESS && NULL == packet)) {
+            continue;
+        }
+        if (ret || NULL == packet) {
+            spdlog::error("Get Package error, {}", (int)ret);
+            continue;
+        }
+
+        self->OnPacket(packet);
+
+        ret = mpp_packet_deinit(&packet);
+        assert(ret == MPP_SUCCESS);
+    }
+}
+
+void MppEncoder::OnPacket(MppPacket packet)
+{
+    auto ptr = mpp_packet_get_pos(packet);
+    auto len = mpp_packet_get_length(packet);
+    auto pts = mpp_packet_get_pts(packet);
+
+    uint64_t submit_us = 0;
+    auto meta = ReleaseFrames(pts, submit_us);
+    if (metrics_ != nullptr) {
+        if (submit_us != 0) {
+            auto packet_us = MonotonicUs();
+            metrics_->encode_packet.Observe(packet_us - submit_us);
+            FrameTracer::Record(TraceSpan::Encode, metrics_->trace_stream, meta.sequence, submit_us, packet_us);
+        }
+        metrics_->packets_encoded.Add();
+        metrics_->packet_bytes.Add(len);
+    }
+    package_callback_((uint8_t*)ptr, len, meta);
+}
+
+FrameMeta MppEncoder::ReleaseFrames(int64_t pts, uint64_t& submit_us)
+{
+    FrameMeta meta;
+    meta.timestamp_us = pts;
+    submit_us = 0;
+    // the packet is out, its input frame and any older one mpp skipped are done
+    while (auto frame = in_flight_.peek()) {
+        if ((int64_t)frame->meta.timestamp_us > pts) {
+            break;
+        }
+        meta = frame->meta;
+        submit_us = frame->submit_us;
+        in_flight_.pop();
+    }
+    return meta;
+}
+
+bool MppEncoder::GetParameterSets(std::vector<uint8_t>& parameter_sets)
+{
+    if (parameter_sets_.empty()) {
+        return false;
+    }
+    parameter_sets = parameter_sets_;
+    return true;
+}
+
+void MppEncoder::Stop(void)
+{
+    is_running_ = false;
+    if (recv_thread_.joinable()) {
+        recv_thread_.join();
+    }
+}
+
+bool MppEncoder::CopyFrame(uint8_t* data, uint32_t size, MppBuffer& buffer)
+{
+    if (frame_group_ == nullptr) {
+        auto ret = mpp_buffer_group_get_internal(&frame_group_, MPP_BUFFER_TYPE_DRM);
+        if (ret != MPP_SUCCESS) {
+            spdlog::error("Get frame buffer group error {}", (int)ret);
+            return false;
+        }
+    }
+    auto ret = mpp_buffer_get(frame_group_, &buffer, frame_buf_size_);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Get frame buffer error {}", (int)ret);
+        return false;
+    }
+
+    // source rows are src_stride apart, the encoder wants hor_stride x ver_stride
+    auto dst = (uint8_t*)mpp_buffer_get_ptr(buffer);
+    const uint32_t width = frame_info_.width;
+    const uint32_t height = frame_info_.height;
+    const uint32_t hor_stride = prep_cfg_.hor_stride;
+    const uint32_t ver_stride = prep_cfg_.ver_stride;
+    // bytes of one packed luma (or pixel) line
+    uint32_t line = width;
+    if (prep_cfg_.format == MPP_FMT_BGR888) {
+        line = width * 3;
+    } else if (prep_cfg_.format == MPP_FMT_YUV422_YUYV) {
+        line = width * 2;
+    }
+    const uint32_t src_stride = frame_info_.hor_stride != 0 ? frame_info_.hor_stride : line;
+    const uint32_t src_rows = frame_info_.ver_stride != 0 ? frame_info_.ver_stride : height;
+    auto copy_plane = [](uint8_t* dst, uint32_t dst_stride, const uint8_t* src, uint32_t src_stride,
+                          uint32_t row, uint32_t rows) {
+        for (uint32_t y = 0; y < rows; y++) {
+            memcpy(dst + y * dst_stride, src + y * src_stride, row);
+        }
+    };
+
+    switch (prep_cfg_.format) {
+    case MPP_FMT_BGR888:
+    case MPP_FMT_YUV422_YUYV:
+        if (size < src_stride * (height - 1) + line) {
+            break;
+        }
+        copy_plane(dst, hor_stride, data, src_stride, line, height);
+        return true;
+    case MPP_FMT_YUV420SP:
+    case MPP_FMT_YUV422SP: {
+        // NV16 chroma has full height
+        auto chroma_rows = prep_cfg_.format == MPP_FMT_YUV422SP ? height : height / 2;
+        if (size < src_stride * src_rows + src_stride * (chroma_rows - 1) + line) {
+            break;
+        }
+        copy_plane(dst, hor_stride, data, src_stride, line, height);
+        copy_plane(dst + hor_stride * ver_stride, hor_stride,
+            data + src_stride * src_rows, src_stride, line, chroma_rows);
+        return true;
+    }
+    case MPP_FMT_YUV420P:
+        if (size < src_stride * src_rows * 3 / 2) {
+            break;
+        }
+        copy_plane(dst, hor_stride, data, src_stride, line, height);
+        copy_plane(dst + hor_stride * ver_stride, hor_stride / 2,
+            data + src_stride * src_rows, src_stride / 2, line / 2, height / 2);
+        copy_plane(dst + hor_stride * ver_stride * 5 / 4, hor_stride / 2,
+            data + src_stride * src_rows * 5 / 4, src_stride / 2, line / 2, height / 2);
+        return true;
+    default:
+        break;
+    }
+
+    spdlog::error("Copy frame error, format {} size {}", (int)prep_cfg_.format, size);
+    mpp_buffer_put(buffer);
+    buffer = nullptr;
+    return false;
+}
+
+MppFrame MppEncoder::NewFrame(MppBuffer buffer)
+{
+    MppFrame frame = nullptr;
+    auto ret = mpp_frame_init(&frame);
+    if (ret) {
+        spdlog::error("mpp_frame_init failed {}", (int)ret);
+        return nullptr;
+    }
+    mpp_frame_set_width(frame, frame_info_.width);
+    mpp_frame_set_height(frame, frame_info_.height);
+
+    mpp_frame_set_hor_stride(frame, prep_cfg_.hor_stride);
+    mpp_frame_set_ver_stride(frame, prep_cfg_.ver_stride);
+
+    mpp_frame_set_fmt(frame, prep_cfg_.format);
+    mpp_frame_set_eos(frame, 0);
+    mpp_frame_set_buffer(frame, buffer);
+    return frame;
+}
+
+MppFrame MppEncoder::ImportFrame(const VideoFrame& frame)
+{
+    // the source reallocated its buffers (VideoCapture::Reset), every import is stale
+    if (frame.generation != import_generation_) {
+        ClearImportCache();
+        import_generation_ = frame.generation;
+    }
+    if (frame.index >= import_slots_.size()) {
+        import_slots_.resize(frame.index + 1);
+    }
+    auto& slot = import_slots_[frame.index];
+    if (slot.frame != nullptr && slot.dma_fd == frame.dma_fd) {
+        return slot.frame;
+    }
+    ReleaseImportSlot(slot);
+
+    if (import_group_ == nullptr) {
+        auto ret = mpp_buffer_group_get_external(&import_group_, MPP_BUFFER_TYPE_EXT_DMA);
+        if (ret != MPP_SUCCESS) {
+            spdlog::error("Get import buffer group error {}", (int)ret);
+            return nullptr;
+        }
+    }
+
+    MppBufferInfo info;
+    memset(&info, 0, sizeof(MppBufferInfo));
+    info.type = MPP_BUFFER_TYPE_EXT_DMA;
+    info.fd = frame.dma_fd;
+    // cached for every later frame of the index, sized by the buffer, not this payload
+    info.size = frame.dma_size != 0 ? frame.dma_size : frame.planes[0].size;
+    info.index = frame.index;
+    auto ret = mpp_buffer_import_with_tag(import_group_, &info, &slot.buffer, NULL, __FUNCTION__);
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Import dma buffer {} error {}", frame.dma_fd, (int)ret);
+        slot.buffer = nullptr;
+        return nullptr;
+    }
+
+    slot.frame = NewFrame(slot.buffer);
+    if (slot.frame == nullptr) {
+        ReleaseImportSlot(slot);
+        return nullptr;
+    }
+    slot.dma_fd = frame.dma_fd;
+    spdlog::info("Import dma buffer index {} fd {} generation {}", frame.index, frame.dma_fd, frame.generation);
+    return slot.frame;
+}
+
+void MppEncoder::ReleaseImportSlot(ImportSlot& slot)
+{
+    if (slot.frame != nullptr) {
+        mpp_frame_deinit(&slot.frame);
+        slot.frame = nullptr;
+    }
+    if (slot.buffer != nullptr) {
+        mpp_buffer_put(slot.buffer);
+        slot.buffer = nullptr;
+    }
+    slot.dma_fd = -1;
+}
+
+void MppEncoder::ClearImportCache(void)
+{
+    for (auto& slot : import_slots_) {
+        ReleaseImportSlot(slot);
+    }
+    import_slots_.clear();
+    if (import_group_ != nullptr) {
+        mpp_buffer_group_put(import_group_);
+        import_group_ = nullptr;
+    }
+}
+
+bool MppEncoder::SubmitFrame(MppFrame frame, const FrameMeta& meta, uint64_t start_ns)
+{
+    mpp_frame_set_pts(frame, (int64_t)meta.timestamp_us);
+
+    // time to get the frame ready for mpp, encode_put_frame itself waits for the encoder
+    if (metrics_ != nullptr) {
+        metrics_->encode_prepare.Observe((MonotonicNs() - start_ns) / 1000);
+    }
+
+    // applies to the next frame put, so it is only sent from the encode thread
+    if (TakeIdrRequest() && api_->control(ctx_, MPP_ENC_SET_IDR_FRAME, nullptr) != MPP_SUCCESS) {
+        spdlog::warn("Request IDR failed");
+    }
+
+    auto put_start_us = MonotonicUs();
+    auto ret = api_->encode_put_frame(ctx_, frame);
+    if (metrics_ != nullptr) {
+        auto put_end_us = MonotonicUs();
+        metrics_->encode_submit.Observe(put_end_us - put_start_us);
+        // the span covers the import too, the histogram only encode_put_frame
+        FrameTracer::Record(TraceSpan::PutFrame, metrics_->trace_stream, meta.sequence, start_ns / 1000, put_end_us);
+    }
+    if (ret != MPP_SUCCESS) {
+        spdlog::error("Encode frame error {}", (int)ret);
+        return false;
+    }
+    return true;
+}
+
+bool MppEncoder::PutFrame(uint8_t* data, uint32_t size, int dma_fd)
+{
+    FrameMeta meta;
+    meta.sequence = sequence_++;
+    meta.timestamp_us = MonotonicUs();
+    return PutFrame(data, size, meta);
+}
+
+bool MppEncoder::PutFrame(uint8_t* data, uint32_t size, const FrameMeta& meta)
+{
+    auto start_ns = MonotonicNs();
+    MppBuffer buffer = nullptr;
+    // memory frames (replay sources) are copied into an encoder owned buffer
+    if (!CopyFrame(data, size, buffer)) {
+        return false;
+    }
+
+    auto frame = NewFrame(buffer);
+    // the frame holds its own reference on the buffer
+    mpp_buffer_put(buffer);
+    if (frame == nullptr) {
+        return false;
+    }
+    in_flight_.enqueue(InFlightFrame { meta, FrameRef(), MonotonicUs() });
+    auto ret = SubmitFrame(frame, meta, start_ns);
+    mpp_frame_deinit(&frame);
+    return ret;
+}
+
+bool MppEncoder::PutFrame(FrameRef frame)
+{
+    if (frame->dma_fd < 0) {
+        // memory frames are copied, frame is dropped on return
+        auto& plane = frame->planes[0];
+        return PutFrame((uint8_t*)plane.start, plane.size, frame->meta);
+    }
+
+    auto start_ns = MonotonicNs();
+    auto mpp_frame = ImportFrame(*frame);
+    if (mpp_frame == nullptr) {
+        return false;
+    }
+    auto meta = frame->meta;
+    // queued before encode_put_frame so EncRecvThread never sees a packet ahead of it
+    in_flight_.enqueue(InFlightFrame { meta, std::move(frame), MonotonicUs() });
+    return SubmitFrame(mpp_frame, meta, start_ns);
+}
@@ -0,0 +1,248 @@
+#include "NalParser.h"
+
+#include <spdlog/spdlog.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+uint32_t FindStartCodeScalar(const uint8_t* data, uint32_t size, uint32_t pos)
+{
+    // look at the third byte first, anything above 1 skips three
+    uint32_t i = pos;
+    while (i + 3 <= size) {
+        auto third = data[i + 2];
+        if (third > 1) {
+            i += 3;
+        } else if (third == 1) {
+            if (data[i] == 0 && data[i + 1] == 0) {
+                return i;
+            }
+            i += 3;
+        } else {
+            i++;
+        }
+    }
+    return size;
+}
+
+#if defined(__x86_64__)
+
+uint32_t FindStartCodeSse2(const uint8_t* data, uint32_t size, uint32_t pos)
+{
+    const auto zero = _mm_setzero_si128();
+    const auto one = _mm_set1_epi8(1);
+    uint32_t i = pos;
+    // three loads, the last one reads up to i + 17
+    for (; i + 18 <= size; i += 16) {
+        auto b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), zero);
+        auto b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 1)), zero);
+        auto b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 2)), one);
+        auto mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return FindStartCodeScalar(data, size, i);
+}
+
+__attribute__((target("avx2"))) uint32_t FindStartCodeAvx2(const uint8_t* data, uint32_t size, uint32_t pos)
+{
+    const auto zero = _mm256_setzero_si256();
+    const auto one = _mm256_set1_epi8(1);
+    uint32_t i = pos;
+    for (; i + 34 <= size; i += 32) {
+        auto b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), zero);
+        auto b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 1)), zero);
+        auto b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 2)), one);
+        auto mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(b0, b1), b2));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return FindStartCodeScalar(data, size, i);
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+uint32_t FindStartCodeNeon(const uint8_t* data, uint32_t size, uint32_t pos)
+{
+    const auto zero = vdupq_n_u8(0);
+    const auto one = vdupq_n_u8(1);
+    uint32_t i = pos;
+    for (; i + 18 <= size; i += 16) {
+        auto b0 = vceqq_u8(vld1q_u8(data + i), zero);
+        auto b1 = vceqq_u8(vld1q_u8(data + i + 1), zero);
+        auto b2 = vceqq_u8(vld1q_u8(data + i + 2), one);
+        auto hit = vandq_u8(vandq_u8(b0, b1), b2);
+        if (vmaxvq_u8(hit) != 0) {
+            // 4 bits per byte, the first set nibble is the first hit
+            auto nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+            return i + __builtin_ctzll(nibbles) / 4;
+        }
+    }
+    return FindStartCodeScalar(data, size, i);
+}
+
+#endif
+
+bool StartCodeKernelSupported(StartCodeKernel kernel)
+{
+    switch (kernel) {
+    case StartCodeKernel::Scalar:
+        return true;
+    case StartCodeKernel::Sse2:
+#if defined(__x86_64__)
+        return true;
+#else
+        return false;
+#endif
+    case StartCodeKernel::Avx2:
+#if defined(__x86_64__)
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    case StartCodeKernel::Neon:
+#if defined(__aarch64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+StartCodeKernel BestStartCodeKernel(void)
+{
+    if (StartCodeKernelSupported(StartCodeKernel::Neon)) {
+        return StartCodeKernel::Neon;
+    }
+    if (StartCodeKernelSupported(StartCodeKernel::Avx2)) {
+        return StartCodeKernel::Avx2;
+    }
+    if (StartCodeKernelSupported(StartCodeKernel::Sse2)) {
+        return StartCodeKernel::Sse2;
+    }
+    return StartCodeKernel::Scalar;
+}
+
+std::string_view StartCodeKernelName(StartCodeKernel kernel)
+{
+    switch (kernel) {
+    case StartCodeKernel::Scalar:
+        return "scalar";
+    case StartCodeKernel::Sse2:
+        return "sse2";
+    case StartCodeKernel::Avx2:
+        return "avx2";
+    case StartCodeKernel::Neon:
+        return "neon";
+    }
+    return "unknown";
+}
+
+uint32_t FindStartCode(StartCodeKernel kernel, const uint8_t* data, uint32_t size, uint32_t pos)
+{
+    switch (kernel) {
+#if defined(__x86_64__)
+    case StartCodeKernel::Sse2:
+        return FindStartCodeSse2(data, size, pos);
+    case StartCodeKernel::Avx2:
+        return FindStartCodeAvx2(data, size, pos);
+#endif
+#if defined(__aarch64__)
+    case StartCodeKernel::Neon:
+        return FindStartCodeNeon(data, size, pos);
+#endif
+    default:
+        return FindStartCodeScalar(data, size, pos);
+    }
+}
+
+bool IsParameterSet(NalCodec codec, uint8_t type)
+{
+    if (codec == NalCodec::H265) {
+        // VPS, SPS, PPS
+        return type >= 32 && type <= 34;
+    }
+    return type == 7 || type == 8;
+}
+
+bool IsSlice(NalCodec codec, uint8_t type)
+{
+    if (codec == NalCodec::H265) {
+        return type < 32;
+    }
+    return type >= 1 && type <= 5;
+}
+
+bool IsKeySlice(NalCodec codec, uint8_t type)
+{
+    if (codec == NalCodec::H265) {
+        // BLA, IDR, CRA
+        return type >= 16 && type <= 21;
+    }
+    return type == 5;
+}
+
+NalParser::NalParser(NalCodec codec, StartCodeKernel kernel)
+    : codec_(codec)
+    , kernel_(StartCodeKernelSupported(kernel) ? kernel : StartCodeKernel::Scalar)
+{
+}
+
+const AccessUnit& NalParser::Parse(const uint8_t* data, uint32_t size)
+{
+    unit_.data = data;
+    unit_.size = size;
+    unit_.nals.clear();
+    unit_.key = false;
+    unit_.has_parameter_sets = false;
+    unit_.parameter_set_bytes = 0;
+    unit_.slice_bytes = 0;
+
+    auto code = FindStartCode(kernel_, data, size, 0);
+    uint32_t begin = code > 0 && data[code - 1] == 0 ? code - 1 : code;
+    while (code < size) {
+        auto header = code + 3;
+        auto next = header < size ? FindStartCode(kernel_, data, size, header) : size;
+        auto end = next < size && next > header && data[next - 1] == 0 ? next - 1 : next;
+        if (header >= end) {
+            // start code without a NAL header, e.g. at the end of the packet
+            break;
+        }
+
+        uint8_t type = codec_ == NalCodec::H265 ? (data[header] >> 1) & 0x3f : data[header] & 0x1f;
+        unit_.nals.push_back({ data + begin, end - begin, (uint8_t)(header - begin), type });
+        if (IsParameterSet(codec_, type)) {
+            unit_.has_parameter_sets = true;
+            unit_.parameter_set_bytes += end - begin;
+        } else if (IsSlice(codec_, type)) {
+            unit_.key |= IsKeySlice(codec_, type);
+            unit_.slice_bytes += end - begin;
+        }
+
+        code = next;
+        begin = end;
+    }
+    return unit_;
+}
+
+bool ParseNalCodec(std::string_view name, NalCodec& codec)
+{
+    if (name == "H264") {
+        codec = NalCodec::H264;
+    } else if (name == "H265") {
+        codec = NalCodec::H265;
+    } else {
+        spdlog::error("Unknown codec {}", name);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,176 @@
+#include "PatternCapture.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+
+namespace {
+
+struct Yuv {
+    uint8_t y;
+    uint8_t u;
+    uint8_t v;
+};
+
+// 75% color bars, B G R
+constexpr uint8_t kBars[8][3] = {
+    { 191, 191, 191 },
+    { 0, 191, 191 },
+    { 191, 191, 0 },
+    { 0, 191, 0 },
+    { 191, 0, 191 },
+    { 0, 0, 191 },
+    { 191, 0, 0 },
+    { 0, 0, 0 },
+};
+
+// BT.601 limited range
+inline Yuv BgrToYuv(const uint8_t* bgr)
+{
+    int b = bgr[0], g = bgr[1], r = bgr[2];
+    return {
+        (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16),
+        (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128),
+        (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128),
+    };
+}
+
+} // namespace
+
+PatternCapture::PatternCapture(const CaptureSourceInfo& info)
+    : ReplayCapture(info.fps, info.buf_count)
+    , info_(info)
+{
+    if (info_.pixelformat.empty()) {
+        info_.pixelformat = "BGR24";
+    }
+}
+
+PatternCapture::~PatternCapture(void)
+{
+    Deinit();
+    if (!frames_.empty()) {
+        // a frame still held keeps reading them, the buffers are leaked instead
+        spdlog::error("Pattern leaks its buffers, {} frames never returned", InFlight());
+        new std::vector<std::vector<uint8_t>>(std::move(frames_));
+    }
+}
+
+void PatternCapture::Render(uint8_t* data, uint32_t offset)
+{
+    const auto width = info_.width;
+    const auto height = info_.height;
+    auto bar_of = [&](uint32_t x) { return ((x + offset) % width) * 8 / width; };
+
+    if (info_.pixelformat.compare("BGR24") == 0) {
+        for (uint32_t x = 0; x < width; x++) {
+            std::memcpy(data + x * 3, kBars[bar_of(x)], 3);
+        }
+        for (uint32_t y = 1; y < height; y++) {
+            std::memcpy(data + y * width * 3, data, width * 3);
+        }
+        return;
+    }
+
+    if (info_.pixelformat.compare("YUYV") == 0) {
+        for (uint32_t x = 0; x + 1 < width; x += 2) {
+            auto yuv0 = BgrToYuv(kBars[bar_of(x)]);
+            auto yuv1 = BgrToYuv(kBars[bar_of(x + 1)]);
+            uint8_t* pixel = data + x * 2;
+            pixel[0] = yuv0.y;
+            pixel[1] = yuv0.u;
+            pixel[2] = yuv1.y;
+            pixel[3] = yuv0.v;
+        }
+        for (uint32_t y = 1; y < height; y++) {
+            std::memcpy(data + y * width * 2, data, width * 2);
+        }
+        return;
+    }
+
+    // NV12, NV16 and I420 share the luma plane
+    uint8_t* luma = data;
+    uint8_t* chroma = data + width * height;
+    for (uint32_t x = 0; x < width; x++) {
+        luma[x] = BgrToYuv(kBars[bar_of(x)]).y;
+    }
+    for (uint32_t y = 1; y < height; y++) {
+        std::memcpy(luma + y * width, luma, width);
+    }
+
+    const auto chroma_width = width / 2;
+    // NV16 keeps chroma at full height
+    const auto chroma_height = info_.pixelformat.compare("NV16") == 0 ? height : height / 2;
+    if (info_.pixelformat.compare("NV12") == 0 || info_.pixelformat.compare("NV16") == 0) {
+        for (uint32_t x = 0; x < chroma_width; x++) {
+            auto yuv = BgrToYuv(kBars[bar_of(x * 2)]);
+            chroma[x * 2] = yuv.u;
+            chroma[x * 2 + 1] = yuv.v;
+        }
+        for (uint32_t y = 1; y < chroma_height; y++) {
+            std::memcpy(chroma + y * width, chroma, width);
+        }
+    } else {
+        uint8_t* plane_u = chroma;
+        uint8_t* plane_v = chroma + chroma_width * chroma_height;
+        for (uint32_t x = 0; x < chroma_width; x++) {
+            auto yuv = BgrToYuv(kBars[bar_of(x * 2)]);
+            plane_u[x] = yuv.u;
+            plane_v[x] = yuv.v;
+        }
+        for (uint32_t y = 1; y < chroma_height; y++) {
+            std::memcpy(plane_u + y * chroma_width, plane_u, chroma_width);
+            std::memcpy(plane_v + y * chroma_width, plane_v, chroma_width);
+        }
+    }
+}
+
+bool PatternCapture::Init(void)
+{
+    if (info_.width == 0 || info_.height == 0 || info_.buf_count <= 0) {
+        spdlog::error("Pattern size error {}x{} bufs {}", info_.width, info_.height, info_.buf_count);
+        return false;
+    }
+    frame_size_ = CaptureFrameSize(info_.pixelformat, info_.width, info_.height);
+    if (frame_size_ == 0) {
+        return false;
+    }
+
+    frames_.resize(info_.buf_count);
+    for (int i = 0; i < info_.buf_count; i++) {
+        frames_[i].resize(frame_size_);
+        Render(frames_[i].data(), info_.width / info_.buf_count * i);
+    }
+
+    video_info_.width = info_.width;
+    video_info_.height = info_.height;
+    video_info_.pixelformat = info_.pixelformat;
+    video_info_.num_planes = 1;
+    video_info_.sizeimage = { frame_size_ };
+    video_info_.bytesperline = { CaptureLineSize(info_.pixelformat, info_.width) };
+    video_info_.colorspace = "V4L2_COLORSPACE_SMPTE170M";
+    frame_index_ = 0;
+
+    spdlog::info("Pattern {} {}x{} fps {}", info_.pixelformat, info_.width, info_.height, fps_);
+    is_running_ = true;
+    return true;
+}
+
+bool PatternCapture::NextFrame(PlaneData& frame)
+{
+    auto& data = frames_[frame_index_];
+    frame_index_ = (frame_index_ + 1) % frames_.size();
+    frame.start = data.data();
+    frame.size = frame_size_;
+    return true;
+}
+
+void PatternCapture::Deinit(void)
+{
+    is_running_ = false;
+    // nothing is freed under a consumer, the next Deinit tries again
+    if (!WaitFramesReturned(1000)) {
+        return;
+    }
+    frames_.clear();
+}
@@ -0,0 +1,539 @@
+#include "Pipeline.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "FrameChain.h"
+#include "FrameTracer.h"
+#include "ThreadPlacement.h"
+
+Pipeline::Pipeline(const PipelineConfig& config, StreamServer& server, MetricsRegistry& registry,
+    CaptureReactor* reactor)
+    : config_(config)
+    , server_(server)
+    , registry_(registry)
+    , reactor_(reactor)
+{
+    for (auto& output_config : config_.Outputs()) {
+        auto output = std::make_unique<Output>();
+        output->config = output_config;
+        output->name = outputs_.empty() ? config_.name : config_.name + "/" + output_config.stream_id;
+        output->packets.SetMetrics(&output->metrics);
+        output->metrics.trace_stream = FrameTracer::Instance().Stream(config_.app + "/" + output_config.stream_id);
+        registry_.Register(config_.app + "/" + output_config.stream_id, &output->metrics);
+        outputs_.push_back(std::move(output));
+    }
+
+    snapshot_ = std::make_shared<Snapshot>(config_.snapshot, config_.encoder, config_.name);
+    snapshot_->SetMetrics(&outputs_.front()->metrics);
+    snapshot_->Start();
+    // the handler may run on after the pipeline is gone, it holds the snapshot
+    server_.AddHttpHandler(SnapshotPath(), [snapshot = snapshot_](const std::string&, const HttpResponder& respond) {
+        snapshot->Request([respond](std::shared_ptr<const std::string> jpeg) {
+            HttpResponse response;
+            if (jpeg) {
+                response.content_type = "image/jpeg";
+                response.body = *jpeg;
+            } else {
+                response.code = 503;
+                response.body = "no frame";
+            }
+            respond(response);
+        });
+    });
+}
+
+Pipeline::~Pipeline(void)
+{
+    server_.RemoveHttpHandler(SnapshotPath());
+    Stop();
+    snapshot_->Stop();
+    for (auto& output : outputs_) {
+        registry_.Unregister(&output->metrics);
+    }
+}
+
+std::string Pipeline::SnapshotPath(void) const
+{
+    return "/snapshot/" + config_.app + "/" + config_.stream_id + ".jpg";
+}
+
+void Pipeline::UpdatePaused(void)
+{
+    // the gates and the snapshot call in from their own threads
+    std::lock_guard<std::mutex> lock(pause_mutex_);
+    bool active = snapshot_->Wanted();
+    for (auto& output : outputs_) {
+        active = active || output->gate->Active();
+    }
+    capture_->SetPaused(!active);
+}
+
+void Pipeline::Start(void)
+{
+    if (thread_.joinable()) {
+        return;
+    }
+    running_ = true;
+    done_ = false;
+    thread_ = std::thread(&Pipeline::Run, this);
+}
+
+void Pipeline::Stop(void)
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = false;
+    // a capture loop entered right after a Stop would run on, stop it until the thread is out
+    while (!done_) {
+        if (capture_) {
+            capture_->Stop();
+        }
+        stop_cv_.notify_all();
+        stop_cv_.wait_for(lock, std::chrono::milliseconds(50));
+    }
+    lock.unlock();
+    thread_.join();
+}
+
+bool Pipeline::WaitRetry(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_cv_.wait_for(lock, std::chrono::milliseconds(config_.retry_ms), [this]() { return !running_; });
+    return running_;
+}
+
+void Pipeline::Run(void)
+{
+    // this thread runs the capture loop, or waits while the reactor dequeues
+    ThreadPlacement::Instance().Apply(ThreadRole::Capture, "cap " + config_.name);
+    auto has_encoders = [this]() {
+        return std::all_of(outputs_.begin(), outputs_.end(), [](auto& output) { return output->encoder != nullptr; });
+    };
+    while (running_) {
+        if (!Open()) {
+            spdlog::warn("[{}] open failed, retry in {} ms", config_.name, config_.retry_ms);
+            Close();
+            if (!WaitRetry()) {
+                break;
+            }
+            continue;
+        }
+
+        StartEncoding();
+
+        // blocks until Stop, false if the device went away
+        bool ok = capture_->Setup([this](FrameRef frame) {
+            newest_capture_us_.store(frame->meta.timestamp_us, std::memory_order_relaxed);
+            snapshot_->Offer(frame);
+            // every output references the same buffer, the last one takes the capture's reference
+            auto in_flight = capture_->InFlight();
+            for (size_t i = 0; i + 1 < outputs_.size(); i++) {
+                outputs_[i]->queue->Push(frame, in_flight);
+            }
+            outputs_.back()->queue->Push(std::move(frame), in_flight);
+        });
+        // without an encoder (a source change it could not follow) everything is opened again
+        while (!ok && running_ && has_encoders()) {
+            spdlog::warn("[{}] capture failed, reset in {} ms", config_.name, config_.retry_ms);
+            if (!WaitRetry()) {
+                break;
+            }
+            ok = capture_->Reset();
+        }
+
+        StopEncoding();
+        Close();
+        if (!ok && !WaitRetry()) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    stop_cv_.notify_all();
+}
+
+bool Pipeline::Open(void)
+{
+    auto source_info = config_.source;
+    // the capture negotiates the cheapest format every encoder takes
+    source_info.formats = VideoEncoderFormats(config_.encoder);
+    for (auto& output : outputs_) {
+        auto formats = VideoEncoderFormats(output->config.encoder);
+        source_info.formats.erase(std::remove_if(source_info.formats.begin(), source_info.formats.end(),
+                                      [&](const std::string& format) {
+                                          return std::find(formats.begin(), formats.end(), format) == formats.end();
+                                      }),
+            source_info.formats.end());
+    }
+    // sub-streams scale NV12 only
+    bool scaled = std::any_of(
+        outputs_.begin(), outputs_.end(), [](auto& output) { return output->config.scale.Enabled(); });
+    if (scaled) {
+        source_info.formats.erase(std::remove_if(source_info.formats.begin(), source_info.formats.end(),
+                                      [](const std::string& format) { return format != "NV12"; }),
+            source_info.formats.end());
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return false;
+        }
+        capture_ = CreateCaptureSource(source_info);
+    }
+    if (!capture_) {
+        return false;
+    }
+    capture_->SetMetrics(&outputs_.front()->metrics);
+    capture_->SetReactor(reactor_);
+    if (!capture_->Init()) {
+        return false;
+    }
+    CaptureVideoInfo cap_info;
+    if (!capture_->GetVideoInfo(cap_info)) {
+        return false;
+    }
+    FrameInfo frame_info;
+    if (!PrepareFrames(cap_info, frame_info)) {
+        return false;
+    }
+
+    // capture thread only dequeues, the encode threads own PutFrame stalls. A
+    // driver buffer is always left for the next frame
+    auto queue_info = config_.queue;
+    auto buf_count = source_info.buf_count;
+    if (queue_info.capacity == 0) {
+        queue_info.capacity = buf_count > 2 ? buf_count - 2 : 1;
+    }
+    if (queue_info.max_in_flight == 0) {
+        queue_info.max_in_flight = buf_count > 1 ? buf_count - 1 : 0;
+    }
+    for (auto& output : outputs_) {
+        if (!OpenOutput(*output, frame_info, queue_info)) {
+            return false;
+        }
+    }
+
+    if (config_.demand.keepalive_fps == 0) {
+        UpdatePaused();
+        for (auto& output : outputs_) {
+            output->gate->SetStateCallback([this](bool active) { UpdatePaused(); });
+        }
+        // a snapshot of an idle input resumes the capture for a frame
+        snapshot_->SetWantedCallback([this](bool wanted) { UpdatePaused(); });
+    }
+    // the sinks and their players stay, only the frame path follows the source
+    capture_->SetFormatCallback([this](const CaptureVideoInfo& info) { return Reformat(info); });
+    return true;
+}
+
+bool Pipeline::OpenOutput(Output& output, const FrameInfo& frame_info, const FrameQueueInfo& queue_info)
+{
+    FrameInfo output_info;
+    if (!PrepareScaler(output, frame_info, output_info)) {
+        return false;
+    }
+
+    // nothing is encoded while nobody watches, the first player gets an IDR right away
+    output.gate = std::make_unique<DemandGate>(config_.demand);
+    output.gate->SetMetrics(&output.metrics);
+
+    StreamSinkInfo sink_info;
+    sink_info.app = config_.app;
+    sink_info.stream_id = output.config.stream_id;
+    sink_info.height = output_info.height;
+    sink_info.width = output_info.width;
+    sink_info.fps = output_info.fps;
+    sink_info.stream_type = output.config.stream.StreamType;
+    sink_info.timeshift = output.config.timeshift;
+    output.sink = server_.CreateSink(sink_info);
+    output.sink->SetMetrics(&output.metrics);
+    output.sink->SetDemandGate(output.gate.get());
+    if (!output.sink->Init()) {
+        return false;
+    }
+    // new players get an IDR instead of waiting up to a gop, the encode
+    // thread asks, the encoder may be replaced on a source change
+    auto idr_requested = &output.idr_requested;
+    output.sink->SetJoinCallback([idr_requested] { idr_requested->store(true, std::memory_order_release); });
+
+    NalCodec codec;
+    if (!ParseNalCodec(output.config.stream.StreamType, codec)) {
+        return false;
+    }
+    // each packet is parsed once, the sink and the recorder share the result
+    output.parser = std::make_unique<NalParser>(codec);
+
+    if (!output.config.record.path.empty()) {
+        // outputs recording to one directory keep apart by name
+        auto name = &output == outputs_.front().get() ? config_.name : config_.name + "-" + output.config.stream_id;
+        output.recorder = std::make_unique<Recorder>(output.config.record, codec, name);
+        output.recorder->SetMetrics(&output.metrics);
+        if (!output.recorder->Start()) {
+            return false;
+        }
+    }
+
+    if (!OpenEncoder(output, output_info)) {
+        return false;
+    }
+    output.queue = std::make_unique<FrameQueue>(queue_info);
+    output.queue->SetMetrics(&output.metrics);
+    return true;
+}
+
+bool Pipeline::PrepareFrames(const CaptureVideoInfo& cap_info, FrameInfo& frame_info)
+{
+    frame_info.format = cap_info.pixelformat;
+    frame_info.fps = config_.fps;
+    frame_info.height = cap_info.height;
+    frame_info.width = cap_info.width;
+    // dma frames are encoded in place, the encoder follows the capture layout
+    if (!cap_info.bytesperline.empty()) {
+        frame_info.hor_stride = cap_info.bytesperline[0];
+        frame_info.ver_stride = cap_info.height;
+    }
+    // snapshots are taken ahead of the converter
+    snapshot_->SetFrameInfo(frame_info);
+    spdlog::info("[{}] capture {} {}x{} stride {}", config_.name, frame_info.format, frame_info.width,
+        frame_info.height, frame_info.hor_stride);
+
+    // BGR24 only sources are converted to NV12 before the encoder, half the bytes to move and encode.
+    // Several encoders read the same BGR24 buffer instead of converting it each
+    converter_.reset();
+    if (frame_info.format == "BGR24" && outputs_.size() == 1) {
+        converter_ = std::make_unique<ColorConverter>(frame_info.width, frame_info.height, frame_info.hor_stride);
+        if (!converter_->Init()) {
+            return false;
+        }
+        frame_info.format = "NV12";
+        frame_info.hor_stride = converter_->Stride();
+        frame_info.ver_stride = frame_info.height;
+    }
+    // three frame periods from capture to the media source
+    for (auto& output : outputs_) {
+        output->metrics.late_threshold_us = 3 * 1000000 / frame_info.fps;
+    }
+    return true;
+}
+
+bool Pipeline::PrepareScaler(Output& output, const FrameInfo& frame_info, FrameInfo& output_info)
+{
+    output_info = frame_info;
+    output.scaler.reset();
+    auto& scale = output.config.scale;
+    if (!scale.Enabled()) {
+        return true;
+    }
+    if (frame_info.format != "NV12") {
+        spdlog::error("[{}] sub-stream needs NV12 frames, capture gives {}", output.name, frame_info.format);
+        return false;
+    }
+
+    uint32_t width = scale.divisor != 0 ? frame_info.width / scale.divisor & ~1U : scale.width;
+    uint32_t height = scale.divisor != 0 ? frame_info.height / scale.divisor & ~1U : scale.height;
+    // box only fits a half or a quarter of the capture
+    auto filter = scale.filter;
+    uint32_t factor = frame_info.width / std::max<uint32_t>(width, 1);
+    if ((factor != 2 && factor != 4) || (frame_info.width / factor & ~1U) != width
+        || (frame_info.height / factor & ~1U) != height) {
+        filter = ScaleFilter::Bilinear;
+    }
+    output.scaler = std::make_unique<FrameScaler>(frame_info.width, frame_info.height, frame_info.hor_stride,
+        frame_info.ver_stride, width, height, filter);
+    if (!output.scaler->Init()) {
+        output.scaler.reset();
+        return false;
+    }
+    output_info.width = width;
+    output_info.height = height;
+    output_info.hor_stride = output.scaler->Stride();
+    output_info.ver_stride = height;
+    return true;
+}
+
+bool Pipeline::OpenEncoder(Output& output, const FrameInfo& frame_info)
+{
+    auto lag = [this, &output](uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit) {
+        auto newest_us = newest_capture_us_.load(std::memory_order_relaxed);
+        output.metrics.encode_lag_ms.Set(newest_us > meta.timestamp_us ? (newest_us - meta.timestamp_us) / 1000 : 0);
+    };
+    // the sink and the recorder of an output are fixed while it is open, the
+    // fanout calls them directly, the encoder's callback is its one std::function
+    PacketFanout fanout(
+        *output.parser, lag, SinkStage { *output.sink }, RecordStage { output.recorder.get(), output.packets });
+    auto package_callback = fanout.Callback();
+    auto& stream = output.config.stream;
+    output.encoder = CreateVideoEncoder(output.config.encoder, frame_info, stream, 10);
+    output.encoder->SetMetrics(&output.metrics);
+    if (!output.encoder->Init(package_callback)) {
+        if (output.config.encoder != VideoEncoderType::Mpp) {
+            return false;
+        }
+        // no VPU (x86 dev machine) or no free encoder channel
+        spdlog::warn("[{}] Mpp encoder unavailable, falling back to libavcodec", output.name);
+        output.encoder = CreateVideoEncoder(VideoEncoderType::Av, frame_info, stream);
+        output.encoder->SetMetrics(&output.metrics);
+        if (!output.encoder->Init(package_callback)) {
+            return false;
+        }
+    }
+
+    // a burst of joins costs one IDR per interval
+    output.encoder->SetIdrInterval(config_.idr_interval_ms);
+    std::vector<uint8_t> parameter_sets;
+    if (output.encoder->GetParameterSets(parameter_sets)) {
+        output.sink->SetParameterSets(parameter_sets);
+        if (output.recorder) {
+            output.recorder->SetParameterSets(parameter_sets);
+        }
+    }
+    return true;
+}
+
+bool Pipeline::Reformat(const CaptureVideoInfo& cap_info)
+{
+    // every frame is back from the encoders, the encode threads idle in Pop
+    StopEncoding();
+    // converted frames belong to the converter, an encoder still holding some goes first
+    if (converter_) {
+        outputs_.front()->encoder.reset();
+    }
+
+    FrameInfo frame_info;
+    if (!PrepareFrames(cap_info, frame_info)) {
+        for (auto& output : outputs_) {
+            output->encoder.reset();
+        }
+        return false;
+    }
+    for (auto& output : outputs_) {
+        // scaled frames belong to the scaler, its encoder goes before it is replaced
+        if (output->scaler) {
+            output->encoder.reset();
+        }
+        FrameInfo output_info;
+        if (!PrepareScaler(*output, frame_info, output_info)) {
+            output->encoder.reset();
+            return false;
+        }
+        if (output->encoder && output->encoder->Reconfigure(output_info)) {
+            spdlog::info("[{}] encoder reconfigured for {}x{}", output->name, frame_info.width, frame_info.height);
+            std::vector<uint8_t> parameter_sets;
+            if (output->encoder->GetParameterSets(parameter_sets)) {
+                output->sink->SetParameterSets(parameter_sets);
+                if (output->recorder) {
+                    output->recorder->SetParameterSets(parameter_sets);
+                }
+            }
+            continue;
+        }
+        // packets of the old encoder are out before the new one starts
+        output->encoder.reset();
+        if (!OpenEncoder(*output, output_info)) {
+            output->encoder.reset();
+            return false;
+        }
+    }
+
+    StartEncoding();
+    return true;
+}
+
+void Pipeline::StartEncoding(void)
+{
+    for (auto& output : outputs_) {
+        output->encoding = true;
+        output->encode_thread = std::thread(&Pipeline::Encode, this, std::ref(*output));
+    }
+}
+
+void Pipeline::StopEncoding(void)
+{
+    for (auto& output : outputs_) {
+        output->encoding = false;
+    }
+    for (auto& output : outputs_) {
+        if (output->encode_thread.joinable()) {
+            output->encode_thread.join();
+        }
+    }
+}
+
+void Pipeline::Close(void)
+{
+    snapshot_->SetWantedCallback(nullptr);
+    for (auto& output : outputs_) {
+        // joins the packet thread (mpp EncRecvThread), packets of frames already
+        // submitted still reach the sink and the recorder until then
+        output->encoder.reset();
+        output->scaler.reset();
+        // the segment is closed with what was queued, its packets go back to the pool
+        output->recorder.reset();
+        output->parser.reset();
+        // queued frames hold capture buffers
+        if (output->queue) {
+            FrameRef frame;
+            while (output->queue->Pop(frame, 0)) {
+                frame = FrameRef();
+            }
+            output->queue.reset();
+        }
+    }
+    // nothing sends any more, the players go before their gates below
+    for (auto& output : outputs_) {
+        output->sink.reset();
+    }
+    converter_.reset();
+    // the snapshot thread may be encoding a capture buffer
+    snapshot_->DropFrame();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capture_.reset();
+    }
+    for (auto& output : outputs_) {
+        output->gate.reset();
+    }
+}
+
+void Pipeline::Encode(Output& output)
+{
+    ThreadPlacement::Instance().Apply(ThreadRole::Encode, "enc " + output.name);
+    FrameRef frame;
+    while (output.encoding) {
+        if (!output.queue->Pop(frame, 100000)) {
+            continue;
+        }
+        bool idr;
+        if (!output.gate->Admit(MonotonicUs(), idr)) {
+            frame = FrameRef();
+            continue;
+        }
+        if (idr || output.idr_requested.exchange(false, std::memory_order_acq_rel)) {
+            output.encoder->ForceIdr();
+        }
+        if (converter_) {
+            // the capture buffer goes back as soon as it is converted
+            frame = converter_->Convert(frame);
+            if (!frame) {
+                continue;
+            }
+        }
+        if (output.scaler) {
+            // same for the scaler, every output scales its own copy
+            auto start_us = MonotonicUs();
+            frame = output.scaler->Scale(frame);
+            if (!frame) {
+                output.metrics.scale_dropped.Add();
+                continue;
+            }
+            output.metrics.scale.Observe(MonotonicUs() - start_us);
+        }
+        output.encoder->PutFrame(std::move(frame));
+    }
+}
@@ -0,0 +1,411 @@
+#include "Recorder.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace {
+
+// O_DIRECT alignment of buffers, offsets and lengths
+constexpr uint32_t kAlign = 4096;
+// writes in flight with io_uring, the memory on top of max_buffer_bytes
+constexpr size_t kWriteBuffers = 4;
+
+uint32_t AlignUp(uint32_t size)
+{
+    return (size + kAlign - 1) / kAlign * kAlign;
+}
+
+} // namespace
+
+Recorder::Recorder(const RecordInfo& info, NalCodec codec, const std::string& name)
+    : info_(info)
+    , name_(name)
+    , parser_(codec)
+    , muxer_(codec)
+{
+    info_.write_bytes = AlignUp(std::max<uint32_t>(info_.write_bytes, kAlign));
+}
+
+Recorder::~Recorder(void)
+{
+    Stop();
+}
+
+bool Recorder::Start(void)
+{
+    if (thread_.joinable()) {
+        return true;
+    }
+    if (mkdir(info_.path.c_str(), 0755) < 0 && errno != EEXIST) {
+        spdlog::error("Can not create record directory {}: {}", info_.path, strerror(errno));
+        return false;
+    }
+    buffers_.resize(kWriteBuffers);
+    for (auto& buffer : buffers_) {
+        buffer.data = static_cast<uint8_t*>(std::aligned_alloc(kAlign, info_.write_bytes));
+        if (buffer.data == nullptr) {
+            spdlog::error("Record buffer allocation failed");
+            return false;
+        }
+    }
+    current_ = 0;
+
+#ifdef HAVE_LIBURING
+    ring_ = new io_uring;
+    auto ret = io_uring_queue_init(kWriteBuffers, ring_, 0);
+    if (ret < 0) {
+        // e.g. disabled by the kernel or a seccomp profile
+        spdlog::info("io_uring unavailable ({}), recording with pwrite", strerror(-ret));
+        delete ring_;
+        ring_ = nullptr;
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = true;
+    }
+    thread_ = std::thread(&Recorder::Run, this);
+    spdlog::info("Recording {} to {}, {} s segments, {}", name_, info_.path, info_.segment_ms / 1000,
+        ring_ != nullptr ? "io_uring" : "pwrite");
+    return true;
+}
+
+void Recorder::Stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+#ifdef HAVE_LIBURING
+    if (ring_ != nullptr) {
+        io_uring_queue_exit(ring_);
+        delete ring_;
+        ring_ = nullptr;
+    }
+#endif
+    for (auto& buffer : buffers_) {
+        std::free(buffer.data);
+    }
+    buffers_.clear();
+}
+
+void Recorder::SetParameterSets(const std::vector<uint8_t>& parameter_sets)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    next_parameter_sets_ = parameter_sets;
+    has_next_parameter_sets_ = true;
+}
+
+void Recorder::Push(PacketRef packet)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        if (skip_to_key_ && !packet->key) {
+            if (dropping_ && metrics_ != nullptr) {
+                metrics_->record_dropped.Add();
+            }
+            return;
+        }
+        if (queued_bytes_ + packet->size > info_.max_buffer_bytes) {
+            if (!dropping_) {
+                spdlog::warn("Recorder {} falls behind, {} bytes queued, dropping to the next key frame", name_,
+                    queued_bytes_);
+            }
+            skip_to_key_ = true;
+            dropping_ = true;
+            if (metrics_ != nullptr) {
+                metrics_->record_dropped.Add();
+            }
+            return;
+        }
+        skip_to_key_ = false;
+        dropping_ = false;
+        queued_bytes_ += packet->size;
+        // the packet stays in its pool buffer until written
+        packets_.push_back(std::move(packet));
+        if (metrics_ != nullptr) {
+            metrics_->record_queued_bytes.Set(queued_bytes_);
+        }
+    }
+    cv_.notify_one();
+}
+
+void Recorder::Run(void)
+{
+    std::deque<PacketRef> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !packets_.empty() || !running_; });
+            if (packets_.empty()) {
+                break;
+            }
+            batch.swap(packets_);
+            if (has_next_parameter_sets_) {
+                parameter_sets_.swap(next_parameter_sets_);
+                has_next_parameter_sets_ = false;
+            }
+        }
+
+        // a batch smaller than write_bytes waits in the write buffer for the next one
+        uint64_t bytes = 0;
+        for (auto& packet : batch) {
+            WritePacket(*packet);
+            bytes += packet->size;
+        }
+        Reap(false);
+        // back to the pool before the lock
+        batch.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_bytes_ -= bytes;
+        if (metrics_ != nullptr) {
+            metrics_->record_queued_bytes.Set(queued_bytes_);
+        }
+    }
+    CloseSegment();
+}
+
+void Recorder::WritePacket(const EncodedPacket& packet)
+{
+    auto& meta = packet.meta;
+    const uint8_t* data = packet.data;
+    uint32_t size = packet.size;
+    if (packet.has_parameter_sets) {
+        parameter_sets_.clear();
+        for (auto& nal : parser_.Parse(data, size).nals) {
+            if (IsParameterSet(parser_.Codec(), nal.type)) {
+                parameter_sets_.insert(parameter_sets_.end(), nal.data, nal.data + nal.size);
+            }
+        }
+    } else if (packet.key && !parameter_sets_.empty()) {
+        // every segment starts with a key frame, it carries the parameter sets
+        joined_.assign(parameter_sets_.begin(), parameter_sets_.end());
+        joined_.insert(joined_.end(), data, data + size);
+        data = joined_.data();
+        size = joined_.size();
+    }
+
+    ts_.clear();
+    if (packet.key
+        && (fd_ < 0 || write_error_ || meta.timestamp_us - segment_start_us_ >= info_.segment_ms * 1000ULL)) {
+        CloseSegment();
+        if (OpenSegment()) {
+            segment_start_us_ = meta.timestamp_us;
+            muxer_.WriteTables(ts_);
+        }
+    }
+    // no segment or the disk failed, lost up to the next segment
+    if (fd_ < 0 || write_error_) {
+        if (metrics_ != nullptr) {
+            metrics_->record_dropped.Add();
+        }
+        return;
+    }
+
+    if (!has_base_) {
+        base_us_ = meta.timestamp_us;
+        has_base_ = true;
+    }
+    auto since_us = meta.timestamp_us > base_us_ ? meta.timestamp_us - base_us_ : 0;
+    auto pts = since_us * 9 / 100 + TsMuxer::kPcrDelay90k;
+    muxer_.WriteAccessUnit(data, size, pts, packet.key, ts_);
+    Append(ts_.data(), ts_.size());
+    if (metrics_ != nullptr) {
+        metrics_->record_packets.Add();
+    }
+}
+
+bool Recorder::OpenSegment(void)
+{
+    char stamp[32];
+    auto now = std::time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    // the index keeps segments cut within one second apart
+    segment_path_ = fmt::format("{}/{}-{}-{}.ts", info_.path, name_, stamp, segment_index_++);
+
+    fd_ = ::open(segment_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    direct_ = fd_ >= 0;
+    if (fd_ < 0 && errno == EINVAL) {
+        // tmpfs and a few others refuse O_DIRECT
+        fd_ = ::open(segment_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd_ < 0) {
+        spdlog::error("Can not open segment {}: {}", segment_path_, strerror(errno));
+        return false;
+    }
+    file_offset_ = 0;
+    file_size_ = 0;
+    write_error_ = false;
+    if (metrics_ != nullptr) {
+        metrics_->record_segments.Add();
+    }
+    spdlog::info("Recording {}{}", segment_path_, direct_ ? "" : " (buffered)");
+    return true;
+}
+
+void Recorder::CloseSegment(void)
+{
+    if (fd_ < 0) {
+        return;
+    }
+    Submit();
+    for (auto& buffer : buffers_) {
+        while (buffer.busy) {
+            Reap(true);
+        }
+    }
+    // the padding of the last O_DIRECT write goes
+    if (direct_ && ftruncate(fd_, file_size_) < 0) {
+        spdlog::error("Truncate segment {} error {}", segment_path_, strerror(errno));
+    }
+    if (fdatasync(fd_) < 0) {
+        spdlog::error("Sync segment {} error {}", segment_path_, strerror(errno));
+    }
+    ::close(fd_);
+    fd_ = -1;
+    spdlog::info("Recorded {}, {} bytes", segment_path_, file_size_);
+}
+
+void Recorder::Append(const uint8_t* data, uint32_t size)
+{
+    while (size > 0) {
+        auto& buffer = buffers_[current_];
+        auto take = std::min(size, info_.write_bytes - buffer.size);
+        std::memcpy(buffer.data + buffer.size, data, take);
+        buffer.size += take;
+        data += take;
+        size -= take;
+        if (buffer.size == info_.write_bytes) {
+            Submit();
+        }
+    }
+}
+
+void Recorder::Submit(void)
+{
+    auto& buffer = buffers_[current_];
+    if (buffer.size == 0) {
+        return;
+    }
+    if (write_error_) {
+        buffer.size = 0;
+        return;
+    }
+    buffer.length = buffer.size;
+    if (direct_ && buffer.length % kAlign != 0) {
+        // only the last write of a segment, truncated when it closes
+        buffer.length = AlignUp(buffer.size);
+        std::memset(buffer.data + buffer.size, 0, buffer.length - buffer.size);
+    }
+    buffer.submit_us = MonotonicUs();
+
+    bool queued = false;
+#ifdef HAVE_LIBURING
+    if (ring_ != nullptr) {
+        auto sqe = io_uring_get_sqe(ring_);
+        if (sqe != nullptr) {
+            io_uring_prep_write(sqe, fd_, buffer.data, buffer.length, file_offset_);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(current_));
+            auto ret = io_uring_submit(ring_);
+            if (ret < 0) {
+                WriteFailed(-ret);
+            } else {
+                buffer.busy = true;
+            }
+            queued = true;
+        }
+    }
+#endif
+    if (!queued) {
+        uint32_t written = 0;
+        while (written < buffer.length) {
+            auto ret = pwrite(fd_, buffer.data + written, buffer.length - written, file_offset_ + written);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                WriteFailed(ret < 0 ? errno : EIO);
+                break;
+            }
+            written += ret;
+        }
+        if (metrics_ != nullptr) {
+            metrics_->record_write.Observe(MonotonicUs() - buffer.submit_us);
+        }
+    }
+    if (metrics_ != nullptr) {
+        metrics_->record_bytes.Add(buffer.size);
+    }
+    file_offset_ += buffer.length;
+    file_size_ += buffer.size;
+    buffer.size = 0;
+
+    // the next buffer may still be on its way to the disk
+    current_ = (current_ + 1) % buffers_.size();
+    while (buffers_[current_].busy) {
+        Reap(true);
+    }
+}
+
+void Recorder::Reap(bool wait)
+{
+#ifdef HAVE_LIBURING
+    if (ring_ == nullptr) {
+        return;
+    }
+    io_uring_cqe* cqe = nullptr;
+    while ((wait ? io_uring_wait_cqe(ring_, &cqe) : io_uring_peek_cqe(ring_, &cqe)) == 0) {
+        auto& buffer = buffers_[reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe))];
+        if (cqe->res < 0) {
+            WriteFailed(-cqe->res);
+        } else if ((uint32_t)cqe->res != buffer.length) {
+            // regular files do not write short unless the disk is full
+            WriteFailed(ENOSPC);
+        }
+        if (metrics_ != nullptr) {
+            metrics_->record_write.Observe(MonotonicUs() - buffer.submit_us);
+        }
+        buffer.busy = false;
+        io_uring_cqe_seen(ring_, cqe);
+        wait = false;
+    }
+#else
+    (void)wait;
+#endif
+}
+
+void Recorder::WriteFailed(int error)
+{
+    if (!write_error_) {
+        spdlog::error("Write segment {} error {}, dropping to the next segment", segment_path_, strerror(error));
+    }
+    write_error_ = true;
+    if (metrics_ != nullptr) {
+        metrics_->record_write_errors.Add();
+    }
+}
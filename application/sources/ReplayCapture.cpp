@@ -0,0 +1,155 @@
+#include "ReplayCapture.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "FrameTracer.h"
+
+ReplayCapture::ReplayCapture(uint32_t fps, int buf_count)
+    : fps_(fps)
+    , slots_(std::max(buf_count, 1))
+{
+    for (size_t i = 0; i < slots_.size(); i++) {
+        slots_[i].index = i;
+        slots_[i].planes.resize(1);
+        slots_[i].owner = this;
+    }
+}
+
+bool ReplayCapture::GetVideoInfo(CaptureVideoInfo& info)
+{
+    info = video_info_;
+    return true;
+}
+
+bool ReplayCapture::Loop(const std::function<void(FrameRef)>& callback)
+{
+    callback_ = callback;
+    using clock = std::chrono::steady_clock;
+    const auto period = fps_ == 0 ? clock::duration::zero()
+                                  : std::chrono::duration_cast<clock::duration>(std::chrono::seconds(1)) / fps_;
+    auto next_time = clock::now();
+
+    while (is_running_) {
+        if (Paused()) {
+            WaitWhilePaused(is_running_);
+            next_time = clock::now();
+            continue;
+        }
+
+        // like a driver running out of buffers, wait for consumers to give one back
+        auto& slot = slots_[slot_index_];
+        if (slot.refcount.load(std::memory_order_acquire) != 0) {
+            std::unique_lock<std::mutex> lock(release_mutex_);
+            // bounded, a pause request has no release to wake it
+            release_cond_.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+                return slot.refcount.load(std::memory_order_acquire) == 0 || !is_running_;
+            });
+            continue;
+        }
+        slot_index_ = (slot_index_ + 1) % slots_.size();
+
+        if (!NextFrame(slot.planes[0])) {
+            spdlog::info("Replay end of stream");
+            break;
+        }
+        slot.meta.sequence = sequence_++;
+        slot.meta.timestamp_us = MonotonicUs();
+        if (metrics_ != nullptr) {
+            metrics_->FrameCaptured(slot.meta.timestamp_us);
+        }
+
+        auto sequence = slot.meta.sequence;
+        auto callback_start_us = slot.meta.timestamp_us;
+        callback(FrameRef::Adopt(&slot));
+        if (metrics_ != nullptr) {
+            auto callback_end_us = MonotonicUs();
+            metrics_->callback.Observe(callback_end_us - callback_start_us);
+            FrameTracer::Record(TraceSpan::Callback, metrics_->trace_stream, sequence, callback_start_us, callback_end_us);
+        }
+
+        if (fps_ != 0) {
+            next_time += period;
+            auto now = clock::now();
+            if (next_time < now) {
+                // too slow, do not try to catch up with a burst
+                next_time = now;
+            } else {
+                std::this_thread::sleep_until(next_time);
+            }
+        }
+    }
+    return true;
+}
+
+bool ReplayCapture::Setup(const std::function<void(PlaneData&, int dma_fd)>& callback)
+{
+    return Loop([callback](FrameRef frame) {
+        callback(frame->planes[0], frame->dma_fd);
+    });
+}
+
+bool ReplayCapture::Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback)
+{
+    return Loop([callback](FrameRef frame) {
+        callback(frame->planes, frame->dma_fd);
+    });
+}
+
+bool ReplayCapture::Setup(const std::function<void(FrameRef)>& callback)
+{
+    return Loop(callback);
+}
+
+void ReplayCapture::ReleaseFrame(VideoFrame& frame)
+{
+    std::lock_guard<std::mutex> lock(release_mutex_);
+    release_cond_.notify_all();
+}
+
+void ReplayCapture::Stop(void)
+{
+    is_running_ = false;
+    std::lock_guard<std::mutex> lock(release_mutex_);
+    release_cond_.notify_all();
+}
+
+bool ReplayCapture::WaitFramesReturned(uint32_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(release_mutex_);
+    if (!release_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return InFlight() == 0; })) {
+        spdlog::warn("{} frames still in flight", InFlight());
+        return false;
+    }
+    return true;
+}
+
+uint32_t ReplayCapture::InFlight(void) const
+{
+    uint32_t count = 0;
+    for (auto& slot : slots_) {
+        count += slot.refcount.load(std::memory_order_acquire) != 0;
+    }
+    return count;
+}
+
+bool ReplayCapture::Reset(void)
+{
+    // the caller backs off between attempts
+    Deinit();
+    if (InFlight() != 0) {
+        spdlog::warn("Reset replay later, its frames are still referenced");
+        return false;
+    }
+    if (!Init()) {
+        spdlog::error("Reset ReplayCapture failed");
+        return false;
+    }
+    if (callback_) {
+        return Loop(callback_);
+    }
+    return true;
+}
@@ -0,0 +1,303 @@
+#include "Snapshot.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+
+static inline bool SameLayout(const FrameInfo& a, const FrameInfo& b)
+{
+    return a.width == b.width && a.height == b.height && a.format == b.format && a.hor_stride == b.hor_stride
+        && a.ver_stride == b.ver_stride;
+}
+
+Snapshot::Snapshot(const SnapshotInfo& info, VideoEncoderType encoder, const std::string& name)
+    : info_(info)
+    , encoder_type_(encoder)
+    , name_(name)
+{
+}
+
+Snapshot::~Snapshot(void)
+{
+    Stop();
+}
+
+bool Snapshot::Start(void)
+{
+    if (thread_.joinable()) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = true;
+    }
+    thread_ = std::thread(&Snapshot::Run, this);
+    return true;
+}
+
+void Snapshot::Stop(void)
+{
+    std::vector<Waiter> waiters;
+    std::shared_ptr<const std::string> jpeg;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiters.swap(waiters_);
+        jpeg = cache_;
+        want_frame_ = false;
+        wanted_ = false;
+        frame_ = FrameRef();
+    }
+    for (auto& waiter : waiters) {
+        waiter.respond(jpeg);
+    }
+    encoder_.reset();
+}
+
+void Snapshot::SetFrameInfo(const FrameInfo& frame_info)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_info_ = frame_info;
+    has_frame_info_ = true;
+    // a jpeg of the old layout is not served for the new one
+    cache_.reset();
+}
+
+void Snapshot::DropFrame(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    frame_ = FrameRef();
+    encoding_cv_.wait(lock, [this]() { return !encoding_; });
+    // the next Offer is a frame of the new capture
+    want_frame_ = !waiters_.empty();
+}
+
+void Snapshot::SetWantedCallback(const std::function<void(bool wanted)>& callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    wanted_callback_ = callback;
+}
+
+void Snapshot::NotifyWanted(bool wanted)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (wanted_callback_) {
+        wanted_callback_(wanted);
+    }
+}
+
+void Snapshot::Offer(const FrameRef& frame)
+{
+    if (!want_frame_.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!want_frame_ || frame_ || !has_frame_info_) {
+        return;
+    }
+    frame_ = frame;
+    taken_info_ = frame_info_;
+    want_frame_ = false;
+    cv_.notify_one();
+}
+
+void Snapshot::Request(const Responder& respond)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    // the http handler may outlive the pipeline and its metrics
+    if (running_ && metrics_ != nullptr) {
+        metrics_->snapshot_requests.Add();
+    }
+    auto now_us = MonotonicUs();
+    // capture stamps are monotonic too
+    bool fresh = cache_ && now_us - std::min(now_us, cache_timestamp_us_) <= info_.max_age_ms * 1000ULL;
+    if (fresh || !running_) {
+        auto jpeg = cache_;
+        lock.unlock();
+        respond(jpeg);
+        return;
+    }
+    waiters_.push_back({ respond, now_us + info_.timeout_ms * 1000ULL });
+    // a frame being encoded already answers this one too
+    if (!encoding_ && !frame_) {
+        want_frame_ = true;
+    }
+    wanted_ = true;
+    cv_.notify_one();
+}
+
+void Snapshot::Run(void)
+{
+    // the state last passed to the wanted callback
+    bool notified = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (!waiters_.empty() && !notified) {
+            notified = true;
+            lock.unlock();
+            NotifyWanted(true);
+            lock.lock();
+            continue;
+        }
+
+        std::vector<Waiter> answered;
+        std::shared_ptr<const std::string> jpeg;
+        if (frame_) {
+            auto frame = std::move(frame_);
+            auto frame_info = taken_info_;
+            auto meta = frame->meta;
+            // sequences start over with the capture, a capture stamp is not reused
+            if (cache_ && meta.timestamp_us == cache_timestamp_us_) {
+                frame = FrameRef();
+            } else {
+                encoding_ = true;
+                lock.unlock();
+                jpeg = Encode(std::move(frame), frame_info);
+                lock.lock();
+                encoding_ = false;
+                encoding_cv_.notify_all();
+                if (jpeg) {
+                    cache_ = jpeg;
+                    cache_timestamp_us_ = meta.timestamp_us;
+                }
+            }
+            // a failed encode still answers, with the last jpeg
+            jpeg = cache_;
+            answered.swap(waiters_);
+        } else {
+            auto now_us = MonotonicUs();
+            auto expired = std::stable_partition(waiters_.begin(), waiters_.end(),
+                [now_us](const Waiter& waiter) { return waiter.deadline_us > now_us; });
+            answered.assign(std::make_move_iterator(expired), std::make_move_iterator(waiters_.end()));
+            waiters_.erase(expired, waiters_.end());
+            if (!answered.empty()) {
+                spdlog::warn("[{}] no frame for {} snapshot request(s) in {} ms", name_, answered.size(),
+                    info_.timeout_ms);
+                if (metrics_ != nullptr) {
+                    metrics_->snapshot_timeouts.Add(answered.size());
+                }
+                jpeg = cache_;
+            }
+        }
+
+        if (waiters_.empty()) {
+            want_frame_ = false;
+            wanted_ = false;
+        }
+        if (!answered.empty() || (waiters_.empty() && notified)) {
+            bool done = waiters_.empty() && notified;
+            if (done) {
+                notified = false;
+            }
+            lock.unlock();
+            for (auto& waiter : answered) {
+                waiter.respond(jpeg);
+            }
+            if (done) {
+                NotifyWanted(false);
+            }
+            lock.lock();
+            continue;
+        }
+
+        if (waiters_.empty()) {
+            cv_.wait(lock);
+        } else {
+            auto deadline_us = std::min_element(waiters_.begin(), waiters_.end(),
+                [](const Waiter& a, const Waiter& b) { return a.deadline_us < b.deadline_us; })->deadline_us;
+            auto now_us = MonotonicUs();
+            cv_.wait_for(lock, std::chrono::microseconds(deadline_us - std::min(deadline_us, now_us)));
+        }
+    }
+    // Stop answers whoever still waits
+    want_frame_ = false;
+    wanted_ = false;
+    lock.unlock();
+    if (notified) {
+        NotifyWanted(false);
+    }
+}
+
+bool Snapshot::OpenEncoder(const FrameInfo& frame_info)
+{
+    StreamInfo stream { "MJPEG", 1, 0 };
+    auto type = encoder_type_;
+    if (info_.width != 0 && info_.width < frame_info.width) {
+        stream.width = std::max<uint32_t>(info_.width & ~1U, 2);
+        stream.height = std::max<uint32_t>((uint64_t)frame_info.height * stream.width / frame_info.width & ~1ULL, 2);
+        // the VPU encodes what it gets, swscale does the scaling
+        type = VideoEncoderType::Av;
+    }
+
+    auto package_callback = [this](uint8_t* data, uint32_t size, const FrameMeta& meta) {
+        auto jpeg = std::make_shared<const std::string>((const char*)data, size);
+        std::lock_guard<std::mutex> lock(encoded_mutex_);
+        encoded_ = std::move(jpeg);
+        encoded_timestamp_us_ = meta.timestamp_us;
+        encoded_cv_.notify_all();
+    };
+    encoder_ = CreateVideoEncoder(type, frame_info, stream, 10);
+    if (!encoder_->Init(package_callback)) {
+        if (type != VideoEncoderType::Mpp) {
+            return false;
+        }
+        spdlog::warn("[{}] Mpp jpeg encoder unavailable, falling back to libavcodec", name_);
+        encoder_ = CreateVideoEncoder(VideoEncoderType::Av, frame_info, stream);
+        if (!encoder_->Init(package_callback)) {
+            return false;
+        }
+    }
+    encoder_info_ = frame_info;
+    spdlog::info("[{}] snapshot {}x{} -> {}x{}", name_, frame_info.width, frame_info.height,
+        stream.width != 0 ? stream.width : frame_info.width, stream.height != 0 ? stream.height : frame_info.height);
+    return true;
+}
+
+std::shared_ptr<const std::string> Snapshot::Encode(FrameRef frame, const FrameInfo& frame_info)
+{
+    // opened on the first request, again after a source change
+    if (!encoder_ || !SameLayout(encoder_info_, frame_info)) {
+        encoder_.reset();
+        if (!OpenEncoder(frame_info)) {
+            spdlog::error("[{}] snapshot encoder open failed", name_);
+            encoder_.reset();
+            return nullptr;
+        }
+    }
+
+    auto timestamp_us = frame->meta.timestamp_us;
+    {
+        std::lock_guard<std::mutex> lock(encoded_mutex_);
+        encoded_.reset();
+    }
+    auto start_us = MonotonicUs();
+    if (!encoder_->PutFrame(std::move(frame))) {
+        spdlog::error("[{}] snapshot encode failed", name_);
+        encoder_.reset();
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(encoded_mutex_);
+    bool done = encoded_cv_.wait_for(lock, std::chrono::milliseconds(info_.timeout_ms),
+        [this, timestamp_us]() { return encoded_ && encoded_timestamp_us_ == timestamp_us; });
+    if (!done) {
+        lock.unlock();
+        // the mpp receive thread calls back under encoded_mutex_, it is joined here
+        spdlog::error("[{}] snapshot encoder gave no jpeg in {} ms", name_, info_.timeout_ms);
+        encoder_.reset();
+        return nullptr;
+    }
+    if (metrics_ != nullptr) {
+        metrics_->snapshot_encode.Observe(MonotonicUs() - start_us);
+        metrics_->snapshot_encodes.Add();
+    }
+    return std::move(encoded_);
+}
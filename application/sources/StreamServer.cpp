@@ -2,6 +2,12 @@
 
 #include <spdlog/spdlog.h>
 
+#include <cstring>
+
+#include "ThreadPlacement.h"
+
+StreamServer* StreamServer::instance_ = nullptr;
+
 StreamServer::StreamServer(const StreamServerInfo& info)
     : info_(info)
 {
@@ -10,6 +16,7 @@ StreamServer::StreamServer(const StreamServerInfo& info)
 StreamServer::~StreamServer(void)
 {
     mk_stop_all_server();
+    instance_ = nullptr;
 }
 
 bool StreamServer::Init(void)
@@ -24,19 +31,145 @@ bool StreamServer::Init(void)
     config.ssl = NULL;
     config.ssl_is_path = 1;
     config.ssl_pwd = NULL;
-    config.thread_num = 0;
+    config.thread_num = info_.poller_threads;
 
     mk_env_init(&config);
-    mk_http_server_start(info_.http_port, 0);
-    mk_rtsp_server_start(info_.rtsp_port, 0);
-    mk_rtmp_server_start(info_.rtmp_port, 0);
+    // the pollers run from here on, ZLMediaKit names them "event poller <n>"
+    ThreadPlacement::Instance().ApplyByName(ThreadRole::Poller, "event poller");
+
+    instance_ = this;
+    mk_events events;
+    memset(&events, 0, sizeof(events));
+    events.on_mk_http_request = StreamServer::OnMkHttpRequest;
+    events.on_mk_media_play = StreamServer::OnMkMediaPlay;
+    // also keeps ZLMediaKit from closing a stream nobody watches
+    events.on_mk_media_no_reader = StreamServer::OnMkMediaNoReader;
+    mk_events_listen(&events);
+
+    // port 0 leaves that server off, e.g. in process benchmarks
+    if (info_.http_port != 0) {
+        mk_http_server_start(info_.http_port, 0);
+    }
+    if (info_.rtsp_port != 0) {
+        mk_rtsp_server_start(info_.rtsp_port, 0);
+    }
+    if (info_.rtmp_port != 0) {
+        mk_rtmp_server_start(info_.rtmp_port, 0);
+    }
 
     return true;
 }
 
+static inline std::string StreamKey(const char* app, const char* stream)
+{
+    return std::string(app != nullptr ? app : "") + "/" + (stream != nullptr ? stream : "");
+}
+
 std::unique_ptr<StreamSink> StreamServer::CreateSink(const StreamSinkInfo& sink_info)
 {
-    return std::make_unique<StreamSink>(sink_info);
+    auto sink = std::make_unique<StreamSink>(sink_info);
+    sink->server_ = this;
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    sinks_[StreamKey(sink_info.app.c_str(), sink_info.stream_id.c_str())] = sink.get();
+    return sink;
+}
+
+void StreamServer::RemoveSink(StreamSink* sink)
+{
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    auto it = sinks_.find(StreamKey(sink->Info().app.c_str(), sink->Info().stream_id.c_str()));
+    if (it != sinks_.end() && it->second == sink) {
+        sinks_.erase(it);
+    }
+}
+
+void StreamServer::AddHttpHandler(const std::string& path, const HttpHandler& handler)
+{
+    AddHttpHandler(path, [handler](const std::string& params, const HttpResponder& respond) {
+        HttpResponse response;
+        handler(params, response);
+        respond(response);
+    });
+}
+
+void StreamServer::AddHttpHandler(const std::string& path, const HttpAsyncHandler& handler)
+{
+    std::lock_guard<std::mutex> lock(http_mutex_);
+    http_handlers_[path] = handler;
+}
+
+void StreamServer::RemoveHttpHandler(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(http_mutex_);
+    http_handlers_.erase(path);
+}
+
+void StreamServer::OnMkHttpRequest(const mk_parser parser, const mk_http_response_invoker invoker,
+    int* consumed, const mk_sock_info sender)
+{
+    auto server = instance_;
+    if (server == nullptr) {
+        return;
+    }
+
+    HttpAsyncHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(server->http_mutex_);
+        auto it = server->http_handlers_.find(mk_parser_get_url(parser));
+        if (it == server->http_handlers_.end()) {
+            return;
+        }
+        handler = it->second;
+    }
+    *consumed = 1;
+
+    auto params = mk_parser_get_url_params(parser);
+    // the clone keeps the connection's invoker valid until the handler responds
+    auto cloned = mk_http_response_invoker_clone(invoker);
+    handler(params != nullptr ? params : "", [cloned](const HttpResponse& response) {
+        const char* response_header[] = { "Content-Type", response.content_type.c_str(), NULL };
+        auto body = mk_http_body_from_string(response.body.data(), response.body.size());
+        mk_http_response_invoker_do(cloned, response.code, response_header, body);
+        mk_http_body_release(body);
+        mk_http_response_invoker_clone_release(cloned);
+    });
+}
+
+void StreamServer::OnMkMediaPlay(const mk_media_info url_info, const mk_auth_invoker invoker,
+    const mk_sock_info sender)
+{
+    // no play authentication, let every player in
+    mk_auth_invoker_do(invoker, nullptr);
+
+    auto server = instance_;
+    if (server == nullptr) {
+        return;
+    }
+    auto key = StreamKey(mk_media_info_get_app(url_info), mk_media_info_get_stream(url_info));
+    spdlog::info("Media Server play {} {}", mk_media_info_get_schema(url_info), key);
+
+    // the lock keeps the sink from being stopped while it gets the event
+    std::lock_guard<std::mutex> lock(server->sink_mutex_);
+    auto it = server->sinks_.find(key);
+    if (it != server->sinks_.end()) {
+        it->second->OnPlayerJoin();
+    }
+}
+
+void StreamServer::OnMkMediaNoReader(const mk_media_source sender)
+{
+    auto server = instance_;
+    if (server == nullptr) {
+        return;
+    }
+    auto key = StreamKey(mk_media_source_get_app(sender), mk_media_source_get_stream(sender));
+    spdlog::info("Media Server no reader {}", key);
+
+    std::lock_guard<std::mutex> lock(server->sink_mutex_);
+    auto it = server->sinks_.find(key);
+    if (it != server->sinks_.end()) {
+        it->second->OnNoReader();
+    }
 }
 
 void StreamServer::Stop(void)
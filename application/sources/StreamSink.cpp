@@ -2,6 +2,11 @@
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+
+#include "FrameTracer.h"
+#include "StreamServer.h"
+
 void StreamSink::OnMkMediaClose(void* self)
 {
     auto server = (StreamSink*)self;
@@ -25,25 +30,174 @@ void StreamSink::OnMkMediaSourceRegist(void* self, mk_media_source sender, int r
         regist == 1 ? "regist" : "unregist",
         mk_media_source_get_reader_count(sender),
         mk_media_source_get_total_reader_count(sender));
+    if (regist == 1 && server->gate_ != nullptr && mk_media_source_get_total_reader_count(sender) > 0) {
+        server->gate_->ReaderJoined();
+    }
     return;
 }
 
 int StreamSink::OnMkMediaSeek(void* self, uint32_t stamp_ms)
 {
-    spdlog::info("Media Server Seek {}ms", stamp_ms);
-    // igonre , 1 is ack
-    return 0;
+    auto server = (StreamSink*)self;
+    if (!server->timeshift_) {
+        spdlog::info("Media Server Seek {}ms ignored, no timeshift", stamp_ms);
+        return 0;
+    }
+    spdlog::info("Media Server Seek {}ms, held {}ms - {}ms", stamp_ms, server->timeshift_->OldestStamp(),
+        server->timeshift_->NewestStamp());
+    server->seek_stamp_ms_.store(stamp_ms, std::memory_order_relaxed);
+    server->seek_pending_.store(true, std::memory_order_release);
+    // 1 is ack
+    return 1;
 }
 
 int StreamSink::OnMkMediaSpeed(void* self, float speed)
 {
     auto server = (StreamSink*)self;
     spdlog::info("Media Server On Speed {}", speed);
-    return 0;
+    // 0 (a pause) is taken as back to live, see ServeTimeshift
+    if (!server->timeshift_ || !(speed >= 0.0f && speed <= 16.0f)) {
+        return 0;
+    }
+    server->speed_.store(speed, std::memory_order_release);
+    return 1;
+}
+
+void StreamSink::StartReplay(uint64_t position, uint64_t now_us)
+{
+    TimeshiftRing::Unit unit;
+    if (!timeshift_->Get(position, unit)) {
+        return;
+    }
+    replaying_ = true;
+    replay_position_ = position;
+    replay_stamp_ms_ = unit.stamp_ms;
+    replay_start_us_ = now_us;
+    // the stream goes on from what it sent last, the ring's stamps are not sent
+    replay_sent_ms_ = sent_ms_;
+}
+
+void StreamSink::StopReplay(void)
+{
+    if (!replaying_) {
+        return;
+    }
+    spdlog::info("Media Server {} {} back to live", info_.app, info_.stream_id);
+    replaying_ = false;
+    if (metrics_ != nullptr) {
+        metrics_->timeshift_delay_ms.Set(0);
+    }
+}
+
+bool StreamSink::ServeTimeshift(uint64_t now_us)
+{
+    if (seek_pending_.exchange(false, std::memory_order_acq_rel)) {
+        uint64_t position;
+        if (timeshift_->FindKey(seek_stamp_ms_.load(std::memory_order_relaxed), position)) {
+            StartReplay(position, now_us);
+            if (metrics_ != nullptr) {
+                metrics_->timeshift_seeks.Add();
+            }
+        }
+    }
+    auto speed = speed_.load(std::memory_order_acquire);
+    if (speed != replay_speed_) {
+        replay_speed_ = speed;
+        if (speed <= 0.0f) {
+            // the stream is shared, one player pausing must not freeze it for the others
+            StopReplay();
+        } else if (replaying_) {
+            // the pace changes from the next unit on
+            StartReplay(replay_position_, now_us);
+        } else if (speed < 1.0f) {
+            // slower than live, the ring takes up the difference
+            StartReplay(timeshift_->End() - 1, now_us);
+        }
+    }
+    if (!replaying_) {
+        return false;
+    }
+
+    // a seek while paused replays at live pace
+    auto pace = replay_speed_ > 0.0f ? replay_speed_ : 1.0f;
+    auto due_ms = replay_stamp_ms_ + (uint64_t)((now_us - replay_start_us_) / 1000 * pace);
+    TimeshiftRing::Unit unit;
+    while (replay_position_ < timeshift_->End()) {
+        if (!timeshift_->Get(replay_position_, unit)) {
+            // evicted under a slow replay, on from the oldest key
+            if (!timeshift_->FindKey(0, replay_position_)) {
+                break;
+            }
+            continue;
+        }
+        if (unit.stamp_ms > due_ms) {
+            break;
+        }
+        // re-stamped to the time it is sent at, the DTS never jumps back on a
+        // seek nor ahead when the replay catches up with live
+        auto elapsed_ms = unit.stamp_ms > replay_stamp_ms_ ? unit.stamp_ms - replay_stamp_ms_ : 0;
+        auto stamp_ms = replay_sent_ms_ + (uint64_t)(elapsed_ms / pace);
+        SendPackage(const_cast<uint8_t*>(unit.data), unit.size, stamp_ms, stamp_ms);
+        replay_position_++;
+    }
+    if (metrics_ != nullptr && replay_position_ < timeshift_->End() && timeshift_->Get(replay_position_, unit)) {
+        metrics_->timeshift_delay_ms.Set(timeshift_->NewestStamp() - unit.stamp_ms);
+    }
+    // faster than live until it caught up, the live unit was the last one sent
+    if (replay_position_ >= timeshift_->End()) {
+        StopReplay();
+    }
+    return true;
+}
+
+void StreamSink::OnPlayerJoin(void)
+{
+    if (gate_ != nullptr) {
+        gate_->ReaderJoined();
+    }
+
+    std::function<void(void)> callback;
+    {
+        std::lock_guard<std::mutex> lock(join_mutex_);
+        join_us_.push_back(MonotonicUs());
+        join_pending_.store(true, std::memory_order_release);
+        callback = join_callback_;
+    }
+    if (callback) {
+        callback();
+    }
+}
+
+void StreamSink::SetJoinCallback(const std::function<void(void)>& callback)
+{
+    std::lock_guard<std::mutex> lock(join_mutex_);
+    join_callback_ = callback;
+}
+
+void StreamSink::SetParameterSets(const std::vector<uint8_t>& parameter_sets)
+{
+    std::lock_guard<std::mutex> lock(parameter_mutex_);
+    next_parameter_sets_ = parameter_sets;
+    has_next_parameter_sets_.store(true, std::memory_order_release);
+}
+
+void StreamSink::OnNoReader(void)
+{
+    if (gate_ != nullptr) {
+        gate_->ReadersGone();
+    }
+}
+
+static NalCodec SinkCodec(const std::string& stream_type)
+{
+    NalCodec codec = NalCodec::H264;
+    ParseNalCodec(stream_type, codec);
+    return codec;
 }
 
 StreamSink::StreamSink(const StreamSinkInfo& info)
     : info_(info)
+    , parser_(SinkCodec(info.stream_type))
 {
 }
 
@@ -77,12 +231,20 @@ bool StreamSink::Init(void)
         send_ = mk_media_input_h265;
     }
 
+    if (info_.timeshift.max_bytes > 0) {
+        timeshift_ = std::make_unique<TimeshiftRing>(info_.timeshift, info_.fps);
+    }
+
     mk_media_init_complete(media_);
     return true;
 }
 
 bool StreamSink::SendPackage(uint8_t* data, uint32_t size, uint64_t dts_ms, uint64_t pts_ms)
 {
+    // live stamps after a replay may trail the re-stamped ones by a frame
+    dts_ms = std::max(dts_ms, sent_ms_);
+    pts_ms = std::max(pts_ms, dts_ms);
+    sent_ms_ = dts_ms;
     if (send_(media_, data, size, dts_ms, pts_ms) == 0) {
         spdlog::error("Send Package error, data = {} size = {}, dts = {}, pts = {}",
             fmt::ptr(data), size, dts_ms, pts_ms);
@@ -91,8 +253,96 @@ bool StreamSink::SendPackage(uint8_t* data, uint32_t size, uint64_t dts_ms, uint
     return true;
 }
 
+bool StreamSink::SendPackage(uint8_t* data, uint32_t size, const FrameMeta& meta)
+{
+    return SendPackage(data, size, meta, parser_.Parse(data, size));
+}
+
+bool StreamSink::SendPackage(uint8_t* data, uint32_t size, const FrameMeta& meta, const AccessUnit& unit)
+{
+    if (!has_base_) {
+        base_us_ = meta.timestamp_us;
+        has_base_ = true;
+    }
+    // no B frames, decode order is presentation order
+    auto stamp_ms = meta.timestamp_us > base_us_ ? (meta.timestamp_us - base_us_) / 1000 : 0;
+
+    auto start_us = MonotonicUs();
+    if (has_next_parameter_sets_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(parameter_mutex_);
+        parameter_sets_.swap(next_parameter_sets_);
+        has_next_parameter_sets_.store(false, std::memory_order_release);
+    }
+    bool prepend = false;
+    if (unit.has_parameter_sets) {
+        parameter_sets_.clear();
+        for (auto& nal : unit.nals) {
+            if (IsParameterSet(parser_.Codec(), nal.type)) {
+                parameter_sets_.insert(parameter_sets_.end(), nal.data, nal.data + nal.size);
+            }
+        }
+    } else if (unit.key && !parameter_sets_.empty()) {
+        // encoders that send the headers once, a session joining later still needs them
+        prepend = true;
+    }
+
+    bool ret = true;
+    if (timeshift_) {
+        // a replay may start at any key unit, each is kept with its parameter sets
+        timeshift_->Append(prepend ? parameter_sets_.data() : nullptr, prepend ? parameter_sets_.size() : 0, data,
+            size, stamp_ms, unit.key);
+        if (metrics_ != nullptr) {
+            metrics_->timeshift_depth_ms.Set(timeshift_->NewestStamp() - timeshift_->OldestStamp());
+        }
+    }
+    // players that seeked or slowed down get the ring instead of the live unit
+    if (!timeshift_ || !ServeTimeshift(start_us)) {
+        if (prepend) {
+            SendPackage(parameter_sets_.data(), parameter_sets_.size(), stamp_ms, stamp_ms);
+        }
+        ret = SendPackage(data, size, stamp_ms, stamp_ms);
+    }
+    auto end_us = MonotonicUs();
+    if (unit.key && join_pending_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(join_mutex_);
+        for (auto join_us : join_us_) {
+            spdlog::info("First IDR {}ms after the player joined", (end_us - join_us) / 1000);
+            if (metrics_ != nullptr) {
+                metrics_->join_to_idr.Observe(end_us - join_us);
+            }
+        }
+        join_us_.clear();
+        join_pending_.store(false, std::memory_order_release);
+    }
+    if (metrics_ == nullptr) {
+        return ret;
+    }
+
+    metrics_->send_package.Observe(end_us - start_us);
+    FrameTracer::Record(TraceSpan::Send, metrics_->trace_stream, meta.sequence, start_us, end_us);
+    if (unit.key) {
+        metrics_->key_frames.Add();
+        metrics_->key_frame_bytes.Add(size);
+    }
+    metrics_->parameter_set_bytes.Add(unit.parameter_set_bytes);
+    if (end_us > meta.timestamp_us) {
+        metrics_->capture_to_send.Observe(end_us - meta.timestamp_us);
+        if (end_us - meta.timestamp_us > metrics_->late_threshold_us) {
+            metrics_->frames_late.Add();
+        }
+    }
+    if (!ret) {
+        metrics_->send_errors.Add();
+    }
+    return ret;
+}
+
 void StreamSink::Stop(void)
 {
+    if (server_ != nullptr) {
+        server_->RemoveSink(this);
+        server_ = nullptr;
+    }
     if (media_ != nullptr) {
         mk_media_release(media_);
         media_ = nullptr;
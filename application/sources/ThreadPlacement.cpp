@@ -0,0 +1,381 @@
+#include "ThreadPlacement.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char* kRoleNames[kThreadRoles] = { "capture", "encode", "encoder_recv", "convert", "poller" };
+
+bool ReadNumber(const std::string& path, uint32_t& value)
+{
+    std::ifstream file(path);
+    return (bool)(file >> value);
+}
+
+// "0-3,6", no names
+bool ParseRanges(std::string_view list, std::vector<int>& cpus)
+{
+    cpus.clear();
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto range = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        while (!range.empty() && (range.back() == '\n' || range.back() == ' ')) {
+            range.remove_suffix(1);
+        }
+        if (range.empty()) {
+            continue;
+        }
+        int first = 0;
+        int last = 0;
+        auto result = std::from_chars(range.data(), range.data() + range.size(), first);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        last = first;
+        if (result.ptr != range.data() + range.size()) {
+            if (*result.ptr != '-') {
+                return false;
+            }
+            auto end = range.data() + range.size();
+            result = std::from_chars(result.ptr + 1, end, last);
+            if (result.ec != std::errc() || result.ptr != end || last < first) {
+                return false;
+            }
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return true;
+}
+
+// back to "0-3,6"
+std::string FormatRanges(const std::vector<int>& cpus)
+{
+    std::string out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (!out.empty()) {
+            out += ',';
+        }
+        out += std::to_string(cpus[i]);
+        if (j != i) {
+            out += '-' + std::to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return out;
+}
+
+pid_t CurrentTid(void)
+{
+    return (pid_t)syscall(SYS_gettid);
+}
+
+std::string TaskPath(pid_t tid, const char* file)
+{
+    return "/proc/self/task/" + std::to_string(tid) + "/" + file;
+}
+
+std::string ThreadName(pid_t tid)
+{
+    std::ifstream file(TaskPath(tid, "comm"));
+    std::string name;
+    std::getline(file, name);
+    return name;
+}
+
+// cpu the thread last ran on, -1 once it is gone
+int LastCpu(pid_t tid)
+{
+    std::ifstream file(TaskPath(tid, "stat"));
+    std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto paren = stat.rfind(')');
+    if (paren == std::string::npos) {
+        return -1;
+    }
+    // fields after the name start at 3 (state), processor is 39
+    std::istringstream fields(stat.substr(paren + 1));
+    std::string field;
+    for (int i = 3; i <= 39 && fields >> field; i++) {
+        if (i == 39) {
+            return std::atoi(field.c_str());
+        }
+    }
+    return -1;
+}
+
+uint64_t NonvoluntarySwitches(pid_t tid)
+{
+    std::ifstream file(TaskPath(tid, "status"));
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0) {
+            return std::strtoull(line.c_str() + 27, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+std::vector<CpuInfo> ReadCpuTopology(const std::string& sysfs_root)
+{
+    std::vector<int> online;
+    std::ifstream file(sysfs_root + "/online");
+    std::string list;
+    if (!std::getline(file, list) || !ParseRanges(list, online) || online.empty()) {
+        for (int cpu = 0; cpu < (int)std::max(std::thread::hardware_concurrency(), 1U); cpu++) {
+            online.push_back(cpu);
+        }
+    }
+
+    std::vector<CpuInfo> topology;
+    for (auto cpu : online) {
+        auto dir = sysfs_root + "/cpu" + std::to_string(cpu);
+        CpuInfo info { cpu, 1, false, false };
+        if (!ReadNumber(dir + "/cpu_capacity", info.capacity)) {
+            ReadNumber(dir + "/cpufreq/cpuinfo_max_freq", info.capacity);
+        }
+        topology.push_back(info);
+    }
+
+    auto [min, max] = std::minmax_element(topology.begin(), topology.end(),
+        [](const CpuInfo& a, const CpuInfo& b) { return a.capacity < b.capacity; });
+    auto low = min->capacity;
+    auto high = max->capacity;
+    for (auto& info : topology) {
+        info.big = info.capacity == high;
+        info.little = info.capacity == low;
+    }
+    return topology;
+}
+
+bool ParseCpuList(std::string_view list, const std::vector<CpuInfo>& topology, std::vector<int>& cpus)
+{
+    cpus.clear();
+    if (list == "big" || list == "little" || list == "all") {
+        for (auto& info : topology) {
+            if (list == "all" || (list == "big" && info.big) || (list == "little" && info.little)) {
+                cpus.push_back(info.cpu);
+            }
+        }
+        return true;
+    }
+    if (!ParseRanges(list, cpus)) {
+        spdlog::error("Bad cpu list {}", list);
+        return false;
+    }
+    // offline or missing cpus would fail sched_setaffinity as a whole
+    cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                   [&](int cpu) {
+                       return std::none_of(topology.begin(), topology.end(),
+                           [cpu](const CpuInfo& info) { return info.cpu == cpu; });
+                   }),
+        cpus.end());
+    if (cpus.empty()) {
+        spdlog::error("No online cpu in {}", list);
+        return false;
+    }
+    return true;
+}
+
+bool ParseThreadRole(std::string_view name, ThreadRole& role)
+{
+    for (size_t i = 0; i < kThreadRoles; i++) {
+        if (name == kRoleNames[i]) {
+            role = (ThreadRole)i;
+            return true;
+        }
+    }
+    spdlog::error("Unknown thread role {}", name);
+    return false;
+}
+
+const char* ThreadRoleName(ThreadRole role)
+{
+    return kRoleNames[(size_t)role];
+}
+
+ThreadPlacement& ThreadPlacement::Instance(void)
+{
+    static ThreadPlacement placement;
+    return placement;
+}
+
+bool ThreadPlacement::Configure(const PlacementInfo& info)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    topology_ = ReadCpuTopology();
+    for (auto& cpu : topology_) {
+        spdlog::info("Cpu {} capacity {}{}", cpu.cpu, cpu.capacity, cpu.big ? " big" : (cpu.little ? " little" : ""));
+    }
+    for (size_t i = 0; i < kThreadRoles; i++) {
+        cpus_[i].clear();
+        if (!info.roles[i].cpus.empty() && !ParseCpuList(info.roles[i].cpus, topology_, cpus_[i])) {
+            return false;
+        }
+        if (info.roles[i].priority < 0 || info.roles[i].priority > 99) {
+            spdlog::error("{} priority {} out of 0 - 99", kRoleNames[i], info.roles[i].priority);
+            return false;
+        }
+    }
+    info_ = info;
+    return true;
+}
+
+bool ThreadPlacement::Apply(ThreadRole role, const std::string& name)
+{
+    // the kernel keeps 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    return ApplyTo(CurrentTid(), role, name.substr(0, 15));
+}
+
+int ThreadPlacement::ApplyByName(ThreadRole role, std::string_view prefix)
+{
+    std::vector<std::pair<pid_t, std::string>> threads;
+    auto dir = opendir("/proc/self/task");
+    if (dir == nullptr) {
+        return 0;
+    }
+    while (auto entry = readdir(dir)) {
+        auto tid = (pid_t)std::atoi(entry->d_name);
+        auto name = tid > 0 ? ThreadName(tid) : std::string();
+        if (!name.empty() && name.compare(0, prefix.size(), prefix) == 0) {
+            threads.emplace_back(tid, std::move(name));
+        }
+    }
+    closedir(dir);
+
+    int placed = 0;
+    for (auto& [tid, name] : threads) {
+        placed += ApplyTo(tid, role, name);
+    }
+    return placed;
+}
+
+bool ThreadPlacement::ApplyTo(pid_t tid, ThreadRole role, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& policy = info_[role];
+    auto& cpus = cpus_[(size_t)role];
+    bool ok = true;
+
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+            spdlog::warn("{} {} affinity {} failed: {}", ThreadRoleName(role), name, FormatRanges(cpus), strerror(errno));
+            ok = false;
+        }
+    }
+    if (policy.priority > 0) {
+        sched_param param {};
+        param.sched_priority = policy.priority;
+        if (sched_setscheduler(tid, SCHED_FIFO, &param) != 0) {
+            // needs CAP_SYS_NICE or an RLIMIT_RTPRIO, e.g. LimitRTPRIO in the unit file
+            spdlog::warn("{} {} SCHED_FIFO {} failed: {}", ThreadRoleName(role), name, policy.priority, strerror(errno));
+            ok = false;
+        }
+    } else if (policy.nice != 0) {
+        // per thread on Linux
+        if (setpriority(PRIO_PROCESS, tid, policy.nice) != 0) {
+            spdlog::warn("{} {} nice {} failed: {}", ThreadRoleName(role), name, policy.nice, strerror(errno));
+            ok = false;
+        }
+    }
+
+    // report what the thread ended up with, not what was asked for
+    Placed placed { tid, role, name, "", "other", 0 };
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(tid, sizeof(set), &set) == 0) {
+        std::vector<int> effective;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                effective.push_back(cpu);
+            }
+        }
+        placed.cpus = FormatRanges(effective);
+    }
+    if (sched_getscheduler(tid) == SCHED_FIFO) {
+        sched_param param {};
+        sched_getparam(tid, &param);
+        placed.policy = "fifo";
+        placed.priority = param.sched_priority;
+    } else {
+        errno = 0;
+        placed.priority = getpriority(PRIO_PROCESS, tid);
+    }
+    spdlog::info("Thread {} ({}) tid {} cpus {} {} {}", name, ThreadRoleName(role), tid, placed.cpus,
+        placed.policy, placed.priority);
+
+    placed_.erase(std::remove_if(placed_.begin(), placed_.end(), [tid](const Placed& p) { return p.tid == tid; }),
+        placed_.end());
+    placed_.push_back(std::move(placed));
+    return ok;
+}
+
+std::string ThreadPlacement::Render(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+
+    fmt::format_to(it, "# HELP streamserver_cpu_capacity sysfs cpu_capacity (1024 is the fastest core) or max frequency in kHz\n");
+    fmt::format_to(it, "# TYPE streamserver_cpu_capacity gauge\n");
+    for (auto& cpu : topology_) {
+        fmt::format_to(it, "streamserver_cpu_capacity{{cpu=\"{}\",core=\"{}\"}} {}\n", cpu.cpu,
+            cpu.big ? "big" : (cpu.little ? "little" : "mid"), cpu.capacity);
+    }
+
+    // threads that exited since, e.g. a pipeline that reopened its input
+    placed_.erase(std::remove_if(placed_.begin(), placed_.end(),
+                      [](const Placed& p) { return LastCpu(p.tid) < 0; }),
+        placed_.end());
+
+    fmt::format_to(it, "# HELP streamserver_thread_priority SCHED_FIFO priority, or nice for policy other\n");
+    fmt::format_to(it, "# TYPE streamserver_thread_priority gauge\n");
+    for (auto& p : placed_) {
+        fmt::format_to(it, "streamserver_thread_priority{{role=\"{}\",thread=\"{}\",tid=\"{}\",cpus=\"{}\",policy=\"{}\"}} {}\n",
+            ThreadRoleName(p.role), p.name, p.tid, p.cpus, p.policy, p.priority);
+    }
+    fmt::format_to(it, "# HELP streamserver_thread_cpu Core the thread last ran on\n");
+    fmt::format_to(it, "# TYPE streamserver_thread_cpu gauge\n");
+    for (auto& p : placed_) {
+        fmt::format_to(it, "streamserver_thread_cpu{{role=\"{}\",thread=\"{}\",tid=\"{}\"}} {}\n",
+            ThreadRoleName(p.role), p.name, p.tid, LastCpu(p.tid));
+    }
+    fmt::format_to(it, "# HELP streamserver_thread_preempted_total Involuntary context switches\n");
+    fmt::format_to(it, "# TYPE streamserver_thread_preempted_total counter\n");
+    for (auto& p : placed_) {
+        fmt::format_to(it, "streamserver_thread_preempted_total{{role=\"{}\",thread=\"{}\",tid=\"{}\"}} {}\n",
+            ThreadRoleName(p.role), p.name, p.tid, NonvoluntarySwitches(p.tid));
+    }
+    return fmt::to_string(out);
+}
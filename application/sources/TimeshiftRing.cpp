@@ -0,0 +1,114 @@
+#include "TimeshiftRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+TimeshiftRing::TimeshiftRing(const TimeshiftInfo& info, uint32_t fps)
+    : info_(info)
+    , data_(info.max_bytes)
+    , index_(std::max<size_t>(2ULL * std::max(info.max_seconds, 1U) * std::max(fps, 1U), 16))
+{
+}
+
+void TimeshiftRing::Evict(void)
+{
+    begin_++;
+    oldest_stamp_ms_.store(begin_ < end_ ? At(begin_).stamp_ms : 0, std::memory_order_relaxed);
+}
+
+bool TimeshiftRing::Append(const uint8_t* prefix, uint32_t prefix_size, const uint8_t* data, uint32_t size,
+    uint64_t stamp_ms, bool key)
+{
+    uint32_t total = prefix_size + size;
+    if (total == 0 || total > data_.size()) {
+        return false;
+    }
+
+    // older than the window, or no index slot left
+    while (begin_ < end_
+        && (stamp_ms - std::min(stamp_ms, At(begin_).stamp_ms) > info_.max_seconds * 1000ULL
+            || end_ - begin_ >= index_.size())) {
+        Evict();
+    }
+
+    // the first free byte after the newest unit, or the start once it does not fit before the end
+    uint32_t offset = 0;
+    while (begin_ < end_) {
+        auto& oldest = At(begin_);
+        auto& newest = At(end_ - 1);
+        uint32_t head = newest.offset + newest.size;
+        if (oldest.offset <= newest.offset) {
+            // [oldest, head) in use, free behind head and ahead of oldest
+            if (head + total <= data_.size()) {
+                offset = head;
+                break;
+            }
+            if (total <= oldest.offset) {
+                offset = 0;
+                break;
+            }
+        } else if (head + total <= oldest.offset) {
+            // wrapped, the free space is [head, oldest)
+            offset = head;
+            break;
+        }
+        Evict();
+    }
+
+    if (prefix_size > 0) {
+        std::memcpy(data_.data() + offset, prefix, prefix_size);
+    }
+    std::memcpy(data_.data() + offset + prefix_size, data, size);
+    index_[end_ % index_.size()] = { offset, total, stamp_ms, key };
+    end_++;
+
+    oldest_stamp_ms_.store(At(begin_).stamp_ms, std::memory_order_relaxed);
+    newest_stamp_ms_.store(stamp_ms, std::memory_order_relaxed);
+    return true;
+}
+
+bool TimeshiftRing::FindKey(uint64_t stamp_ms, uint64_t& position) const
+{
+    if (begin_ == end_) {
+        return false;
+    }
+    // units are appended in stamp order: the last one at or before stamp_ms
+    uint64_t low = begin_;
+    uint64_t high = end_;
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        if (At(middle).stamp_ms <= stamp_ms) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    // then back to its key unit, a gop at most
+    for (auto i = low; i > begin_; i--) {
+        if (At(i - 1).key) {
+            position = i - 1;
+            return true;
+        }
+    }
+    // older than the ring, the first key held
+    for (auto i = begin_; i < end_; i++) {
+        if (At(i).key) {
+            position = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TimeshiftRing::Get(uint64_t position, Unit& unit) const
+{
+    if (position < begin_ || position >= end_) {
+        return false;
+    }
+    auto& entry = At(position);
+    unit.data = data_.data() + entry.offset;
+    unit.size = entry.size;
+    unit.stamp_ms = entry.stamp_ms;
+    unit.key = entry.key;
+    return true;
+}
@@ -0,0 +1,159 @@
+#include "TsMuxer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+
+constexpr uint8_t kSyncByte = 0x47;
+constexpr uint32_t kPayloadSize = TsMuxer::kPacketSize - 4;
+// length, flags and the 6 byte PCR
+constexpr uint32_t kPcrFieldSize = 8;
+
+std::array<uint32_t, 256> MakeCrcTable(void)
+{
+    std::array<uint32_t, 256> table {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+void PutPts(uint8_t* p, uint8_t prefix, uint64_t pts)
+{
+    p[0] = prefix | ((pts >> 29) & 0x0E) | 1;
+    p[1] = (pts >> 22) & 0xFF;
+    p[2] = ((pts >> 14) & 0xFE) | 1;
+    p[3] = (pts >> 7) & 0xFF;
+    p[4] = ((pts << 1) & 0xFE) | 1;
+}
+
+void PutPcr(uint8_t* p, uint64_t base)
+{
+    p[0] = (base >> 25) & 0xFF;
+    p[1] = (base >> 17) & 0xFF;
+    p[2] = (base >> 9) & 0xFF;
+    p[3] = (base >> 1) & 0xFF;
+    // 6 reserved bits, 9 bit extension 0
+    p[4] = ((base & 1) << 7) | 0x7E;
+    p[5] = 0;
+}
+
+} // namespace
+
+uint32_t TsCrc32(const uint8_t* data, uint32_t size)
+{
+    static const auto table = MakeCrcTable();
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+TsMuxer::TsMuxer(NalCodec codec)
+    : codec_(codec)
+{
+}
+
+void TsMuxer::WriteSection(uint16_t pid, uint8_t& counter, const uint8_t* section, uint32_t size,
+    std::vector<uint8_t>& out)
+{
+    auto offset = out.size();
+    out.resize(offset + kPacketSize, 0xFF);
+    auto p = out.data() + offset;
+    p[0] = kSyncByte;
+    p[1] = 0x40 | (pid >> 8);
+    p[2] = pid & 0xFF;
+    p[3] = 0x10 | counter;
+    counter = (counter + 1) & 0x0F;
+    // pointer field, the section starts right away
+    p[4] = 0;
+    std::memcpy(p + 5, section, size);
+}
+
+void TsMuxer::WriteTables(std::vector<uint8_t>& out)
+{
+    uint8_t pat[] = {
+        0x00, 0xB0, 13,
+        0x00, 0x01, 0xC1, 0x00, 0x00,
+        // program 1 -> PMT
+        0x00, 0x01, (uint8_t)(0xE0 | (kPmtPid >> 8)), (uint8_t)(kPmtPid & 0xFF),
+        0, 0, 0, 0,
+    };
+    auto crc = TsCrc32(pat, sizeof(pat) - 4);
+    pat[sizeof(pat) - 4] = crc >> 24;
+    pat[sizeof(pat) - 3] = crc >> 16;
+    pat[sizeof(pat) - 2] = crc >> 8;
+    pat[sizeof(pat) - 1] = crc;
+    WriteSection(0, pat_counter_, pat, sizeof(pat), out);
+
+    // ISO/IEC 13818-1 stream types, AVC and HEVC
+    uint8_t stream_type = codec_ == NalCodec::H265 ? 0x24 : 0x1B;
+    uint8_t pmt[] = {
+        0x02, 0xB0, 18,
+        0x00, 0x01, 0xC1, 0x00, 0x00,
+        // PCR PID, no program info
+        (uint8_t)(0xE0 | (kVideoPid >> 8)), (uint8_t)(kVideoPid & 0xFF), 0xF0, 0x00,
+        stream_type, (uint8_t)(0xE0 | (kVideoPid >> 8)), (uint8_t)(kVideoPid & 0xFF), 0xF0, 0x00,
+        0, 0, 0, 0,
+    };
+    crc = TsCrc32(pmt, sizeof(pmt) - 4);
+    pmt[sizeof(pmt) - 4] = crc >> 24;
+    pmt[sizeof(pmt) - 3] = crc >> 16;
+    pmt[sizeof(pmt) - 2] = crc >> 8;
+    pmt[sizeof(pmt) - 1] = crc;
+    WriteSection(kPmtPid, pmt_counter_, pmt, sizeof(pmt), out);
+}
+
+void TsMuxer::WriteAccessUnit(const uint8_t* data, uint32_t size, uint64_t pts_90k, bool key,
+    std::vector<uint8_t>& out)
+{
+    // video PES of unbounded length, data aligned, pts only (no B frames)
+    uint8_t header[14] = { 0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x84, 0x80, 0x05 };
+    PutPts(header + 9, 0x20, pts_90k & 0x1FFFFFFFFULL);
+    auto pcr = (pts_90k > kPcrDelay90k ? pts_90k - kPcrDelay90k : 0) & 0x1FFFFFFFFULL;
+
+    uint32_t header_left = sizeof(header);
+    uint32_t data_left = size;
+    bool first = true;
+    out.reserve(out.size() + (size + sizeof(header)) / kPayloadSize * kPacketSize + 2 * kPacketSize);
+    while (header_left + data_left > 0) {
+        auto offset = out.size();
+        out.resize(offset + kPacketSize);
+        auto p = out.data() + offset;
+
+        auto take = std::min(kPayloadSize - (first ? kPcrFieldSize : 0), header_left + data_left);
+        // adaptation field bytes, length byte included: the PCR and the stuffing of the last packet
+        auto field = kPayloadSize - take;
+        p[0] = kSyncByte;
+        p[1] = (first ? 0x40 : 0x00) | (kVideoPid >> 8);
+        p[2] = kVideoPid & 0xFF;
+        p[3] = (field > 0 ? 0x30 : 0x10) | video_counter_;
+        video_counter_ = (video_counter_ + 1) & 0x0F;
+        if (field > 0) {
+            p[4] = field - 1;
+            if (field > 1) {
+                std::memset(p + 5, 0xFF, field - 1);
+                p[5] = 0;
+                if (first) {
+                    p[5] = 0x10 | (key ? 0x40 : 0);
+                    PutPcr(p + 6, pcr);
+                }
+            }
+        }
+
+        auto dst = p + 4 + field;
+        auto from_header = std::min(take, header_left);
+        std::memcpy(dst, header + sizeof(header) - header_left, from_header);
+        header_left -= from_header;
+        std::memcpy(dst + from_header, data + size - data_left, take - from_header);
+        data_left -= take - from_header;
+        first = false;
+    }
+}
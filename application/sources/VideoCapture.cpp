@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/videodev2.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
@@ -13,15 +14,40 @@
 #include <magic_enum.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <thread>
 
+#include "CaptureReactor.h"
+#include "FrameTracer.h"
+
+// the buffers and the encoder's prep config still fit: size, format and per plane stride and size
+static inline bool SameLayout(const CaptureVideoInfo& a, const CaptureVideoInfo& b)
+{
+    return a.width == b.width && a.height == b.height && a.pixelformat == b.pixelformat
+        && a.bytesperline == b.bytesperline && a.sizeimage == b.sizeimage;
+}
+
+static inline std::string FourccName(uint32_t fourcc)
+{
+    return fmt::format("{}{}{}{}", (char)(fourcc & 0xFF), (char)((fourcc >> 8) & 0xFF),
+        (char)((fourcc >> 16) & 0xFF), (char)((fourcc >> 24) & 0xFF));
+}
+
 static inline std::string AdaptFrameType(uint32_t frame_type)
 {
     switch (frame_type) {
     case V4L2_PIX_FMT_BGR24:
         return "BGR24";
+    case V4L2_PIX_FMT_NV12:
+        return "NV12";
+    case V4L2_PIX_FMT_NV16:
+        return "NV16";
+    case V4L2_PIX_FMT_YUYV:
+        return "YUYV";
+    case V4L2_PIX_FMT_YUV420:
+        return "I420";
     default:
-        spdlog::error("Unkonw frame type {}", frame_type);
+        spdlog::error("Unkonw frame type {}", FourccName(frame_type));
         return "Error";
     }
 }
@@ -32,27 +58,25 @@ static inline uint32_t AdaptFrameType(std::string_view frame_type)
         return V4L2_PIX_FMT_BGR24;
     } else if (frame_type.compare("NV12") == 0) {
         return V4L2_PIX_FMT_NV12;
+    } else if (frame_type.compare("NV16") == 0) {
+        return V4L2_PIX_FMT_NV16;
+    } else if (frame_type.compare("YUYV") == 0) {
+        return V4L2_PIX_FMT_YUYV;
+    } else if (frame_type.compare("I420") == 0) {
+        return V4L2_PIX_FMT_YUV420;
     } else {
         spdlog::error("Can not find this Format {}", frame_type);
         return -1;
     }
 }
 
+// EINTR only, anything else (EAGAIN of a non blocking DQBUF too) is for the caller to handle
 static inline int VideoIoctl(int fd, int req, void* arg)
 {
-    struct timespec poll_time;
     int ret;
-    uint8_t cnt = 0;
-    constexpr uint8_t max_cnt = 10;
-    while ((ret = ioctl(fd, req, arg))) {
-        if (ret == -1 && (EINTR != errno && EAGAIN != errno && ETIMEDOUT == errno )) {
-            break;
-        }
-        if (cnt++ > max_cnt)
-            break;
-        // 10 milliseconds
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
+    do {
+        ret = ioctl(fd, req, arg);
+    } while (ret == -1 && errno == EINTR);
     return ret;
 }
 
@@ -64,6 +88,12 @@ VideoCapture::VideoCapture(std::string_view video_path, int buf_count, uint32_t
 {
 }
 
+VideoCapture::VideoCapture(const CaptureSourceInfo& info)
+    : VideoCapture(info.path, info.buf_count, info.timeout)
+{
+    request_ = info;
+}
+
 bool VideoCapture::CheckCaptureAbility(void)
 {
     struct v4l2_capability arg_capability;
@@ -108,11 +138,17 @@ bool VideoCapture::CheckVideoFormat(void)
         return false;
     }
 
+    video_info_.sizeimage.clear();
+    video_info_.bytesperline.clear();
     if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
         video_info_.height = arg_format.fmt.pix_mp.height;
         video_info_.width = arg_format.fmt.pix_mp.width;
         video_info_.pixelformat = AdaptFrameType(arg_format.fmt.pix_mp.pixelformat);
         video_info_.num_planes = arg_format.fmt.pix_mp.num_planes;
+        for (uint32_t i = 0; i < video_info_.num_planes; i++) {
+            video_info_.sizeimage.push_back(arg_format.fmt.pix_mp.plane_fmt[i].sizeimage);
+            video_info_.bytesperline.push_back(arg_format.fmt.pix_mp.plane_fmt[i].bytesperline);
+        }
         auto colorspace_int = arg_format.fmt.pix_mp.colorspace;
         auto colorspace = magic_enum::enum_cast<v4l2_colorspace>(arg_format.fmt.pix_mp.colorspace);
         if (colorspace.has_value()) {
@@ -127,7 +163,8 @@ bool VideoCapture::CheckVideoFormat(void)
         video_info_.pixelformat = AdaptFrameType(arg_format.fmt.pix.pixelformat);
         video_info_.num_planes = 1;
         video_info_.sizeimage.push_back(arg_format.fmt.pix.sizeimage);
-        auto colorspace_int = arg_format.fmt.pix_mp.colorspace;
+        video_info_.bytesperline.push_back(arg_format.fmt.pix.bytesperline);
+        auto colorspace_int = arg_format.fmt.pix.colorspace;
         auto colorspace = magic_enum::enum_cast<v4l2_colorspace>(arg_format.fmt.pix.colorspace);
         if (colorspace.has_value()) {
             video_info_.colorspace = magic_enum::enum_name(colorspace.value());
@@ -137,36 +174,124 @@ bool VideoCapture::CheckVideoFormat(void)
         }
     }
 
-    for (uint32_t i = 0; i < video_info_.num_planes; i++) {
-        video_info_.sizeimage.push_back(arg_format.fmt.pix_mp.plane_fmt[i].sizeimage);
+    if (video_info_.pixelformat.compare("Error") == 0) {
+        return false;
+    }
+    // drivers may leave it 0 for packed formats
+    if (video_info_.bytesperline.empty() || video_info_.bytesperline[0] == 0) {
+        video_info_.bytesperline.assign(video_info_.num_planes,
+            CaptureLineSize(video_info_.pixelformat, video_info_.width));
     }
 
     spdlog::info("Video height: {}", video_info_.height);
     spdlog::info("Video width: {}", video_info_.width);
     spdlog::info("Video pixelformat: {}", video_info_.pixelformat);
     spdlog::info("Video num_planes: {}", video_info_.num_planes);
+    spdlog::info("Video bytesperline: {}", video_info_.bytesperline[0]);
     spdlog::info("Video colorspace: {}", video_info_.colorspace);
 
     return true;
 }
 
-std::vector<std::string> VideoCapture::EnumVideoFormat(void)
+std::vector<uint32_t> VideoCapture::EnumVideoFormat(void)
 {
     struct v4l2_fmtdesc fmtdesc;
+    std::memset(&fmtdesc, 0, sizeof(fmtdesc));
     fmtdesc.index = 0;
     fmtdesc.type = buf_type_;
-    std::vector<std::string> fmts;
+    std::vector<uint32_t> fmts;
     while (!VideoIoctl(fd_, VIDIOC_ENUM_FMT, &fmtdesc)) {
-        auto fmt = fmt::format("{}{}{}{}", fmtdesc.pixelformat & 0xFF,
-            (fmtdesc.pixelformat >> 8) & 0xFF, (fmtdesc.pixelformat >> 16) & 0xFF,
-            (fmtdesc.pixelformat >> 24) & 0xFF);
-        spdlog::info("fmt name: [{}] \tfmt pixelformat: {}", std::string((char*)fmtdesc.description), fmt);
+        spdlog::info("fmt name: [{}] \tfmt pixelformat: {}",
+            std::string((char*)fmtdesc.description), FourccName(fmtdesc.pixelformat));
+        fmts.push_back(fmtdesc.pixelformat);
         fmtdesc.index++;
-        fmts.emplace_back(std::move(fmt));
     }
     return fmts;
 }
 
+std::vector<std::pair<uint32_t, uint32_t>> VideoCapture::EnumFrameSizes(uint32_t fourcc)
+{
+    struct v4l2_frmsizeenum frmsize;
+    std::memset(&frmsize, 0, sizeof(frmsize));
+    frmsize.pixel_format = fourcc;
+    std::vector<std::pair<uint32_t, uint32_t>> sizes;
+    while (!VideoIoctl(fd_, VIDIOC_ENUM_FRAMESIZES, &frmsize)) {
+        if (frmsize.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+            spdlog::info("{} sizes {}x{} - {}x{}", FourccName(fourcc),
+                frmsize.stepwise.min_width, frmsize.stepwise.min_height,
+                frmsize.stepwise.max_width, frmsize.stepwise.max_height);
+            return {};
+        }
+        spdlog::info("{} size {}x{}", FourccName(fourcc), frmsize.discrete.width, frmsize.discrete.height);
+        sizes.emplace_back(frmsize.discrete.width, frmsize.discrete.height);
+        frmsize.index++;
+    }
+    return sizes;
+}
+
+bool VideoCapture::NegotiateVideoFormat(void)
+{
+    auto device_formats = EnumVideoFormat();
+    if (device_formats.size() == 0) {
+        spdlog::error("Can not find video format");
+        return false;
+    }
+
+    std::vector<std::string> candidates;
+    if (!request_.pixelformat.empty()) {
+        candidates.push_back(request_.pixelformat);
+    } else {
+        // cheapest first, limited to what the consumer takes
+        for (auto& format : CaptureFormats()) {
+            if (request_.formats.empty()
+                || std::find(request_.formats.begin(), request_.formats.end(), format) != request_.formats.end()) {
+                candidates.push_back(format);
+            }
+        }
+    }
+
+    std::string format;
+    uint32_t fourcc = 0;
+    for (auto& candidate : candidates) {
+        auto candidate_fourcc = AdaptFrameType(candidate);
+        if (std::find(device_formats.begin(), device_formats.end(), candidate_fourcc) != device_formats.end()) {
+            format = candidate;
+            fourcc = candidate_fourcc;
+            break;
+        }
+    }
+    if (format.empty()) {
+        spdlog::error("No format both {} and the encoder take", video_path_);
+        return false;
+    }
+
+    // the source (e.g. hdmi rx) decides the size unless asked for
+    CaptureVideoInfo video_info = video_info_;
+    video_info.pixelformat = format;
+    if (request_.width != 0 && request_.height != 0) {
+        video_info.width = request_.width;
+        video_info.height = request_.height;
+    }
+    auto sizes = EnumFrameSizes(fourcc);
+    if (!sizes.empty()
+        && std::find(sizes.begin(), sizes.end(), std::make_pair(video_info.width, video_info.height)) == sizes.end()) {
+        auto largest = *std::max_element(sizes.begin(), sizes.end(), [](const auto& a, const auto& b) {
+            return a.first * a.second < b.first * b.second;
+        });
+        spdlog::warn("{} has no {}x{}, use {}x{}", format, video_info.width, video_info.height,
+            largest.first, largest.second);
+        video_info.width = largest.first;
+        video_info.height = largest.second;
+    }
+
+    spdlog::info("Negotiated {} {}x{}", format, video_info.width, video_info.height);
+    if (!SetVideoFormat(video_info)) {
+        return false;
+    }
+    // the driver may adjust size and strides
+    return CheckVideoFormat();
+}
+
 bool VideoCapture::SetVideoFormat(CaptureVideoInfo& video_info)
 {
     struct v4l2_format fmt;
@@ -214,6 +339,7 @@ bool VideoCapture::QueryVideoBuffers(void)
     planes_data_.resize(buf_count_);
     planes_buffers_.resize(buf_count_);
     for (int i = 0; i < buf_count_; i++) {
+        planes_data_[i].dma_fd = -1;
         std::memset(&buf, 0, sizeof(struct v4l2_buffer));
         buf.index = i;
         buf.type = buf_type_;
@@ -230,9 +356,10 @@ bool VideoCapture::QueryVideoBuffers(void)
             return false;
         }
 
-        planes_data_[i].data.resize(num_planes);
+        planes_data_[i].data.resize(num_planes, PlaneData { MAP_FAILED, 0 });
         for (int j = 0; j < num_planes; j++) {
             if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+                planes_data_[i].data[j].size = (planes_buffers_[i] + j)->length;
                 planes_data_[i].data[j].start = mmap(NULL /* start anywhere */,
                     (planes_buffers_[i] + j)->length,
                     PROT_READ | PROT_WRITE /* required */,
@@ -240,6 +367,7 @@ bool VideoCapture::QueryVideoBuffers(void)
                     fd_,
                     (planes_buffers_[i] + j)->m.mem_offset);
             } else {
+                planes_data_[i].data[j].size = buf.length;
                 planes_data_[i].data[j].start = (char*)mmap(NULL,
                     buf.length,
                     PROT_READ | PROT_WRITE,
@@ -266,6 +394,18 @@ bool VideoCapture::QueryVideoBuffers(void)
             planes_data_[i].dma_fd = expbuf.fd;
         }
     }
+
+    frames_ = std::vector<VideoFrame>(buf_count_);
+    generation_++;
+    for (int i = 0; i < buf_count_; i++) {
+        frames_[i].index = i;
+        frames_[i].generation = generation_;
+        frames_[i].dma_fd = planes_data_[i].dma_fd;
+        // the exported buffer is plane 0 as mapped, not a frame's bytesused
+        frames_[i].dma_size = planes_data_[i].data[0].size;
+        frames_[i].planes = planes_data_[i].data;
+        frames_[i].owner = this;
+    }
     return true;
 }
 
@@ -289,12 +429,64 @@ bool VideoCapture::QueueVideoBuffers(void)
             return false;
         }
     }
+
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    buffer_state_.assign(buf_count_, BufferState::Queued);
+    return true;
+}
+
+bool VideoCapture::StreamOn(void)
+{
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    for (size_t i = 0; i < buffer_state_.size(); i++) {
+        if (buffer_state_[i] != BufferState::Free) {
+            continue;
+        }
+        struct v4l2_buffer buf;
+        std::memset(&buf, 0, sizeof(buf));
+        buf.index = i;
+        buf.type = buf_type_;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            buf.length = video_info_.num_planes;
+            buf.m.planes = planes_buffers_[i];
+        }
+        if (VideoIoctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+            spdlog::error("VIDIOC_QBUF failed {}", i);
+            return false;
+        }
+        buffer_state_[i] = BufferState::Queued;
+    }
+
+    if (VideoIoctl(fd_, VIDIOC_STREAMON, &buf_type_) < 0) {
+        spdlog::error("VIDIOC_STREAMON failed");
+        return false;
+    }
+    streaming_ = true;
+    return true;
+}
+
+bool VideoCapture::StreamOff(void)
+{
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    streaming_ = false;
+    // STREAMOFF takes every queued buffer back from the driver
+    for (auto& state : buffer_state_) {
+        if (state == BufferState::Queued) {
+            state = BufferState::Free;
+        }
+    }
+    if (VideoIoctl(fd_, VIDIOC_STREAMOFF, &buf_type_) < 0) {
+        spdlog::error("VIDIOC_STREAMOFF fail");
+        return false;
+    }
     return true;
 }
 
 bool VideoCapture::Init(void)
 {
-    fd_ = ::open(video_path_.c_str(), O_RDWR);
+    // DQBUF never blocks, the caller waits for the fd (select or the reactor)
+    fd_ = ::open(video_path_.c_str(), O_RDWR | O_NONBLOCK);
     if (fd_ < 0) {
         spdlog::error("Can not open {}", video_path_);
         return false;
@@ -304,13 +496,23 @@ bool VideoCapture::Init(void)
         return false;
     }
 
+    // resolution changes and replugs are handled in place, see Renegotiate
+    struct v4l2_event_subscription subscription;
+    std::memset(&subscription, 0, sizeof(subscription));
+    subscription.type = V4L2_EVENT_SOURCE_CHANGE;
+    source_events_ = VideoIoctl(fd_, VIDIOC_SUBSCRIBE_EVENT, &subscription) == 0;
+    if (!source_events_) {
+        spdlog::info("{} has no source change events, a new resolution resets the capture", video_path_);
+    }
+    no_signal_ = false;
+    change_start_us_ = 0;
+
+    // only the current size matters here, the format is negotiated below
     if (!CheckVideoFormat()) {
-        return false;
+        spdlog::info("Current format of {} is not usable as is", video_path_);
     }
 
-    auto video_format = EnumVideoFormat();
-    if (video_format.size() == 0) {
-        spdlog::error("Can not find video format");
+    if (!NegotiateVideoFormat()) {
         return false;
     }
 
@@ -335,151 +537,462 @@ bool VideoCapture::GetVideoInfo(CaptureVideoInfo& info)
     return true;
 }
 
-bool VideoCapture::Setup(const std::function<void(PlaneData&, int dma_fd)>& callback)
+bool VideoCapture::Loop(const std::function<void(FrameRef)>& callback)
 {
-    PlaneData ret_data;
-    assert(buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE);
-    callback_op_ = callback;
-    if (VideoIoctl(fd_, VIDIOC_STREAMON, &buf_type_) < 0) {
-        spdlog::error("VIDIOC_STREAMON failed");
+    callback_ = callback;
+    if (!Paused() && !StreamOn()) {
         return false;
     }
 
-    struct v4l2_buffer buf;
+    dequeue_planes_.resize(video_info_.num_planes);
     fd_set fds;
-    timeval* tv = nullptr;
-    if (timeout_ != 0) {
-        tv = (timeval*)malloc(sizeof(timeval));
-        tv->tv_sec = timeout_;
-        tv->tv_usec = 0;
-    }
+    fd_set event_fds;
+    bool ret = true;
+    has_sequence_ = false;
     while (is_running_) {
+        if (Paused()) {
+            // no DMA and no sensor readout while nobody needs frames
+            if (streaming_ && !StreamOff()) {
+                ret = false;
+                break;
+            }
+            WaitWhilePaused(is_running_);
+            if (!is_running_) {
+                break;
+            }
+            // streams on with the next source change
+            if (no_signal_) {
+                continue;
+            }
+            if (!StreamOn()) {
+                ret = false;
+                break;
+            }
+            spdlog::info("Capture {} resumed", video_path_);
+            has_sequence_ = false;
+            continue;
+        }
+
+        if (reactor_ != nullptr) {
+            if (!ReactorWait()) {
+                ret = false;
+                break;
+            }
+            continue;
+        }
+
+        auto wait_start_us = MonotonicUs();
         FD_ZERO(&fds);
-        FD_SET(fd_, &fds);
-        tv->tv_sec = timeout_;
-        auto r = select(fd_ + 1, &fds, NULL, NULL, tv);
+        FD_ZERO(&event_fds);
+        // without a signal the stream is off, only the next source change matters
+        if (!no_signal_) {
+            FD_SET(fd_, &fds);
+        }
+        if (source_events_) {
+            FD_SET(fd_, &event_fds);
+        }
+        timeval tv = { (time_t)timeout_, 0 };
+        if (no_signal_) {
+            // Stop only clears is_running_
+            tv = { 0, 200000 };
+        }
+        auto r = select(fd_ + 1, &fds, NULL, &event_fds, (timeout_ == 0 && !no_signal_) ? nullptr : &tv);
         if (-1 == r) {
             if (EINTR == errno)
                 continue;
             spdlog::error("select err {}", strerror(errno));
+            ret = false;
+            break;
         }
         if (0 == r) {
+            if (no_signal_) {
+                continue;
+            }
             spdlog::error("select timeout");
-            return false;
+            ret = false;
+            break;
         }
-        std::memset(&buf, 0, sizeof(buf));
-        buf.type = buf_type_;
-        buf.memory = V4L2_MEMORY_MMAP;
-        if (VideoIoctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
-            spdlog::error("dqbuf fail {}", strerror(errno));
+        if (source_events_ && FD_ISSET(fd_, &event_fds)) {
+            if (!HandleEvents()) {
+                ret = false;
+                break;
+            }
+            // the buffers may be new, select again
+            has_sequence_ = false;
+            continue;
         }
+        DequeueFrame(wait_start_us);
+    }
 
-        if (buf.index > buf_count_) {
-            spdlog::error("VIDIOC_DQBUF error {}", buf.index);
-            continue;
+    if (streaming_ && !StreamOff()) {
+        return false;
+    }
+
+    return ret;
+}
+
+bool VideoCapture::DequeueFrame(uint64_t wait_start_us)
+{
+    const auto num_planes = video_info_.num_planes;
+    struct v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = buf_type_;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        buf.m.planes = dequeue_planes_.data();
+        buf.length = num_planes;
+    }
+
+    if (VideoIoctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+        // drained
+        if (errno != EAGAIN) {
+            spdlog::error("dqbuf fail {}", strerror(errno));
         }
+        return false;
+    }
+
+    if (buf.index >= (uint32_t)buf_count_) {
+        spdlog::error("VIDIOC_DQBUF error {}", buf.index);
+        return false;
+    }
 
-        ret_data.size = buf.bytesused;
-        ret_data.start = planes_data_[buf.index].data[0].start;
+    auto dequeue_us = MonotonicUs();
+    if (metrics_ != nullptr) {
+        metrics_->dequeue_wait.Observe(dequeue_us - wait_start_us);
+        metrics_->FrameCaptured(dequeue_us);
+        // the driver drops frames silently when it runs out of buffers
+        if (has_sequence_ && buf.sequence - last_sequence_ > 1) {
+            metrics_->frames_dropped.Add(buf.sequence - last_sequence_ - 1);
+        }
+    }
+    has_sequence_ = true;
+    last_sequence_ = buf.sequence;
+    if (change_start_us_ != 0) {
+        spdlog::info("Capture {} back {}ms after the source change", video_path_,
+            (dequeue_us - change_start_us_) / 1000);
+        if (metrics_ != nullptr) {
+            metrics_->source_change.Observe(dequeue_us - change_start_us_);
+        }
+        change_start_us_ = 0;
+    }
 
-        callback_op_(ret_data, planes_data_[buf.index].dma_fd);
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        buffer_state_[buf.index] = BufferState::InUse;
+    }
 
-        if (VideoIoctl(fd_, VIDIOC_QBUF, &buf) < 0) {
-            spdlog::error("failture VIDIOC_QBUF");
+    auto& frame = frames_[buf.index];
+    if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        for (int j = 0; j < num_planes; j++) {
+            frame.planes[j].size = dequeue_planes_[j].bytesused;
         }
+    } else {
+        frame.planes[0].size = buf.bytesused;
+    }
+    frame.meta.sequence = buf.sequence;
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+        && (buf.timestamp.tv_sec != 0 || buf.timestamp.tv_usec != 0)) {
+        frame.meta.timestamp_us = buf.timestamp.tv_sec * 1000000ULL + buf.timestamp.tv_usec;
+    } else {
+        // driver without monotonic stamps, dequeue time is the best we have
+        frame.meta.timestamp_us = MonotonicUs();
+    }
+
+    // the buffer is queued again by ReleaseFrame once every consumer is done
+    in_flight_.fetch_add(1, std::memory_order_relaxed);
+    auto sequence = frame.meta.sequence;
+    callback_(FrameRef::Adopt(&frame));
+    if (metrics_ != nullptr) {
+        auto callback_end_us = MonotonicUs();
+        metrics_->callback.Observe(callback_end_us - dequeue_us);
+        FrameTracer::Record(TraceSpan::Dequeue, metrics_->trace_stream, sequence, wait_start_us, dequeue_us);
+        FrameTracer::Record(TraceSpan::Callback, metrics_->trace_stream, sequence, dequeue_us, callback_end_us);
     }
     return true;
 }
 
-bool VideoCapture::Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback)
+bool VideoCapture::ReactorWait(void)
 {
-    assert(buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-    callback_mp_ = callback;
-    if (VideoIoctl(fd_, VIDIOC_STREAMON, &buf_type_) < 0) {
-        spdlog::error("VIDIOC_STREAMON failed");
+    {
+        std::lock_guard<std::mutex> lock(reactor_mutex_);
+        reactor_event_ = ReactorEvent::None;
+    }
+    // without a signal the stream is off and epoll reports EPOLLERR right
+    // away, the handler then looks for events every 200ms
+    uint32_t events = no_signal_ ? EPOLLPRI : EPOLLIN | (source_events_ ? EPOLLPRI : 0);
+    uint32_t timeout_ms = no_signal_ ? 0 : timeout_ * 1000;
+    wait_start_us_ = MonotonicUs();
+    if (!reactor_->Add(fd_, events, timeout_ms, [this](uint32_t events) { return OnReactorEvent(events); })) {
         return false;
     }
 
-    std::vector<PlaneData> date_ret(video_info_.num_planes);
-    struct v4l2_plane* tmp_plane = (struct v4l2_plane*)calloc(video_info_.num_planes, sizeof(*tmp_plane));
+    ReactorEvent event;
+    {
+        std::unique_lock<std::mutex> lock(reactor_mutex_);
+        // Stop only clears is_running_, SetPaused only the flag
+        while (reactor_event_ == ReactorEvent::None && is_running_ && !Paused()) {
+            reactor_cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        event = reactor_event_;
+    }
+    // no frame is dequeued once it returns
+    reactor_->Remove(fd_);
 
-    fd_set fds;
-    timeval* tv = nullptr;
-    if (timeout_ != 0) {
-        tv = (timeval*)malloc(sizeof(timeval));
-        tv->tv_sec = timeout_;
-        tv->tv_usec = 0;
+    switch (event) {
+    case ReactorEvent::Events:
+        if (!HandleEvents()) {
+            return false;
+        }
+        has_sequence_ = false;
+        return true;
+    case ReactorEvent::Timeout:
+        spdlog::error("capture {} timeout", video_path_);
+        return false;
+    case ReactorEvent::Error:
+        spdlog::error("capture {} poll error", video_path_);
+        return false;
+    default:
+        return true;
+    }
+}
+
+int VideoCapture::HandBack(ReactorEvent event)
+{
+    {
+        std::lock_guard<std::mutex> lock(reactor_mutex_);
+        reactor_event_ = event;
+    }
+    reactor_cv_.notify_all();
+    return -1;
+}
+
+int VideoCapture::OnReactorEvent(uint32_t events)
+{
+    if (!is_running_ || Paused()) {
+        return HandBack(ReactorEvent::Wake);
+    }
+    if (events == 0) {
+        return HandBack(ReactorEvent::Timeout);
+    }
+    // source changes block (frames have to come back), not on this thread
+    if (events & EPOLLPRI) {
+        return HandBack(ReactorEvent::Events);
+    }
+    if (no_signal_) {
+        return 200;
+    }
+    if (events & EPOLLIN) {
+        // every ready buffer, one wakeup may stand for several frames
+        while (is_running_ && DequeueFrame(wait_start_us_)) { }
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        // e.g. the device was unplugged
+        return HandBack(ReactorEvent::Error);
     }
+    wait_start_us_ = MonotonicUs();
+    return 0;
+}
+
+bool VideoCapture::Setup(const std::function<void(PlaneData&, int dma_fd)>& callback)
+{
+    return Loop([callback](FrameRef frame) {
+        callback(frame->planes[0], frame->dma_fd);
+    });
+}
+
+bool VideoCapture::Setup(const std::function<void(std::vector<PlaneData>&, int dma_fd)>& callback)
+{
+    return Loop([callback](FrameRef frame) {
+        callback(frame->planes, frame->dma_fd);
+    });
+}
+
+bool VideoCapture::Setup(const std::function<void(FrameRef)>& callback)
+{
+    return Loop(callback);
+}
+
+void VideoCapture::ReleaseFrame(VideoFrame& frame)
+{
     struct v4l2_buffer buf;
-    while (is_running_) {
-        FD_ZERO(&fds);
-        FD_SET(fd_, &fds);
-        tv->tv_sec = timeout_;
-        auto r = select(fd_ + 1, &fds, NULL, NULL, tv);
-        if (-1 == r) {
-            if (EINTR == errno)
-                continue;
-            spdlog::error("select err {}", strerror(errno));
-        }
-        if (0 == r) {
-            spdlog::error("select timeout");
-            break;
-        }
-        std::memset(&buf, 0, sizeof(buf));
-        buf.type = buf_type_;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.m.planes = tmp_plane;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.index = frame.index;
+    buf.type = buf_type_;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
         buf.length = video_info_.num_planes;
+        buf.m.planes = planes_buffers_[frame.index];
+    }
 
-        if (VideoIoctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
-            spdlog::error("dqbuf fail {}", strerror(errno));
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        if (!streaming_ || frame.index >= buffer_state_.size()) {
+            // queued again by StreamOn
+            if (frame.index < buffer_state_.size()) {
+                buffer_state_[frame.index] = BufferState::Free;
+            }
+        } else if (fd_ != -1 && VideoIoctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+            spdlog::error("failture VIDIOC_QBUF {}", frame.index);
+        } else {
+            buffer_state_[frame.index] = BufferState::Queued;
         }
+    }
+    in_flight_.fetch_sub(1, std::memory_order_release);
+}
 
-        if (buf.index > buf_count_) {
-            spdlog::error("VIDIOC_DQBUF error {}", buf.index);
-            continue;
-        }
+void VideoCapture::Stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(reactor_mutex_);
+        is_running_ = false;
+    }
+    reactor_cv_.notify_all();
+}
 
-        for (int j = 0; j < video_info_.num_planes; j++) {
-            date_ret[j].start = planes_data_[buf.index].data[j].start;
-            date_ret[j].size = (tmp_plane + j)->bytesused;
-        }
+bool VideoCapture::WaitFramesReturned(uint32_t timeout_ms)
+{
+    for (uint32_t i = 0; in_flight_.load(std::memory_order_acquire) != 0 && i < timeout_ms / 10; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (in_flight_.load(std::memory_order_acquire) != 0) {
+        spdlog::warn("{} frames still in flight", in_flight_.load());
+        return false;
+    }
+    return true;
+}
 
-        callback_mp_(date_ret, planes_data_[buf.index].dma_fd);
+bool VideoCapture::HandleEvents(void)
+{
+    struct v4l2_event event;
+    bool changed = false;
+    while (true) {
+        std::memset(&event, 0, sizeof(event));
+        if (ioctl(fd_, VIDIOC_DQEVENT, &event) < 0) {
+            break;
+        }
+        if (event.type == V4L2_EVENT_SOURCE_CHANGE
+            && (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+            changed = true;
+        }
+        if (event.pending == 0) {
+            break;
+        }
+    }
+    return !changed || Renegotiate();
+}
 
-        if (VideoIoctl(fd_, VIDIOC_QBUF, &buf) < 0) {
-            spdlog::error("failture VIDIOC_QBUF");
+bool VideoCapture::ApplyDvTimings(void)
+{
+    struct v4l2_dv_timings timings;
+    std::memset(&timings, 0, sizeof(timings));
+    if (ioctl(fd_, VIDIOC_QUERY_DV_TIMINGS, &timings) < 0) {
+        // not a DV receiver, the format is all there is
+        if (errno == ENOTTY || errno == ENODATA) {
+            return true;
         }
+        // ENOLINK / ENOLCK: cable out or the receiver is not locked yet
+        spdlog::warn("No signal on {}: {}", video_path_, strerror(errno));
+        return false;
+    }
+    if (ioctl(fd_, VIDIOC_S_DV_TIMINGS, &timings) < 0 && errno != ENOTTY) {
+        spdlog::warn("Set dv timings {}x{} error {}", (uint32_t)timings.bt.width, (uint32_t)timings.bt.height,
+            strerror(errno));
     }
+    return true;
+}
 
-    if (VideoIoctl(fd_, VIDIOC_STREAMOFF, &buf_type_) < 0) {
-        spdlog::error("VIDIOC_STREAMOFF fail");
+bool VideoCapture::Renegotiate(void)
+{
+    if (change_start_us_ == 0) {
+        change_start_us_ = MonotonicUs();
+    }
+    if (metrics_ != nullptr) {
+        metrics_->source_changes.Add();
+    }
+    spdlog::info("Source change on {}", video_path_);
+
+    if (streaming_ && !StreamOff()) {
+        return false;
+    }
+    // the buffers may go away, every consumer has to be done with them
+    if (!WaitFramesReturned(1000)) {
         return false;
     }
+    no_signal_ = !ApplyDvTimings();
+    if (no_signal_) {
+        // stream off until the next source change
+        return true;
+    }
 
-    free(tmp_plane);
+    auto old_info = video_info_;
+    if (!CheckVideoFormat()) {
+        spdlog::info("Current format of {} is not usable as is", video_path_);
+    }
+    if (SameLayout(video_info_, old_info)) {
+        // e.g. a replug at the same resolution, the buffers still fit
+        spdlog::info("Capture {} keeps {}x{}", video_path_, video_info_.width, video_info_.height);
+        video_info_ = old_info;
+    } else {
+        // S_FMT is refused while buffers are allocated
+        auto buf_count = buf_count_;
+        ReleaseBuffers();
+        ReqVideoBuffers(0);
+        if (!NegotiateVideoFormat() || ReqVideoBuffers(buf_count) == 0 || !QueryVideoBuffers()
+            || !QueueVideoBuffers()) {
+            return false;
+        }
+        spdlog::info("Capture {} now {} {}x{}", video_path_, video_info_.pixelformat, video_info_.width,
+            video_info_.height);
+        if (format_callback_ && !format_callback_(video_info_)) {
+            return false;
+        }
+    }
 
-    return false;
+    // a paused loop streams on when it resumes
+    if (!Paused() && !StreamOn()) {
+        return false;
+    }
+    return true;
 }
 
-void VideoCapture::Deinit(void)
+void VideoCapture::ReleaseBuffers(void)
 {
-    is_running_ = false;
-    for (int i = 0; i < buf_count_; i++) {
-        for (int j = 0; j < video_info_.num_planes; j++)
-            if (MAP_FAILED != planes_data_[i].data[j].start) {
-                if (-1 == munmap(planes_data_[i].data[j].start, (planes_buffers_[i] + j)->length)) {
-                    planes_data_[i].data[j].start = MAP_FAILED;
-                    spdlog::error("munmap error {}", strerror(errno));
-                }
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        buffer_state_.clear();
+    }
+    for (auto& buffer : planes_data_) {
+        for (auto& plane : buffer.data) {
+            if (MAP_FAILED != plane.start && -1 == munmap(plane.start, plane.size)) {
+                spdlog::error("munmap error {}", strerror(errno));
             }
+            plane.start = MAP_FAILED;
+        }
+        if (buffer.dma_fd != -1) {
+            ::close(buffer.dma_fd);
+            buffer.dma_fd = -1;
+        }
     }
+    planes_data_.clear();
+    frames_.clear();
+
     for (auto& item : planes_buffers_) {
         if (item != nullptr) {
             free(item);
             item = nullptr;
         }
     }
+}
+
+void VideoCapture::Deinit(void)
+{
+    is_running_ = false;
+
+    // consumers may still hold frames (the snapshot thread up to its timeout),
+    // nothing is unmapped or closed under them, the next Deinit tries again
+    if (!WaitFramesReturned(1000)) {
+        return;
+    }
+    ReleaseBuffers();
 
     if (fd_ != -1) {
         ::close(fd_);
@@ -490,22 +1003,32 @@ void VideoCapture::Deinit(void)
 
 bool VideoCapture::Reset(void)
 {
+    // the caller backs off between attempts
+    auto old_info = video_info_;
     Deinit();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-   
+    if (in_flight_.load(std::memory_order_acquire) != 0) {
+        spdlog::warn("Reset {} later, its buffers are still referenced", video_path_);
+        return false;
+    }
     if (!Init()) {
         spdlog::error("Reset VideoCapture failed");
         return false;
     }
-    is_running_ = true;
-    if (buf_type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-        return Setup(callback_mp_);
-    } else {
-        return Setup(callback_op_);
+    // e.g. replugged to another resolution on a device without source change events
+    if (format_callback_ && !SameLayout(video_info_, old_info) && !format_callback_(video_info_)) {
+        return false;
     }
+    is_running_ = true;
+    return Loop(callback_);
 }
 
 VideoCapture::~VideoCapture(void)
 {
+    // waits a bounded time, a consumer that never returns its frame must not hang the shutdown
     Deinit();
+    auto in_flight = in_flight_.load(std::memory_order_acquire);
+    if (in_flight != 0) {
+        // what still holds a frame keeps reading valid memory, the mappings and the fd are leaked instead
+        spdlog::error("{} leaks its buffers, {} frames never returned", video_path_, in_flight);
+    }
 }
\ No newline at end of file